@@ -0,0 +1,468 @@
+/**
+ * @file blist.c
+ * Adjusts the Buddy List's tree view to suit the merged window layout
+ *
+ * GtkTreeView measures the cells of every row to size its columns and rows.
+ * In the merged window, the Buddy List pane is allocated again whenever the
+ * window or pane slider changes size, which can re-measure thousands of rows.
+ * The functions in this file can switch the tree view to fixed-size columns
+ * and rows, so it only needs to measure a single row.  That is only correct
+ * while every row has the same height, so it is turned off while buddy icons
+ * are shown or any contact is expanded to list its buddies.
+ *
+ * The Buddy List pane can also be collapsed to a thin strip.  Its notebook is
+ * then taken out of the window entirely, so presence changes only update the
+ * tree model, and the unrealized tree view is laid out again in one pass when
+ * the pane is expanded.
+ *
+ * @section LICENSE
+ * Copyright (C) 2012 David Michael <fedora.dm0@gmail.com>
+ *
+ * This file is part of Window Merge.
+ *
+ * Window Merge is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * Window Merge is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Window Merge.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "plugin.h"
+
+#include <gtkblist.h>
+#include <gtkconv.h>
+
+#include <prefs.h>
+
+#include "window_merge.h"
+
+
+/**
+ * Give the filler column of the Buddy List tree the width left by the others
+ *
+ * Fixed-width columns don't follow the pane as it is resized, so the last
+ * expanding (or else the last visible) column is given the remaining width.
+ * This also sets the width of a column that was unallocated when it was fixed.
+ *
+ * @param[in] widget     The Buddy List tree view
+**/
+static void
+size_columns(GtkWidget *widget)
+{
+  GtkTreeViewColumn *column;    /*< A column of the Buddy List tree view     */
+  GtkTreeViewColumn *filler;    /*< The column given the remaining width     */
+  GtkAllocation allocation;     /*< The size allocated to the tree view      */
+  GList *columns;               /*< The columns of the tree view             */
+  GList *item;                  /*< A column in the list (iteration)         */
+  gint width;                   /*< The width left over for the filler       */
+
+  gtk_widget_get_allocation(widget, &allocation);
+  columns = gtk_tree_view_get_columns(GTK_TREE_VIEW(widget));
+  filler = NULL;
+  for ( item = columns; item != NULL; item = item->next ) {
+    column = item->data;
+    if ( gtk_tree_view_column_get_visible(column) &&
+         (filler == NULL || !gtk_tree_view_column_get_expand(filler) ||
+          gtk_tree_view_column_get_expand(column)) )
+      filler = column;
+  }
+
+  /* Subtract every other visible column from the allocated width. */
+  width = allocation.width;
+  for ( item = columns; item != NULL; item = item->next ) {
+    column = item->data;
+    if ( column != filler && gtk_tree_view_column_get_visible(column) )
+      width -= gtk_tree_view_column_get_width(column);
+  }
+  g_list_free(columns);
+
+  /* Only resize the filler when it changes, since that allocates again. */
+  if ( filler != NULL && width > 0 &&
+       width != gtk_tree_view_column_get_fixed_width(filler) )
+    gtk_tree_view_column_set_fixed_width(filler, width);
+}
+
+
+/**
+ * An idle callback to size the Buddy List columns after it was allocated
+ *
+ * @param[in] data       Pointer to the Buddy List whose tree was allocated
+ * @return               Whether to call this function again
+**/
+static gboolean
+size_columns_idle_cb(gpointer data)
+{
+  PidginBuddyList *gtkblist;    /*< The Buddy List whose tree was allocated  */
+
+  gtkblist = data;
+  pwm_clear(gtkblist, "columns_idle");
+  size_columns(gtkblist->treeview);
+
+  return FALSE;
+}
+
+
+/**
+ * A callback for when the Buddy List tree view is allocated its size
+ *
+ * Resizing a column from here would queue another allocation within this
+ * one, so the columns are sized when idle, once for any number of
+ * allocations (e.g. while the pane is being dragged).
+ *
+ * @param[in] widget     Unused
+ * @param[in] allocation Unused
+ * @param[in] data       Pointer to the Buddy List whose tree was allocated
+**/
+static void
+treeview_size_allocate_cb(U GtkWidget *widget, U GtkAllocation *allocation,
+                          gpointer data)
+{
+  if ( pwm_fetch((PidginBuddyList *)data, "columns_idle") == NULL )
+    pwm_store(data, "columns_idle",
+              GUINT_TO_POINTER(g_idle_add(size_columns_idle_cb, data)));
+}
+
+
+/**
+ * Toggle fixed-height rows and fixed-width columns in the Buddy List tree
+ *
+ * The original sizing of each column is stored on the column, so it can be
+ * restored when the Buddy List is split or the preference is disabled.  Every
+ * row takes the height of the first row while this is enabled.
+ *
+ * @param[in] gtkblist   The Buddy List whose tree view is being changed
+ * @param[in] fixed      Whether rows should have fixed sizes
+**/
+void
+pwm_set_blist_fixed_rows(PidginBuddyList *gtkblist, gboolean fixed)
+{
+  GtkTreeViewColumn *column;    /*< A column of the Buddy List tree view     */
+  GtkTreeView *treeview;        /*< The Buddy List tree view                 */
+  GList *columns;               /*< The columns of the tree view             */
+  GList *item;                  /*< A column in the list (iteration)         */
+  gpointer sizing;              /*< The stored original sizing of a column   */
+  gint width;                   /*< The current width of a column            */
+
+  /* Sanity check: Only change a Buddy List that has a tree view. */
+  if ( gtkblist == NULL || gtkblist->treeview == NULL )
+    return;
+
+  treeview = GTK_TREE_VIEW(gtkblist->treeview);
+
+  /* Sanity check: Don't change the tree view if it is already set. */
+  if ( gtk_tree_view_get_fixed_height_mode(treeview) == fixed )
+    return;
+
+  /* The fixed height mode must be off before columns can be measured again. */
+  if ( !fixed ) {
+    gtk_tree_view_set_fixed_height_mode(treeview, FALSE);
+    g_object_disconnect(G_OBJECT(treeview), "any_signal",
+                        G_CALLBACK(treeview_size_allocate_cb), gtkblist,
+                        NULL);
+    if ( pwm_fetch(gtkblist, "columns_idle") != NULL )
+      g_source_remove(GPOINTER_TO_UINT(pwm_clear(gtkblist, "columns_idle")));
+  }
+
+  columns = gtk_tree_view_get_columns(treeview);
+  for ( item = columns; item != NULL; item = item->next ) {
+    column = item->data;
+
+    /* Keep the current width, and remember how the column was sized. */
+    if ( fixed ) {
+      width = gtk_tree_view_column_get_width(column);
+      if ( width > 0 )
+        gtk_tree_view_column_set_fixed_width(column, width);
+      g_object_set_data(G_OBJECT(column), "pwm_sizing",
+                        GINT_TO_POINTER(
+                          gtk_tree_view_column_get_sizing(column) + 1));
+      gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+    }
+
+    /* Restore the column's original sizing, if it was stored. */
+    else {
+      sizing = g_object_steal_data(G_OBJECT(column), "pwm_sizing");
+      if ( sizing != NULL )
+        gtk_tree_view_column_set_sizing(column,
+                                        GPOINTER_TO_INT(sizing) - 1);
+    }
+  }
+  g_list_free(columns);
+
+  /* Only measure a single row now that every column has a fixed size. */
+  if ( fixed ) {
+    gtk_tree_view_set_fixed_height_mode(treeview, TRUE);
+    g_object_connect(G_OBJECT(treeview), "signal::size-allocate",
+                     G_CALLBACK(treeview_size_allocate_cb), gtkblist, NULL);
+
+    /* Size the columns now if the tree view was already allocated. */
+    if ( gtk_widget_get_realized(GTK_WIDGET(treeview)) )
+      size_columns(GTK_WIDGET(treeview));
+  }
+}
+
+
+/**
+ * Measure the height of a row of the Buddy List tree as it would be drawn
+ *
+ * @param[in] treeview   The Buddy List tree view
+ * @param[in] row        The row to measure
+ * @return               The height of the tallest cell in the row
+**/
+static gint
+get_row_height(GtkTreeView *treeview, GtkTreeIter *row)
+{
+  GtkTreeViewColumn *column;    /*< A column of the Buddy List tree view     */
+  GtkTreeModel *model;          /*< The Buddy List tree model                */
+  GList *columns;               /*< The columns of the tree view             */
+  GList *item;                  /*< A column in the list (iteration)         */
+  gint height = 0;              /*< The height of the row                    */
+  gint cell_height;             /*< The height of a column's cells           */
+
+  model = gtk_tree_view_get_model(treeview);
+  columns = gtk_tree_view_get_columns(treeview);
+  for ( item = columns; item != NULL; item = item->next ) {
+    column = item->data;
+    if ( !gtk_tree_view_column_get_visible(column) )
+      continue;
+    gtk_tree_view_column_cell_set_cell_data(column, model, row,
+      gtk_tree_model_iter_has_child(model, row), FALSE);
+    gtk_tree_view_column_cell_get_size(column, NULL, NULL, NULL, NULL,
+                                       &cell_height);
+    height = MAX(height, cell_height);
+  }
+  g_list_free(columns);
+
+  return height;
+}
+
+
+/**
+ * Return whether every row of the Buddy List tree has the same height
+ *
+ * Buddy icons make rows taller than groups, and an expanded contact lists its
+ * buddies in rows with different content, so either would be cut off or
+ * padded out to the height of the first row.  Group rows are drawn unlike the
+ * rows beneath them, so the first group row is measured against its first
+ * child as well.
+ *
+ * @param[in] gtkblist   The Buddy List whose rows are checked
+ * @return               Whether fixed-height rows can be used
+**/
+static gboolean
+blist_rows_uniform(PidginBuddyList *gtkblist)
+{
+  PurpleBlistNode *node;        /*< A Buddy List node (iteration)            */
+  PidginBlistNode *gtknode;     /*< The Pidgin data of a contact node        */
+  GtkTreeModel *model;          /*< The Buddy List tree model                */
+  GtkTreeIter group;            /*< A group row of the tree                  */
+  GtkTreeIter child;            /*< The first row in the group               */
+
+  if ( purple_prefs_get_bool(PIDGIN_PREFS_ROOT "/blist/show_buddy_icons") )
+    return FALSE;
+
+  for ( node = purple_blist_get_root(); node != NULL;
+        node = purple_blist_node_next(node, TRUE) ) {
+    if ( !PURPLE_BLIST_NODE_IS_CONTACT(node) )
+      continue;
+    gtknode = node->ui_data;
+    if ( gtknode != NULL && gtknode->contact_expanded )
+      return FALSE;
+  }
+
+  /* Compare the first group that has rows with the first of its rows. */
+  model = GTK_TREE_MODEL(gtkblist->treemodel);
+  if ( !gtk_tree_model_get_iter_first(model, &group) )
+    return TRUE;
+  while ( !gtk_tree_model_iter_children(model, &child, &group) )
+    if ( !gtk_tree_model_iter_next(model, &group) )
+      return TRUE;
+
+  return get_row_height(GTK_TREE_VIEW(gtkblist->treeview), &group) ==
+         get_row_height(GTK_TREE_VIEW(gtkblist->treeview), &child);
+}
+
+
+/**
+ * An idle callback to check the Buddy List rows after the tree has changed
+ *
+ * @param[in] data       Pointer to the merged Buddy List
+ * @return               Whether to call this function again
+**/
+static gboolean
+rows_changed_idle_cb(gpointer data)
+{
+  pwm_clear((PidginBuddyList *)data, "rows_idle");
+  pwm_update_blist_fixed_rows(data);
+
+  return FALSE;
+}
+
+
+/**
+ * A callback for when a row of the Buddy List tree gains or loses children
+ *
+ * Expanding or collapsing a contact adds or removes its buddy rows, so the
+ * rows are checked again once Pidgin has finished updating the tree.
+ *
+ * @param[in] model      Unused
+ * @param[in] path       Unused
+ * @param[in] iter       Unused
+ * @param[in] data       Pointer to the merged Buddy List
+**/
+static void
+row_has_child_toggled_cb(U GtkTreeModel *model, U GtkTreePath *path,
+                         U GtkTreeIter *iter, gpointer data)
+{
+  if ( pwm_fetch((PidginBuddyList *)data, "rows_idle") == NULL )
+    pwm_store(data, "rows_idle",
+              GUINT_TO_POINTER(g_idle_add(rows_changed_idle_cb, data)));
+}
+
+
+/**
+ * Use fixed-height rows in a merged Buddy List only while they fit its rows
+ *
+ * @param[in] gtkblist   The merged Buddy List whose tree view is checked
+**/
+void
+pwm_update_blist_fixed_rows(PidginBuddyList *gtkblist)
+{
+  pwm_set_blist_fixed_rows(gtkblist,
+                           pwm_blist_get_convs(gtkblist) != NULL &&
+                           purple_prefs_get_bool(PREF_ROWS) &&
+                           blist_rows_uniform(gtkblist));
+}
+
+
+/**
+ * Start choosing fixed-height rows for a merged Buddy List as its tree changes
+ *
+ * @param[in] gtkblist   The merged Buddy List whose tree view is watched
+**/
+void
+pwm_init_blist_rows(PidginBuddyList *gtkblist)
+{
+  g_object_connect(G_OBJECT(gtkblist->treemodel),
+                   "signal::row-has-child-toggled",
+                   G_CALLBACK(row_has_child_toggled_cb), gtkblist, NULL);
+  pwm_update_blist_fixed_rows(gtkblist);
+}
+
+
+/**
+ * Stop watching the Buddy List tree, and measure its rows normally again
+ *
+ * @param[in] gtkblist   The Buddy List whose tree view was watched
+**/
+void
+pwm_free_blist_rows(PidginBuddyList *gtkblist)
+{
+  g_object_disconnect(G_OBJECT(gtkblist->treemodel), "any_signal",
+                      G_CALLBACK(row_has_child_toggled_cb), gtkblist, NULL);
+  if ( pwm_fetch(gtkblist, "rows_idle") != NULL )
+    g_source_remove(GPOINTER_TO_UINT(pwm_clear(gtkblist, "rows_idle")));
+  pwm_set_blist_fixed_rows(gtkblist, FALSE);
+}
+
+
+/**
+ * A callback for when the strip of a collapsed Buddy List pane is clicked
+ *
+ * @param[in] button     Unused
+ * @param[in] data       Pointer to the Buddy List that was collapsed
+**/
+static void
+strip_clicked_cb(U GtkButton *button, gpointer data)
+{
+  pwm_set_blist_collapsed(data, FALSE);
+}
+
+
+/**
+ * Collapse the Buddy List pane to a thin strip, or expand it again
+ *
+ * While collapsed, the Buddy List notebook is held outside of the window, so
+ * its tree view is unrealized and its rows aren't measured or drawn as the
+ * model changes.  The strip left in its pane expands it when clicked.
+ *
+ * @param[in] gtkblist   The merged Buddy List whose pane is changed
+ * @param[in] collapsed  Whether the Buddy List pane should be collapsed
+**/
+void
+pwm_set_blist_collapsed(PidginBuddyList *gtkblist, gboolean collapsed)
+{
+  GtkArrowType arrow_type;      /*< The direction the Buddy List would open  */
+  GtkWidget *paned;             /*< The panes of the merged window           */
+  GtkWidget *strip;             /*< Stands in for the collapsed Buddy List   */
+  gboolean first;               /*< Whether the Buddy List is the first pane */
+
+  paned = pwm_fetch(gtkblist, "paned");
+  strip = pwm_fetch(gtkblist, "blist_strip");
+
+  /* Sanity check: Only change the panes of a merged Buddy List. */
+  if ( pwm_blist_get_convs(gtkblist) == NULL || paned == NULL ||
+       collapsed == (strip != NULL) )
+    return;
+
+  pwm_record_event(gtkblist, G_STRFUNC, NULL);
+  pwm_watchdog_enter(G_STRFUNC);
+
+  if ( collapsed ) {
+    first = gtk_paned_get_child1(GTK_PANED(paned)) == gtkblist->notebook;
+    if ( GTK_IS_VPANED(paned) )
+      arrow_type = first ? GTK_ARROW_DOWN : GTK_ARROW_UP;
+    else
+      arrow_type = first ? GTK_ARROW_RIGHT : GTK_ARROW_LEFT;
+
+    strip = gtk_button_new();
+    gtk_button_set_relief(GTK_BUTTON(strip), GTK_RELIEF_NONE);
+    gtk_button_set_focus_on_click(GTK_BUTTON(strip), FALSE);
+    gtk_container_add(GTK_CONTAINER(strip),
+                      gtk_arrow_new(arrow_type, GTK_SHADOW_NONE));
+    /* TRANSLATORS: This is the tooltip of the thin strip that replaces the
+       collapsed Buddy List in the Buddy List window. */
+    gtk_widget_set_tooltip_text(strip, _("Show the Buddy List"));
+    g_object_connect(G_OBJECT(strip), "signal::clicked",
+                     G_CALLBACK(strip_clicked_cb), gtkblist, NULL);
+    gtk_widget_show_all(strip);
+
+    /* Remember the slider, since the strip's size shouldn't be saved. */
+    pwm_store(gtkblist, "blist_strip", strip);
+    pwm_update_idle_layout(gtkblist);
+    pwm_store(gtkblist, "blist_position",
+              GINT_TO_POINTER(gtk_paned_get_position(GTK_PANED(paned))));
+
+    /* Hold the Buddy List outside the window, and put the strip in place. */
+    g_object_ref(G_OBJECT(gtkblist->notebook));
+    gtk_container_remove(GTK_CONTAINER(paned), gtkblist->notebook);
+    if ( first )
+      gtk_paned_pack1(GTK_PANED(paned), strip, FALSE, FALSE);
+    else
+      gtk_paned_pack2(GTK_PANED(paned), strip, FALSE, FALSE);
+    gtk_paned_set_position(GTK_PANED(paned), first ? 0 : G_MAXINT);
+  } else {
+    first = gtk_paned_get_child1(GTK_PANED(paned)) == strip;
+    gtk_widget_destroy(strip);
+
+    /* Put the Buddy List back where the strip was, at its former size. */
+    if ( first )
+      gtk_paned_pack1(GTK_PANED(paned), gtkblist->notebook, FALSE, TRUE);
+    else
+      gtk_paned_pack2(GTK_PANED(paned), gtkblist->notebook, FALSE, TRUE);
+    g_object_unref(G_OBJECT(gtkblist->notebook));
+    gtk_paned_set_position(GTK_PANED(paned),
+      GPOINTER_TO_INT(pwm_fetch(gtkblist, "blist_position")));
+    pwm_clear(gtkblist, "blist_position");
+    pwm_clear(gtkblist, "blist_strip");
+    pwm_update_idle_layout(gtkblist);
+  }
+
+  pwm_watchdog_leave();
+}
@@ -0,0 +1,295 @@
+/**
+ * @file census.c
+ * Counts the widgets and windows making up the merged window for leak hunting
+ *
+ * A census walks every widget reachable from the merged window, including
+ * submenus and the widgets the plugin keeps outside of it (the conversation
+ * window's own toplevel and a collapsed Buddy List).  Widgets are counted by
+ * type, along with realized widgets, native windows, accelerator groups, and
+ * the size of each conversation's text.  Each census is written to its own
+ * JSON file, so censuses from different times can be compared to find which
+ * part of the plugin is accumulating widgets.
+ *
+ * @section LICENSE
+ * Copyright (C) 2012 David Michael <fedora.dm0@gmail.com>
+ *
+ * This file is part of Window Merge.
+ *
+ * Window Merge is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * Window Merge is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Window Merge.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "plugin.h"
+
+#include <gtkblist.h>
+#include <gtkconv.h>
+
+#include <conversation.h>
+
+#include <string.h>
+#include <time.h>
+
+#include "window_merge.h"
+
+
+/**
+ * The counts for one widget tree in a census
+**/
+typedef struct {
+  GHashTable *types;            /*< Number of widgets of each type name      */
+  guint widgets;                /*< Number of widgets in the tree            */
+  guint realized;               /*< Number of realized widgets               */
+  guint windowed;               /*< Realized widgets with their own window   */
+} PwmCensus;
+
+
+/**
+ * Append a string to JSON text as a quoted and escaped JSON string
+ *
+ * @param[in] json       The JSON text being written
+ * @param[in] str        The UTF-8 string to append, or NULL for null
+**/
+static void
+append_string(GString *json, const gchar *str)
+{
+  if ( str == NULL ) {
+    g_string_append(json, "null");
+    return;
+  }
+
+  g_string_append_c(json, '"');
+  for ( ; *str != '\0'; str++ )
+    if ( *str == '"' || *str == '\\' )
+      g_string_append_printf(json, "\\%c", *str);
+    else if ( (guchar)*str < 0x20 )
+      g_string_append_printf(json, "\\u%04x", (guchar)*str);
+    else
+      g_string_append_c(json, *str);
+  g_string_append_c(json, '"');
+}
+
+
+/**
+ * Count a widget and every widget inside it, including internal children
+ *
+ * Submenus are counted with the menu items that own them, since they are
+ * separate toplevels that would otherwise be missed.
+ *
+ * @param[in] widget     The widget to count
+ * @param[in] data       The census of the widget's tree
+**/
+static void
+count_widget(GtkWidget *widget, gpointer data)
+{
+  PwmCensus *census;            /*< The census of the widget's tree          */
+  GtkWidget *submenu;           /*< The submenu of a menu item               */
+  const gchar *type;            /*< The type name of the widget              */
+
+  census = data;
+  type = G_OBJECT_TYPE_NAME(widget);
+  g_hash_table_insert(census->types, (gpointer)type, GUINT_TO_POINTER(
+    GPOINTER_TO_UINT(g_hash_table_lookup(census->types, type)) + 1));
+  census->widgets++;
+
+  if ( gtk_widget_get_realized(widget) ) {
+    census->realized++;
+    if ( gtk_widget_get_has_window(widget) )
+      census->windowed++;
+  }
+
+  if ( GTK_IS_CONTAINER(widget) )
+    gtk_container_forall(GTK_CONTAINER(widget), count_widget, census);
+
+  if ( GTK_IS_MENU_ITEM(widget) ) {
+    submenu = gtk_menu_item_get_submenu(GTK_MENU_ITEM(widget));
+    if ( submenu != NULL )
+      count_widget(gtk_widget_get_toplevel(submenu), census);
+  }
+}
+
+
+/**
+ * Count a native window and all of its descendants
+ *
+ * @param[in] window     The window to count
+ * @return               The number of windows, including window
+**/
+static guint
+count_windows(GdkWindow *window)
+{
+  GList *child;                 /*< A child window (iteration)               */
+  guint count = 1;              /*< The number of windows counted            */
+
+  for ( child = gdk_window_peek_children(window); child != NULL;
+        child = child->next )
+    count += count_windows(child->data);
+
+  return count;
+}
+
+
+/**
+ * Append the census of a widget tree to the JSON text
+ *
+ * @param[in] json       The JSON text being written
+ * @param[in] name       What the widget tree is in the merged window
+ * @param[in] root       The top widget of the tree
+**/
+static void
+append_tree(GString *json, const gchar *name, GtkWidget *root)
+{
+  PwmCensus census;             /*< The counts for the tree                  */
+  GHashTableIter iter;          /*< Iterates over the widget types           */
+  GdkWindow *window;            /*< The native window of the tree, if any    */
+  GSList *groups;               /*< The accelerator groups of a toplevel     */
+  gpointer type;                /*< The name of a widget type                */
+  gpointer count;               /*< The number of widgets of a type          */
+  gboolean first = TRUE;        /*< Whether no type has been written yet     */
+
+  memset(&census, 0, sizeof(census));
+  census.types = g_hash_table_new(g_str_hash, g_str_equal);
+  count_widget(root, &census);
+
+  window = gtk_widget_get_window(root);
+  groups = GTK_IS_WINDOW(root) ? gtk_accel_groups_from_object(G_OBJECT(root))
+                               : NULL;
+
+  g_string_append(json, "    {\n      \"name\": ");
+  append_string(json, name);
+  g_string_append_printf(json, ",\n      \"widgets\": %u,\n"
+                         "      \"realized\": %u,\n"
+                         "      \"windowed\": %u,\n"
+                         "      \"gdk_windows\": %u,\n"
+                         "      \"accel_groups\": %u,\n"
+                         "      \"types\": {",
+                         census.widgets, census.realized, census.windowed,
+                         gtk_widget_get_realized(root) && window != NULL ?
+                         count_windows(window) : 0, g_slist_length(groups));
+
+  g_hash_table_iter_init(&iter, census.types);
+  while ( g_hash_table_iter_next(&iter, &type, &count) ) {
+    g_string_append(json, first ? "\n        " : ",\n        ");
+    append_string(json, type);
+    g_string_append_printf(json, ": %u", GPOINTER_TO_UINT(count));
+    first = FALSE;
+  }
+  g_string_append(json, "\n      }\n    }");
+
+  g_hash_table_destroy(census.types);
+}
+
+
+/**
+ * Append the sizes of the text in each merged conversation to the JSON text
+ *
+ * @param[in] json       The JSON text being written
+ * @param[in] gtkconvwin The conversation window merged into the Buddy List
+**/
+static void
+append_tabs(GString *json, PidginWindow *gtkconvwin)
+{
+  PidginConversation *gtkconv;  /*< A merged conversation                    */
+  GtkTextBuffer *buffer;        /*< The message history of gtkconv           */
+  GList *item;                  /*< A conversation in the list (iteration)   */
+
+  for ( item = gtkconvwin->gtkconvs; item != NULL; item = item->next ) {
+    gtkconv = item->data;
+    g_string_append(json, item == gtkconvwin->gtkconvs ? "\n" : ",\n");
+
+    /* Placeholder tabs, such as the dummy tab, have no conversation text. */
+    if ( gtkconv->imhtml == NULL ) {
+      g_string_append(json, "    {\"name\": null, \"placeholder\": true}");
+      continue;
+    }
+
+    buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(gtkconv->imhtml));
+    g_string_append(json, "    {\"name\": ");
+    append_string(json, purple_conversation_get_name(gtkconv->active_conv));
+    g_string_append_printf(json, ", \"chars\": %d, \"lines\": %d, "
+                           "\"realized\": %s}",
+                           gtk_text_buffer_get_char_count(buffer),
+                           gtk_text_buffer_get_line_count(buffer),
+                           gtk_widget_get_realized(gtkconv->imhtml) ?
+                           "true" : "false");
+  }
+}
+
+
+/**
+ * Take a census of the merged window, and save it to a new JSON file
+ *
+ * @param[in] gtkblist   The merged Buddy List to count
+ * @return               A newly allocated path to the file, or NULL on error
+**/
+gchar *
+pwm_census_dump(PidginBuddyList *gtkblist)
+{
+  PidginWindow *gtkconvwin;     /*< Conversation window merged into gtkblist */
+  GtkWidget *conv_window;       /*< The conversation window's own window     */
+  GString *json;                /*< The JSON text of the census              */
+  gchar *suffix;                /*< The end of the census file name          */
+  gchar *path;                  /*< The path of the census file              */
+  char stamp[32];               /*< The time of the census                   */
+  time_t now;                   /*< The current time                         */
+
+  gtkconvwin = pwm_blist_get_convs(gtkblist);
+
+  /* Sanity check: Only count a merged window. */
+  if ( gtkconvwin == NULL )
+    return NULL;
+
+  pwm_record_event(gtkblist, G_STRFUNC, NULL);
+  now = time(NULL);
+  strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+  conv_window = pwm_fetch(gtkblist, "conv_window");
+
+  json = g_string_new("{\n  \"time\": ");
+  append_string(json, stamp);
+  g_string_append_printf(json, ",\n  \"tabs\": %u,\n  \"menus\": %u,\n"
+                         "  \"detached\": %s,\n  \"collapsed\": %s,\n"
+                         "  \"trees\": [\n",
+                         pidgin_conv_window_get_gtkconv_count(gtkconvwin),
+                         g_list_length(pwm_fetch(gtkblist, "conv_menus")),
+                         pwm_fetch(gtkblist, "detached") != NULL ?
+                         "true" : "false",
+                         pwm_fetch(gtkblist, "blist_strip") != NULL ?
+                         "true" : "false");
+
+  /* Count the merged window, and everything the plugin keeps outside it. */
+  append_tree(json, "blist_window", gtkblist->window);
+  if ( conv_window != NULL ) {
+    g_string_append(json, ",\n");
+    append_tree(json, "conv_window", conv_window);
+  }
+  if ( pwm_fetch(gtkblist, "blist_strip") != NULL ) {
+    g_string_append(json, ",\n");
+    append_tree(json, "collapsed_blist", gtkblist->notebook);
+  }
+
+  g_string_append(json, "\n  ],\n  \"conversations\": [");
+  append_tabs(json, gtkconvwin);
+  g_string_append(json, "\n  ]\n}\n");
+
+  /* Give every census its own file, so they can be compared later. */
+  suffix = g_strdup_printf("-census-%s.json", stamp);
+  path = pwm_user_file(suffix);
+  g_free(suffix);
+
+  if ( !g_file_set_contents(path, json->str, json->len, NULL) ) {
+    g_free(path);
+    path = NULL;
+  }
+  g_string_free(json, TRUE);
+
+  return path;
+}
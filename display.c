@@ -0,0 +1,513 @@
+/**
+ * @file display.c
+ * Holds back drawing messages in the merged window when it would be wasted
+ *
+ * Pidgin appends every message to its history as soon as it arrives, which
+ * scrolls the history, updates the tab, and (since the conversations share a
+ * window with the Buddy List) redraws parts of the Buddy List window.  A busy
+ * chat receiving hundreds of messages per second keeps the whole merged window
+ * from responding.
+ *
+ * When a merged conversation receives more messages per second than the rate
+ * in the PREF_FLOOD preference, its new messages are queued and written all
+ * at once about every frame, with the window's drawing held until the whole
+ * batch is written.  Each message is still written separately, so it keeps
+ * its own time stamp and name, and other plugins and loggers see every one.
+ * Conversations leave flood mode once the rate drops.
+ *
+ * While the merged window is unmapped, minimized, or withdrawn (e.g. to the
+ * system tray), nothing it displays can be seen.  If the PREF_QUIET preference
+ * is set, messages for its conversations are only queued then, and the
+ * conversations are marked as having unseen messages so notifications still
+ * work.  The queues are all written in one pass when the window can be seen
+ * again.  A window that is only covered by others is not counted as hidden,
+ * since compositing window managers can still show it, e.g. in previews.
+ *
+ * A queued message is only given to Pidgin when it is written, so Pidgin's
+ * "displaying" and "displayed" message signals are delayed along with it, and
+ * plugins using them (e.g. for notifications) see the message late.  This is
+ * why PREF_QUIET is off by default.
+ *
+ * @section LICENSE
+ * Copyright (C) 2012 David Michael <fedora.dm0@gmail.com>
+ *
+ * This file is part of Window Merge.
+ *
+ * Window Merge is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * Window Merge is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Window Merge.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "plugin.h"
+
+#include <gtkblist.h>
+#include <gtkconv.h>
+
+#include <conversation.h>
+#include <signals.h>
+
+#include "window_merge.h"
+
+/** Milliseconds between writing batches of queued messages (about a frame) */
+#define DISPLAY_FRAME 16
+
+
+/**
+ * A message waiting to be written to a conversation's history
+**/
+typedef struct {
+  gchar *name;                  /*< The name of the message's sender         */
+  gchar *alias;                 /*< The alias of the message's sender        */
+  gchar *message;               /*< The text of the message                  */
+  PurpleMessageFlags flags;     /*< The flags of the message                 */
+  time_t mtime;                 /*< The time the message was sent            */
+} PwmMessage;
+
+
+/**
+ * The message rate and queue of a conversation
+**/
+typedef struct {
+  gint64 window;                /*< Monotonic time the rate window began     */
+  gint count;                   /*< Messages received in the rate window     */
+  gboolean flooded;             /*< Whether new messages are being queued    */
+  gint unseen;                  /*< Unseen messages counted before writing   */
+  GQueue messages;              /*< The messages waiting to be written       */
+  guint timeout;                /*< The source ID of the next batch          */
+} PwmFlood;
+
+
+/**
+ * The state of the message display hooks
+**/
+static struct {
+  PurpleConversationUiOps *ops; /*< Pidgin's conversation UI operations      */
+  void (*write_conv)(PurpleConversation *, const char *, const char *,
+                     const char *, PurpleMessageFlags, time_t);
+                                /*< Pidgin's function writing messages       */
+  gint rate;                    /*< Messages per second to start batching    */
+  gboolean quiet;               /*< Whether to hold messages while hidden    */
+} display;
+
+
+/**
+ * Free a queued message
+ *
+ * @param[in] data       The message to free
+**/
+static void
+free_message(gpointer data)
+{
+  PwmMessage *msg;              /*< The message being freed                  */
+
+  msg = data;
+  g_free(msg->name);
+  g_free(msg->alias);
+  g_free(msg->message);
+  g_free(msg);
+}
+
+
+/**
+ * Return whether messages for a conversation are held until it can be seen
+ *
+ * @param[in] gtkconv    The Pidgin UI of the conversation
+ * @return               Whether gtkconv is in a merged window that is hidden
+**/
+static gboolean
+is_held(PidginConversation *gtkconv)
+{
+  PidginBuddyList *gtkblist;    /*< The Buddy List displaying gtkconv        */
+
+  gtkblist = gtkconv != NULL ?
+             pwm_convs_get_blist(pidgin_conv_get_window(gtkconv)) : NULL;
+
+  return display.quiet && gtkblist != NULL &&
+         pwm_fetch(gtkblist, "hidden") != NULL;
+}
+
+
+/**
+ * Mark a conversation as having an unseen message that is being held
+ *
+ * This follows how Pidgin marks unseen messages, but it only reports the
+ * change when the conversation's unseen state is raised.  The tab and the
+ * notifications are updated once, instead of once for each held message.
+ *
+ * @param[in] gtkconv    The Pidgin UI of the conversation
+ * @param[in] flood      The message queue of the conversation
+ * @param[in] flags      The flags of the held message
+**/
+static void
+mark_unseen(PidginConversation *gtkconv, PwmFlood *flood,
+            PurpleMessageFlags flags)
+{
+  PidginUnseenState state;      /*< The unseen state of the held message     */
+
+  /* Pidgin doesn't count the user's own messages as unseen. */
+  if ( flags & PURPLE_MESSAGE_SEND )
+    return;
+
+  if ( (flags & PURPLE_MESSAGE_NICK) == PURPLE_MESSAGE_NICK )
+    state = PIDGIN_UNSEEN_NICK;
+  else if ( flags & (PURPLE_MESSAGE_SYSTEM | PURPLE_MESSAGE_ERROR) )
+    state = PIDGIN_UNSEEN_EVENT;
+  else if ( flags & PURPLE_MESSAGE_NO_LOG )
+    state = PIDGIN_UNSEEN_NO_LOG;
+  else
+    state = PIDGIN_UNSEEN_TEXT;
+
+  if ( state >= PIDGIN_UNSEEN_TEXT ) {
+    gtkconv->unseen_count++;
+    flood->unseen++;
+  }
+
+  if ( state > gtkconv->unseen_state ) {
+    gtkconv->unseen_state = state;
+    purple_conversation_set_data(gtkconv->active_conv, "unseen-state",
+                                 GINT_TO_POINTER(state));
+    purple_conversation_set_data(gtkconv->active_conv, "unseen-count",
+                                 GINT_TO_POINTER(gtkconv->unseen_count));
+    purple_conversation_update(gtkconv->active_conv,
+                               PURPLE_CONV_UPDATE_UNSEEN);
+  }
+}
+
+
+/**
+ * Write all of a conversation's queued messages to its history
+ *
+ * The window's drawing is held while the batch is written, so the history
+ * is redrawn once per batch instead of once per message.
+ *
+ * @param[in] conv       The conversation whose messages are written
+**/
+static void
+flush_messages(PurpleConversation *conv)
+{
+  PidginConversation *gtkconv;  /*< The Pidgin UI of conv                    */
+  PidginWindow *gtkconvwin;     /*< The window displaying conv               */
+  PwmMessage *msg;              /*< A message being written                  */
+  PwmFlood *flood;              /*< The message queue of conv                */
+  GdkWindow *window;            /*< The window whose drawing is held         */
+
+  flood = purple_conversation_get_data(conv, "pwm_flood");
+  gtkconv = PIDGIN_CONVERSATION(conv);
+  gtkconvwin = gtkconv != NULL ? pidgin_conv_get_window(gtkconv) : NULL;
+  window = gtkconvwin != NULL && gtk_widget_get_realized(gtkconvwin->window) ?
+           gtk_widget_get_window(gtkconvwin->window) : NULL;
+
+  /* Pidgin counts the messages again as they are written. */
+  if ( gtkconv != NULL )
+    gtkconv->unseen_count = MAX(gtkconv->unseen_count - flood->unseen, 0);
+  flood->unseen = 0;
+
+  if ( window != NULL )
+    gdk_window_freeze_updates(window);
+
+  while ( (msg = g_queue_pop_head(&flood->messages)) != NULL ) {
+    display.write_conv(conv, msg->name, msg->alias, msg->message, msg->flags,
+                       msg->mtime);
+    free_message(msg);
+  }
+
+  if ( window != NULL )
+    gdk_window_thaw_updates(window);
+}
+
+
+/**
+ * A timeout callback to write the next batch of a flooded conversation
+ *
+ * @param[in] data       The flooded conversation
+ * @return               Whether to call this function again
+**/
+static gboolean
+flush_timeout_cb(gpointer data)
+{
+  PwmFlood *flood;              /*< The message queue of the conversation    */
+
+  flood = purple_conversation_get_data(data, "pwm_flood");
+  flood->timeout = 0;
+
+  /* Leave the messages queued if the window was hidden meanwhile. */
+  if ( !is_held(PIDGIN_CONVERSATION((PurpleConversation *)data)) )
+    flush_messages(data);
+
+  return FALSE;
+}
+
+
+/**
+ * Write a message to a conversation, or queue it if the conversation is
+ * being flooded in the merged window or the merged window is hidden
+ *
+ * @param[in] conv       The conversation receiving the message
+ * @param[in] name       The name of the message's sender
+ * @param[in] alias      The alias of the message's sender
+ * @param[in] message    The text of the message
+ * @param[in] flags      The flags of the message
+ * @param[in] mtime      The time the message was sent
+**/
+static void
+write_conv(PurpleConversation *conv, const char *name, const char *alias,
+           const char *message, PurpleMessageFlags flags, time_t mtime)
+{
+  PidginConversation *gtkconv;  /*< The Pidgin UI of conv                    */
+  PwmMessage *msg;              /*< The message being queued                 */
+  PwmFlood *flood;              /*< The message rate and queue of conv       */
+  gint64 now;                   /*< The current monotonic time (usec)        */
+
+  gtkconv = PIDGIN_CONVERSATION(conv);
+  flood = purple_conversation_get_data(conv, "pwm_flood");
+
+  /* Only measure the message rate of conversations in the merged window. */
+  if ( flood == NULL ) {
+    if ( gtkconv == NULL ||
+         pwm_convs_get_blist(pidgin_conv_get_window(gtkconv)) == NULL ) {
+      display.write_conv(conv, name, alias, message, flags, mtime);
+      return;
+    }
+    flood = g_new0(PwmFlood, 1);
+    g_queue_init(&flood->messages);
+    purple_conversation_set_data(conv, "pwm_flood", flood);
+  }
+
+  /* Measure the message rate over one second windows, unless it's off. */
+  now = g_get_monotonic_time();
+  if ( now - flood->window >= G_USEC_PER_SEC ) {
+    flood->flooded = flood->count > display.rate && display.rate > 0;
+    flood->window = now;
+    flood->count = 0;
+  }
+  if ( ++flood->count > display.rate && display.rate > 0 )
+    flood->flooded = TRUE;
+
+  /* Keep messages in order while earlier ones are still queued. */
+  if ( !flood->flooded && g_queue_is_empty(&flood->messages) &&
+       !is_held(gtkconv) ) {
+    display.write_conv(conv, name, alias, message, flags, mtime);
+    return;
+  }
+
+  msg = g_new0(PwmMessage, 1);
+  msg->name = g_strdup(name);
+  msg->alias = g_strdup(alias);
+  msg->message = g_strdup(message);
+  msg->flags = flags;
+  msg->mtime = mtime;
+  g_queue_push_tail(&flood->messages, msg);
+
+  /* Hidden windows only need to know there are new messages until shown. */
+  if ( is_held(gtkconv) )
+    mark_unseen(gtkconv, flood, flags);
+  else if ( flood->timeout == 0 )
+    flood->timeout = g_timeout_add(DISPLAY_FRAME, flush_timeout_cb, conv);
+}
+
+
+/**
+ * Stop batching a conversation's messages, and free its message queue
+ *
+ * @param[in] conv       The conversation
+ * @param[in] flush      Whether to write the queued messages first
+**/
+static void
+free_flood(PurpleConversation *conv, gboolean flush)
+{
+  PwmFlood *flood;              /*< The message queue of conv                */
+
+  flood = purple_conversation_get_data(conv, "pwm_flood");
+
+  /* Sanity check: Only free conversations that had messages batched. */
+  if ( flood == NULL )
+    return;
+
+  if ( flood->timeout != 0 )
+    g_source_remove(flood->timeout);
+  if ( flush )
+    flush_messages(conv);
+
+  g_queue_foreach(&flood->messages, (GFunc)free_message, NULL);
+  g_queue_clear(&flood->messages);
+  g_free(flood);
+  purple_conversation_set_data(conv, "pwm_flood", NULL);
+}
+
+
+/**
+ * A callback for when a conversation is being closed
+ *
+ * @param[in] conv       The conversation on its way out the door
+**/
+static void
+deleting_conversation_cb(PurpleConversation *conv)
+{
+  free_flood(conv, FALSE);
+}
+
+
+/**
+ * Write the held messages of every conversation in a merged window
+ *
+ * @param[in] gtkblist   The merged Buddy List that can be seen again
+**/
+static void
+catch_up(PidginBuddyList *gtkblist)
+{
+  PidginConversation *gtkconv;  /*< The Pidgin UI of a conversation          */
+  PwmFlood *flood;              /*< The message queue of a conversation      */
+  GList *item;                  /*< A conversation in the list (iteration)   */
+
+  for ( item = purple_get_conversations(); item != NULL; item = item->next ) {
+    gtkconv = PIDGIN_CONVERSATION((PurpleConversation *)item->data);
+    flood = purple_conversation_get_data(item->data, "pwm_flood");
+    if ( flood != NULL && !g_queue_is_empty(&flood->messages) &&
+         pwm_convs_get_blist(pidgin_conv_get_window(gtkconv)) == gtkblist )
+      flush_messages(item->data);
+  }
+}
+
+
+/**
+ * Determine whether a merged window can be seen, and catch up when it can
+ *
+ * @param[in] gtkblist   The merged Buddy List whose window changed
+**/
+static void
+update_hidden(PidginBuddyList *gtkblist)
+{
+  GdkWindowState state = 0;     /*< The window's state, e.g. minimized       */
+  gboolean hidden;              /*< Whether the window can't be seen         */
+
+  if ( gtk_widget_get_realized(gtkblist->window) )
+    state = gdk_window_get_state(gtk_widget_get_window(gtkblist->window));
+
+  hidden = !gtk_widget_get_mapped(gtkblist->window) ||
+           state & (GDK_WINDOW_STATE_ICONIFIED | GDK_WINDOW_STATE_WITHDRAWN);
+
+  /* Sanity check: Only act when the window is shown or hidden. */
+  if ( hidden == (pwm_fetch(gtkblist, "hidden") != NULL) )
+    return;
+
+  pwm_store(gtkblist, "hidden", GINT_TO_POINTER(hidden));
+  if ( !hidden )
+    catch_up(gtkblist);
+}
+
+
+/**
+ * A callback for when the merged window is mapped, unmapped, minimized, or
+ * restored
+ *
+ * @param[in] widget     Unused
+ * @param[in] event      Unused
+ * @param[in] data       The merged Buddy List
+ * @return               Whether to stop processing other event handlers
+**/
+static gboolean
+window_event_cb(U GtkWidget *widget, U GdkEvent *event, gpointer data)
+{
+  update_hidden(data);
+
+  return FALSE;
+}
+
+
+/**
+ * Start following whether a merged window can be seen
+ *
+ * @param[in] gtkblist   The merged Buddy List to follow
+ *
+ * @note Remember pwm_display_unwatch() before the Buddy List is split.
+**/
+void
+pwm_display_watch(PidginBuddyList *gtkblist)
+{
+  g_object_connect(G_OBJECT(gtkblist->window),
+                   "signal::map-event", G_CALLBACK(window_event_cb), gtkblist,
+                   "signal::unmap-event", G_CALLBACK(window_event_cb),
+                   gtkblist,
+                   "signal::window-state-event", G_CALLBACK(window_event_cb),
+                   gtkblist,
+                   NULL);
+  update_hidden(gtkblist);
+}
+
+
+/**
+ * Stop following whether a merged window can be seen, and write any messages
+ * that were held for it
+ *
+ * @param[in] gtkblist   The merged Buddy List being split
+**/
+void
+pwm_display_unwatch(PidginBuddyList *gtkblist)
+{
+  g_object_disconnect(G_OBJECT(gtkblist->window), "any_signal",
+                      G_CALLBACK(window_event_cb), gtkblist, NULL);
+  pwm_clear(gtkblist, "hidden");
+  catch_up(gtkblist);
+}
+
+
+/**
+ * Start holding back messages in the merged window when they can't be seen
+ *
+ * @param[in] rate       Messages per second to start batching, or 0 for never
+ * @param[in] quiet      Whether to hold messages while the window is hidden
+ *
+ * @note Remember pwm_display_stop() before the plugin is unloaded.
+**/
+void
+pwm_display_start(gint rate, gboolean quiet)
+{
+  /* Sanity check: Don't hook message display twice, or for nothing. */
+  if ( display.ops != NULL || (rate <= 0 && !quiet) )
+    return;
+
+  display.ops = pidgin_conversations_get_conv_ui_ops();
+  display.write_conv = display.ops->write_conv;
+  display.rate = rate;
+  display.quiet = quiet;
+
+  /* Replace the function in Pidgin's operations used by all conversations. */
+  /* XXX: There is no other way to intercept messages before they are drawn. */
+  display.ops->write_conv = write_conv;
+
+  purple_signal_connect(purple_conversations_get_handle(),
+                        "deleting-conversation", &display,
+                        PURPLE_CALLBACK(deleting_conversation_cb), NULL);
+}
+
+
+/**
+ * Stop holding back messages, and write every queued message
+ *
+ * @note This must be called before the plugin is unloaded from memory.
+**/
+void
+pwm_display_stop(void)
+{
+  GList *item;                  /*< A conversation in the list (iteration)   */
+
+  if ( display.ops == NULL )
+    return;
+
+  purple_signals_disconnect_by_handle(&display);
+
+  for ( item = purple_get_conversations(); item != NULL; item = item->next )
+    free_flood(item->data, TRUE);
+
+  display.ops->write_conv = display.write_conv;
+  display.ops = NULL;
+}
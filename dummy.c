@@ -7,6 +7,11 @@
  * supposed to be displayed when no conversations are open in a merged window.
  * Pidgin callbacks add and remove it as conversations come and go.
  *
+ * The dummy is built from a more general placeholder tab: a fake conversation
+ * UI holding a single label, which conversation notebooks accept like a real
+ * conversation.  Placeholders are also used for tabs that stand in for real
+ * conversations until they are needed.
+ *
  * @section LICENSE
  * Copyright (C) 2012 David Michael <fedora.dm0@gmail.com>
  *
@@ -32,22 +37,22 @@
 #include <gtkconv.h>
 #include <gtkutils.h>
 
+#include "probes.h"
 #include "window_merge.h"
 
 
 /**
- * Allocate and return a conversation UI that only holds an instructions label
+ * Allocate and return a conversation UI that only holds a label
  *
+ * @param[in] markup     The Pango markup displayed in the label, or NULL
  * @return               Pointer to the allocated conversation UI structure
  *
- * @note Remember pwm_free_dummy_conversation() for the window that owns this.
+ * @note Remember pwm_placeholder_free() when the placeholder is not needed.
 **/
-void
-pwm_init_dummy_conversation(PidginBuddyList *gtkblist)
+PidginConversation *
+pwm_placeholder_new(const char *markup)
 {
   PidginConversation *gtkconv;  /*< The new (pretend) conversation structure */
-  gchar *html;                  /*< The HTML-formatted instructions text     */
-  gchar *pretty;                /*< The HTML text with prettier arrow chars  */
 
   gtkconv = g_new0(PidginConversation, 1);
 
@@ -55,9 +60,114 @@ pwm_init_dummy_conversation(PidginBuddyList *gtkblist)
   gtkconv->tab_cont = gtk_label_new(NULL);
   gtk_label_set_line_wrap(GTK_LABEL(gtkconv->tab_cont), TRUE);
   gtk_misc_set_alignment(GTK_MISC(gtkconv->tab_cont), 0.5f, 0.2f);
+  if ( markup != NULL )
+    gtk_label_set_markup(GTK_LABEL(gtkconv->tab_cont), markup);
   g_object_set_data(G_OBJECT(gtkconv->tab_cont),
                     "PidginConversation", gtkconv);
 
+  /* Set up the label so it accepts dropped conversations like the infopane. */
+  gtkconv->entry = gtkconv->tab_cont;
+  gtkconv->infopane = gtkconv->tab_cont;
+  gtkconv->infopane_hbox = gtkconv->tab_cont;
+
+  return gtkconv;
+}
+
+
+/**
+ * Display a placeholder tab in the given conversation window
+ *
+ * @param[in] gtkconvwin The conversation window to display the placeholder
+ * @param[in] gtkconv    The placeholder conversation UI
+ * @param[in] title      The text of the placeholder's tab
+ * @param[in] stock      The stock icon of the placeholder's tab
+ * @param[in] closable   Whether to keep the tab's "close" button
+**/
+void
+pwm_placeholder_show(PidginWindow *gtkconvwin, PidginConversation *gtkconv,
+                     const char *title, const char *stock, gboolean closable)
+{
+  /* Sanity check: Don't show a placeholder that is already displayed. */
+  if ( pidgin_conv_get_window(gtkconv) != NULL )
+    return;
+
+  /* Add the placeholder tab to the conversations notebook. */
+  pidgin_conv_window_add_gtkconv(gtkconvwin, gtkconv);
+
+  /* Remove the "close" button that was just added to the tab label. */
+  if ( !closable ) {
+    gtk_widget_destroy(gtkconv->close);
+    gtkconv->close = NULL;
+  }
+
+  /* Label the tab for those who can see it. */
+  gtk_label_set_text(GTK_LABEL(gtkconv->tab_label), title);
+  gtk_label_set_text(GTK_LABEL(gtkconv->menu_label), title);
+  g_object_set(G_OBJECT(gtkconv->icon), "stock", stock, NULL);
+  g_object_set(G_OBJECT(gtkconv->menu_icon), "stock", stock, NULL);
+}
+
+
+/**
+ * Take down a placeholder tab from its parent window
+ *
+ * @param[in] gtkconv    The placeholder conversation UI
+**/
+void
+pwm_placeholder_hide(PidginConversation *gtkconv)
+{
+  PidginWindow *gtkconvwin;     /*< The conversation window that has gtkconv */
+
+  gtkconvwin = pidgin_conv_get_window(gtkconv);
+
+  /* Sanity check: If the placeholder isn't being shown, leave it alone. */
+  if ( gtkconvwin == NULL )
+    return;
+
+  /* Force-unparent the placeholder before the slew of callbacks run on it. */
+  /* XXX: This is bad, but it stops Message Notifications from exploding. */
+  gtkconvwin->gtkconvs = g_list_remove(gtkconvwin->gtkconvs, gtkconv);
+
+  /* Remove the tab from its window. */
+  gtkconv->win = NULL;
+  pidgin_conv_window_remove_gtkconv(gtkconvwin, gtkconv);
+}
+
+
+/**
+ * Free the memory used by a placeholder tab
+ *
+ * @param[in] gtkconv    The placeholder conversation UI
+**/
+void
+pwm_placeholder_free(PidginConversation *gtkconv)
+{
+  /* Destroy the label widget, and release the conversation UI memory. */
+  pwm_placeholder_hide(gtkconv);
+  gtk_widget_destroy(gtkconv->tab_cont);
+  g_free(gtkconv);
+}
+
+
+/**
+ * A callback for when the instructions label is first mapped, to fill it in
+ *
+ * The instructions are only formatted when they are about to be seen, since
+ * the label is hidden along with an idle conversation pane.
+ *
+ * @param[in] label      The instructions label
+ * @param[in] data       Unused
+**/
+static void
+dummy_map_cb(GtkWidget *label, U gpointer data)
+{
+  gchar *html;                  /*< The HTML-formatted instructions text     */
+  gchar *pretty;                /*< The HTML text with prettier arrow chars  */
+
+  /* The instructions only need to be written once. */
+  g_object_disconnect(G_OBJECT(label), "any_signal",
+                      G_CALLBACK(dummy_map_cb), NULL, NULL);
+
   /* TRANSLATORS: A few notes on this one:
      1) Try to keep the "->" styled arrows to denote menu selection, since
         Pidgin converts those character sequences to Unicode arrows.
@@ -76,13 +186,27 @@ pwm_init_dummy_conversation(PidginBuddyList *gtkblist)
           _(PWM_STR_NAME), _(PWM_STR_NAME), _(PWM_STR_CP_BLIST));
   pretty = pidgin_make_pretty_arrows(html);
   g_free(html);
-  gtk_label_set_markup(GTK_LABEL(gtkconv->tab_cont), pretty);
+  gtk_label_set_markup(GTK_LABEL(label), pretty);
   g_free(pretty);
+}
 
-  /* Set up the label so it accepts dropped conversations like the infopane. */
-  gtkconv->entry = gtkconv->tab_cont;
-  gtkconv->infopane = gtkconv->tab_cont;
-  gtkconv->infopane_hbox = gtkconv->tab_cont;
+
+/**
+ * Allocate a conversation UI that only holds an instructions label
+ *
+ * @param[in] gtkblist   The Buddy List that will own the instructions tab
+ *
+ * @note Remember pwm_free_dummy_conversation() for the window that owns this.
+**/
+void
+pwm_init_dummy_conversation(PidginBuddyList *gtkblist)
+{
+  PidginConversation *gtkconv;  /*< The new (pretend) conversation structure */
+
+  /* Leave the instructions empty until the label is displayed. */
+  gtkconv = pwm_placeholder_new(NULL);
+  g_object_connect(G_OBJECT(gtkconv->tab_cont), "signal::map",
+                   G_CALLBACK(dummy_map_cb), NULL, NULL);
 
   /* Store the dummy conversation's pointer on the Buddy List. */
   pwm_store(gtkblist, "fake_tab", gtkconv);
@@ -100,6 +224,7 @@ pwm_show_dummy_conversation(PidginBuddyList *gtkblist)
   PidginConversation *gtkconv;  /*< The fake conversation structure          */
   PidginWindow *gtkconvwin;     /*< The conversation window tied to gtkblist */
 
+  pwm_record_event(gtkblist, G_STRFUNC, NULL);
   gtkconv = pwm_fetch(gtkblist, "fake_tab");
   gtkconvwin = pwm_blist_get_convs(gtkblist);
 
@@ -107,18 +232,15 @@ pwm_show_dummy_conversation(PidginBuddyList *gtkblist)
   if ( gtkconvwin == NULL || pidgin_conv_get_window(gtkconv) != NULL )
     return;
 
-  /* Add the instructions tab to the conversations notebook. */
-  pidgin_conv_window_add_gtkconv(gtkconvwin, gtkconv);
-
-  /* Remove the "close" button that was just added to the tab label. */
-  gtk_widget_destroy(gtkconv->close);
-  gtkconv->close = NULL;
+  PWM_PROBE3(dummy_show__entry, gtkblist, gtkconv->tab_cont,
+             PWM_PROBE_TABS(gtkblist));
 
   /* Show the plugin name and an About icon for those who can see the label. */
-  gtk_label_set_text(GTK_LABEL(gtkconv->tab_label), _(PWM_STR_NAME));
-  gtk_label_set_text(GTK_LABEL(gtkconv->menu_label), _(PWM_STR_NAME));
-  g_object_set(G_OBJECT(gtkconv->icon), "stock", GTK_STOCK_ABOUT, NULL);
-  g_object_set(G_OBJECT(gtkconv->menu_icon), "stock", GTK_STOCK_ABOUT, NULL);
+  pwm_placeholder_show(gtkconvwin, gtkconv, _(PWM_STR_NAME), GTK_STOCK_ABOUT,
+                       FALSE);
+
+  PWM_PROBE3(dummy_show__return, gtkblist, gtkconv->tab_cont,
+             PWM_PROBE_TABS(gtkblist));
 }
 
 
@@ -131,22 +253,19 @@ void
 pwm_hide_dummy_conversation(PidginBuddyList *gtkblist)
 {
   PidginConversation *gtkconv;  /*< The fake conversation structure          */
-  PidginWindow *gtkconvwin;     /*< The conversation window that has gtkconv */
 
+  pwm_record_event(gtkblist, G_STRFUNC, NULL);
   gtkconv = pwm_fetch(gtkblist, "fake_tab");
-  gtkconvwin = pidgin_conv_get_window(gtkconv);
 
   /* Sanity check: If the dummy tab isn't being shown, leave it alone. */
-  if ( gtkconvwin == NULL )
+  if ( pidgin_conv_get_window(gtkconv) == NULL )
     return;
 
-  /* Force-unparent the dummy tab before the slew of callbacks run over it. */
-  /* XXX: This is bad, but it stops Message Notifications from exploding. */
-  gtkconvwin->gtkconvs = g_list_remove(gtkconvwin->gtkconvs, gtkconv);
-
-  /* Remove the tab from its window. */
-  gtkconv->win = NULL;
-  pidgin_conv_window_remove_gtkconv(gtkconvwin, gtkconv);
+  PWM_PROBE3(dummy_hide__entry, gtkblist, gtkconv->tab_cont,
+             PWM_PROBE_TABS(gtkblist));
+  pwm_placeholder_hide(gtkconv);
+  PWM_PROBE3(dummy_hide__return, gtkblist, gtkconv->tab_cont,
+             PWM_PROBE_TABS(gtkblist));
 }
 
 
@@ -166,9 +285,6 @@ pwm_free_dummy_conversation(PidginBuddyList *gtkblist)
   if ( gtkconv == NULL )
     return;
 
-  /* Destroy the label widget, and release the conversation UI memory. */
-  pwm_hide_dummy_conversation(gtkblist);
-  gtk_widget_destroy(gtkconv->tab_cont);
-  g_free(gtkconv);
+  pwm_placeholder_free(gtkconv);
   pwm_clear(gtkblist, "fake_tab");
 }
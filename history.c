@@ -0,0 +1,485 @@
+/**
+ * @file history.c
+ * Loads the last conversation log into new merged tabs without blocking
+ *
+ * The History plugin bundled with Pidgin reads and parses a whole log on the
+ * main thread when a conversation is created, which freezes the merged window
+ * (Buddy List included) for large logs.  This file offers an alternative that
+ * reads the end of the last log from before the conversation was created in a
+ * worker thread, so the log the conversation is writing now is never read
+ * while it grows.  The parsed text is then
+ * inserted at the top of the conversation history in small chunks from idle
+ * callbacks, so messages that arrive meanwhile stay below it.
+ *
+ * Nothing is loaded while the History plugin is enabled, to avoid showing the
+ * same messages twice.
+ *
+ * @section LICENSE
+ * Copyright (C) 2012 David Michael <fedora.dm0@gmail.com>
+ *
+ * This file is part of Window Merge.
+ *
+ * Window Merge is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * Window Merge is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Window Merge.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "plugin.h"
+
+#include <gtkblist.h>
+#include <gtkconv.h>
+#include <gtkimhtml.h>
+
+#include <conversation.h>
+#include <log.h>
+#include <plugin.h>
+
+#include <gio/gio.h>
+#include <string.h>
+
+#include "window_merge.h"
+
+/** The most bytes read from the end of a log */
+#define HISTORY_MAX_BYTES 65536
+
+/** The number of log lines inserted per idle callback */
+#define HISTORY_CHUNK_LINES 50
+
+
+/**
+ * A log being loaded into a conversation
+ *
+ * The list of logs holds one reference, and a task reading the log holds
+ * another until its ready callback runs, even after the plugin stopped it.
+**/
+typedef struct {
+  PurpleConversation *conv;     /*< The conversation receiving the log       */
+  GCancellable *cancel;         /*< Cancels reading the log on unload        */
+  GPtrArray *chunks;            /*< The parsed chunks of HTML to insert      */
+  GtkTextMark *mark;            /*< Where the next chunk is inserted         */
+  guint next;                   /*< The index of the next chunk to insert    */
+  guint idle;                   /*< The source ID inserting chunks           */
+  gint refs;                    /*< The number of references to the preload */
+} PwmPreload;
+
+
+/**
+ * The log file read by a worker thread
+**/
+typedef struct {
+  gchar *path;                  /*< The path of the log file                 */
+  gboolean is_html;             /*< Whether the HTML logger wrote the file   */
+} PwmLogFile;
+
+
+/**
+ * The logs being loaded, only accessed from the main thread
+**/
+static struct {
+  GList *preloads;              /*< The list of logs being loaded            */
+} history;
+
+
+/**
+ * Release a reference to a log being loaded, and free it with the last one
+ *
+ * @param[in] preload    The log to release
+**/
+static void
+unref_preload(PwmPreload *preload)
+{
+  if ( --preload->refs > 0 )
+    return;
+
+  if ( preload->chunks != NULL )
+    g_ptr_array_unref(preload->chunks);
+  g_object_unref(preload->cancel);
+  g_free(preload);
+}
+
+
+/**
+ * Stop inserting a log, and release the list's reference to it
+ *
+ * @param[in] preload    The log to drop
+**/
+static void
+drop_preload(PwmPreload *preload)
+{
+  history.preloads = g_list_remove(history.preloads, preload);
+
+  if ( preload->idle != 0 ) {
+    g_source_remove(preload->idle);
+    preload->idle = 0;
+  }
+  unref_preload(preload);
+}
+
+
+/**
+ * Free the description of a log file read by a worker thread
+ *
+ * @param[in] data       The log file to free
+**/
+static void
+free_log_file(gpointer data)
+{
+  PwmLogFile *file;             /*< The log file being freed                 */
+
+  file = data;
+  g_free(file->path);
+  g_free(file);
+}
+
+
+/**
+ * Return whether a conversation still exists with its history widget
+ *
+ * @param[in] conv       The conversation to check
+ * @return               Its Pidgin conversation, or NULL if it's gone
+**/
+static PidginConversation *
+get_live_conversation(PurpleConversation *conv)
+{
+  if ( g_list_find(purple_get_conversations(), conv) == NULL )
+    return NULL;
+
+  return PIDGIN_CONVERSATION(conv);
+}
+
+
+/**
+ * Split the end of a log file into chunks of HTML lines
+ *
+ * @param[in] contents   The text read from the end of the log
+ * @param[in] is_html    Whether the log was written by the HTML logger
+ * @return               A newly allocated array of chunks
+**/
+static GPtrArray *
+parse_log(const gchar *contents, gboolean is_html)
+{
+  GPtrArray *chunks;            /*< The chunks of HTML being built           */
+  GString *chunk = NULL;        /*< The chunk being built                    */
+  gchar **lines;                /*< The lines of the log                     */
+  gchar *escaped;               /*< A plain text line escaped as HTML        */
+  guint count = 0;              /*< The number of lines in the chunk         */
+  guint i;                      /*< The index of a line (iteration)          */
+
+  chunks = g_ptr_array_new_with_free_func(g_free);
+  lines = g_strsplit(contents, "\n", -1);
+
+  /* Skip the header line, or the partial line where the log was cut. */
+  for ( i = 1; lines[0] != NULL && lines[i] != NULL; i++ ) {
+    if ( *lines[i] == '\0' || g_str_has_prefix(lines[i], "</body>") )
+      continue;
+
+    if ( chunk == NULL )
+      chunk = g_string_new(NULL);
+
+    if ( is_html )
+      g_string_append(chunk, lines[i]);
+    else {
+      escaped = g_markup_escape_text(lines[i], -1);
+      g_string_append(chunk, escaped);
+      g_string_append(chunk, "<br>");
+      g_free(escaped);
+    }
+
+    if ( ++count == HISTORY_CHUNK_LINES ) {
+      g_ptr_array_add(chunks, g_string_free(chunk, FALSE));
+      chunk = NULL;
+      count = 0;
+    }
+  }
+  if ( chunk != NULL )
+    g_ptr_array_add(chunks, g_string_free(chunk, FALSE));
+
+  g_strfreev(lines);
+
+  return chunks;
+}
+
+
+/**
+ * Read and parse the end of a log file in a worker thread
+ *
+ * Only the last HISTORY_MAX_BYTES of the file are read.  The read part can
+ * start in the middle of a line (or an HTML tag), which parse_log() skips.
+ *
+ * @param[in] task       The task reading the log
+ * @param[in] source     Unused
+ * @param[in] data       The log file to read
+ * @param[in] cancel     Cancels reading the log
+**/
+static void
+read_thread(GTask *task, U gpointer source, gpointer data,
+            GCancellable *cancel)
+{
+  GFileInputStream *stream;     /*< The open log file                        */
+  GPtrArray *chunks = NULL;     /*< The parsed end of the log                */
+  PwmLogFile *file;             /*< The log file to read                     */
+  GFileInfo *info;              /*< The size of the log file                 */
+  GFile *gfile;                 /*< The log file to open                     */
+  gchar *contents;              /*< The end of the log file                  */
+  gsize length;                 /*< The number of bytes read                 */
+  goffset size = -1;            /*< The size of the log file                 */
+
+  file = data;
+  gfile = g_file_new_for_path(file->path);
+  stream = g_file_read(gfile, cancel, NULL);
+  g_object_unref(gfile);
+
+  if ( stream == NULL ) {
+    g_task_return_pointer(task, NULL, NULL);
+    return;
+  }
+
+  info = g_file_input_stream_query_info(stream,
+                                        G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                                        cancel, NULL);
+  if ( info != NULL ) {
+    size = g_file_info_get_size(info);
+    g_object_unref(info);
+  }
+
+  /* Skip to the end of a long log, and read no more than the end. */
+  contents = g_malloc(HISTORY_MAX_BYTES + 1);
+  if ( size >= 0 &&
+       (size <= HISTORY_MAX_BYTES ||
+        g_seekable_seek(G_SEEKABLE(stream), size - HISTORY_MAX_BYTES,
+                        G_SEEK_SET, cancel, NULL)) &&
+       g_input_stream_read_all(G_INPUT_STREAM(stream), contents,
+                               HISTORY_MAX_BYTES, &length, cancel, NULL) ) {
+    contents[length] = '\0';
+    chunks = parse_log(contents, file->is_html);
+  }
+  g_free(contents);
+  g_object_unref(stream);
+
+  g_task_return_pointer(task, chunks, (GDestroyNotify)g_ptr_array_unref);
+}
+
+
+/**
+ * Find the newest log of a conversation from before it was created
+ *
+ * Logs are listed on the main thread, since the loggers aren't thread-safe.
+ * The conversation's own log is skipped by its time, since it is still being
+ * written, and only logs stored in plain files by the HTML or text loggers can
+ * be read by a worker thread.
+ *
+ * @param[in] conv       The conversation that was created
+ * @return               A newly allocated log file, or NULL if there is none
+**/
+static PwmLogFile *
+find_log_file(PurpleConversation *conv)
+{
+  PurpleLogCommonLoggerData *common; /*< File data of an HTML or text log */
+  PurpleLog *log;               /*< A log of the conversation (iteration)    */
+  PwmLogFile *file = NULL;      /*< The newest earlier log file              */
+  GList *logs;                  /*< Logs of the conversation, newest first */
+  GList *item;                  /*< A log in the list (iteration)            */
+  time_t created;               /*< When the conversation's own log started  */
+
+  created = conv->logs != NULL ? ((PurpleLog *)conv->logs->data)->time :
+                                 time(NULL);
+  logs = purple_log_get_logs(
+           purple_conversation_get_type(conv) == PURPLE_CONV_TYPE_CHAT ?
+           PURPLE_LOG_CHAT : PURPLE_LOG_IM,
+           purple_conversation_get_name(conv),
+           purple_conversation_get_account(conv));
+
+  for ( item = logs; item != NULL && file == NULL; item = item->next ) {
+    log = item->data;
+    common = log->logger_data;
+    if ( log->time >= created || common == NULL || common->path == NULL ||
+         (strcmp(log->logger->id, "html") != 0 &&
+          strcmp(log->logger->id, "txt") != 0) )
+      continue;
+
+    file = g_new0(PwmLogFile, 1);
+    file->path = g_strdup(common->path);
+    file->is_html = strcmp(log->logger->id, "html") == 0;
+  }
+
+  g_list_foreach(logs, (GFunc)purple_log_free, NULL);
+  g_list_free(logs);
+
+  return file;
+}
+
+
+/**
+ * An idle callback to insert the next chunk of a log into its conversation
+ *
+ * @param[in] data       The log being loaded
+ * @return               Whether to call this function again
+**/
+static gboolean
+insert_chunk_cb(gpointer data)
+{
+  PidginConversation *gtkconv;  /*< The conversation receiving the log       */
+  PwmPreload *preload;          /*< The log being loaded                     */
+  GtkTextBuffer *buffer;        /*< The text buffer of the history           */
+  GtkTextIter iter;             /*< Where the chunk is inserted              */
+
+  preload = data;
+  gtkconv = get_live_conversation(preload->conv);
+
+  /* Sanity check: Stop if the conversation was closed meanwhile. */
+  if ( gtkconv == NULL ) {
+    preload->idle = 0;
+    drop_preload(preload);
+    return FALSE;
+  }
+
+  buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(gtkconv->imhtml));
+  gtk_text_buffer_get_iter_at_mark(buffer, &iter, preload->mark);
+
+  /* Insert a chunk, or the separator after the last one, and finish. */
+  if ( preload->next < preload->chunks->len ) {
+    gtk_imhtml_insert_html_at_iter(GTK_IMHTML(gtkconv->imhtml),
+                                   g_ptr_array_index(preload->chunks,
+                                                     preload->next++),
+                                   GTK_IMHTML_NO_SCROLL, &iter);
+    return TRUE;
+  }
+
+  gtk_imhtml_insert_html_at_iter(GTK_IMHTML(gtkconv->imhtml), "<hr>",
+                                 GTK_IMHTML_NO_SCROLL, &iter);
+  gtk_text_buffer_delete_mark(buffer, preload->mark);
+  preload->idle = 0;
+  drop_preload(preload);
+
+  return FALSE;
+}
+
+
+/**
+ * A callback for when a worker thread has finished reading a log
+ *
+ * @param[in] source     Unused
+ * @param[in] result     The result of the read task
+ * @param[in] data       The log being loaded
+ *
+ * @note This can run after pwm_history_stop(), when it only frees the log.
+**/
+static void
+read_ready_cb(U GObject *source, GAsyncResult *result, gpointer data)
+{
+  PidginConversation *gtkconv;  /*< The conversation receiving the log       */
+  PwmPreload *preload;          /*< The log being loaded                     */
+  GtkTextBuffer *buffer;        /*< The text buffer of the history           */
+  GtkTextIter start;            /*< The start of the history                 */
+
+  preload = data;
+  preload->chunks = g_task_propagate_pointer(G_TASK(result), NULL);
+
+  /* Sanity check: A stopped log was already dropped from the list. */
+  if ( g_cancellable_is_cancelled(preload->cancel) ) {
+    unref_preload(preload);
+    return;
+  }
+
+  /* Sanity check: Only insert a log into a conversation that still exists. */
+  gtkconv = get_live_conversation(preload->conv);
+  if ( preload->chunks == NULL || preload->chunks->len == 0 ||
+       gtkconv == NULL ) {
+    drop_preload(preload);
+    unref_preload(preload);
+    return;
+  }
+
+  /* The mark moves past each chunk, keeping newer messages below the log. */
+  buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(gtkconv->imhtml));
+  gtk_text_buffer_get_start_iter(buffer, &start);
+  preload->mark = gtk_text_buffer_create_mark(buffer, NULL, &start, FALSE);
+  preload->idle = g_idle_add(insert_chunk_cb, preload);
+  unref_preload(preload);
+}
+
+
+/**
+ * Start loading the last log of a new conversation in the background
+ *
+ * This only acts once for each conversation, when its history is empty.
+ *
+ * @param[in] gtkconv    The conversation that was created
+**/
+void
+pwm_preload_history(PidginConversation *gtkconv)
+{
+  PurpleConversation *conv;     /*< The conversation receiving the log       */
+  PurplePlugin *plugin;         /*< The bundled History plugin               */
+  PwmPreload *preload;          /*< The log being loaded                     */
+  PwmLogFile *file;             /*< The log file to read                     */
+  GtkTextBuffer *buffer;        /*< The text buffer of the history           */
+  GTask *task;                  /*< The task reading the log                 */
+
+  conv = gtkconv->active_conv;
+
+  /* Sanity check: Only load a log once into an empty history. */
+  if ( conv == NULL || gtkconv->imhtml == NULL ||
+       purple_conversation_get_data(conv, "pwm_history") != NULL )
+    return;
+  purple_conversation_set_data(conv, "pwm_history", GINT_TO_POINTER(TRUE));
+  buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(gtkconv->imhtml));
+  if ( gtk_text_buffer_get_char_count(buffer) > 0 )
+    return;
+
+  /* Sanity check: Let the History plugin do its job if it's enabled. */
+  plugin = purple_plugins_find_with_id("core-history");
+  if ( plugin != NULL && purple_plugin_is_loaded(plugin) )
+    return;
+
+  file = find_log_file(conv);
+  if ( file == NULL )
+    return;
+
+  /* One reference is for the list, and the other is for the task. */
+  preload = g_new0(PwmPreload, 1);
+  preload->conv = conv;
+  preload->cancel = g_cancellable_new();
+  preload->refs = 2;
+  history.preloads = g_list_prepend(history.preloads, preload);
+
+  task = g_task_new(NULL, preload->cancel, read_ready_cb, preload);
+  g_task_set_task_data(task, file, free_log_file);
+  g_task_run_in_thread(task, read_thread);
+  g_object_unref(task);
+}
+
+
+/**
+ * Stop loading logs without waiting for worker threads to finish
+ *
+ * A worker thread that is still reading keeps its own reference to its log,
+ * which is freed by the task's ready callback once the thread is done.
+**/
+void
+pwm_history_stop(void)
+{
+  PwmPreload *preload;          /*< The log being loaded                     */
+
+  while ( history.preloads != NULL ) {
+    preload = history.preloads->data;
+    g_cancellable_cancel(preload->cancel);
+
+    /* Drop the marks of logs that were still being inserted. */
+    if ( preload->mark != NULL &&
+         get_live_conversation(preload->conv) != NULL )
+      gtk_text_buffer_delete_mark(gtk_text_mark_get_buffer(preload->mark),
+                                  preload->mark);
+    preload->mark = NULL;
+    drop_preload(preload);
+  }
+}
@@ -0,0 +1,276 @@
+/**
+ * @file latency.c
+ * Measures how long received messages take to be drawn on the screen
+ *
+ * A sample is started when a message is received for a conversation, and its
+ * processing time is taken when Pidgin has written the message to the history.
+ * The sample ends when the history is next drawn.  Samples are summarized
+ * separately for merged and stock conversation windows, so the statistics
+ * file shows how much the merged layout adds to message display latency.
+ *
+ * Only one sample is kept per conversation at a time, so a conversation that
+ * receives messages faster than they are drawn is sampled periodically.
+ *
+ * @section LICENSE
+ * Copyright (C) 2012 David Michael <fedora.dm0@gmail.com>
+ *
+ * This file is part of Window Merge.
+ *
+ * Window Merge is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * Window Merge is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Window Merge.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "plugin.h"
+
+#include <gtkblist.h>
+#include <gtkconv.h>
+
+#include <conversation.h>
+#include <signals.h>
+
+#include <string.h>
+#include <time.h>
+
+#include "window_merge.h"
+
+/** The number of samples to summarize in each line of the statistics file */
+#define LATENCY_REPORT 100
+
+
+/**
+ * A message being measured from its reception until it is drawn
+**/
+typedef struct {
+  gint64 received;              /*< Monotonic time of reception (usec)       */
+  clock_t cpu;                  /*< Processor time used to display it        */
+  gboolean displayed;           /*< Whether the message has been written     */
+} PwmSample;
+
+
+/**
+ * A summary of samples from one kind of conversation window
+**/
+typedef struct {
+  guint count;                  /*< The number of samples summarized         */
+  gint64 total;                 /*< Total latency of the samples (usec)      */
+  gint64 worst;                 /*< Highest latency of a sample (usec)       */
+  gint64 cpu;                   /*< Total processor time of samples (usec)   */
+} PwmSummary;
+
+
+/**
+ * The state of the latency measurements
+**/
+static struct {
+  PwmSummary merged;            /*< Samples from the merged window           */
+  PwmSummary stock;             /*< Samples from other conversation windows  */
+  gboolean started;             /*< Whether messages are being measured      */
+} latency;
+
+
+/**
+ * Write a summary to the statistics file, and start a new one
+ *
+ * @param[in] summary    The summary being reported
+ * @param[in] name       The kind of conversation window summarized
+**/
+static void
+report_summary(PwmSummary *summary, const char *name)
+{
+  /* Sanity check: Don't report empty summaries. */
+  if ( summary->count == 0 )
+    return;
+
+  pwm_stats_append("latency %s n=%u avg=%" G_GINT64_FORMAT "us max=%"
+                   G_GINT64_FORMAT "us cpu=%" G_GINT64_FORMAT "us", name,
+                   summary->count, summary->total / summary->count,
+                   summary->worst, summary->cpu / summary->count);
+  memset(summary, 0, sizeof(*summary));
+}
+
+
+/**
+ * A callback for when a conversation's history is drawn after a new message
+ *
+ * @param[in] widget     The history widget that was drawn
+ * @param[in] event      Unused
+ * @param[in] data       Pointer to the conversation of the history
+ * @return               Whether to stop processing other event handlers
+**/
+static gboolean
+expose_event_cb(GtkWidget *widget, U GdkEventExpose *event, gpointer data)
+{
+  PidginConversation *gtkconv;  /*< The conversation of the history          */
+  PwmSummary *summary;          /*< The summary receiving the sample         */
+  PwmSample *sample;            /*< The message being measured               */
+  gint64 elapsed;               /*< Time from reception to drawing (usec)    */
+
+  gtkconv = data;
+  sample = g_object_steal_data(G_OBJECT(widget), "pwm_sample");
+  elapsed = g_get_monotonic_time() - sample->received;
+
+  summary = pwm_convs_get_blist(pidgin_conv_get_window(gtkconv)) != NULL ?
+            &latency.merged : &latency.stock;
+  summary->count++;
+  summary->total += elapsed;
+  summary->worst = MAX(summary->worst, elapsed);
+  summary->cpu += (gint64)sample->cpu * G_USEC_PER_SEC / CLOCKS_PER_SEC;
+  g_free(sample);
+
+  g_object_disconnect(G_OBJECT(widget), "any_signal",
+                      G_CALLBACK(expose_event_cb), data, NULL);
+
+  if ( summary->count >= LATENCY_REPORT )
+    report_summary(summary, summary == &latency.merged ? "merged" : "stock");
+
+  return FALSE;
+}
+
+
+/**
+ * A callback for when an IM or chat message is received
+ *
+ * @param[in] account    Unused
+ * @param[in] sender     Unused
+ * @param[in] message    Unused
+ * @param[in] conv       The conversation receiving the message
+ * @param[in] flags      Unused
+**/
+static void
+received_msg_cb(U PurpleAccount *account, U char *sender, U char *message,
+                PurpleConversation *conv, U PurpleMessageFlags flags)
+{
+  PidginConversation *gtkconv;  /*< The conversation receiving the message   */
+  PwmSample *sample;            /*< The message being measured               */
+
+  gtkconv = conv != NULL ? PIDGIN_CONVERSATION(conv) : NULL;
+
+  /* Sanity check: Only sample conversations with a history. */
+  if ( gtkconv == NULL || gtkconv->imhtml == NULL )
+    return;
+
+  /* Wait for a sample to be drawn, unless its history was hidden meanwhile. */
+  sample = g_object_get_data(G_OBJECT(gtkconv->imhtml), "pwm_sample");
+  if ( sample != NULL && sample->displayed ) {
+    if ( gtk_widget_get_mapped(gtkconv->imhtml) )
+      return;
+    g_signal_handlers_disconnect_matched(gtkconv->imhtml, G_SIGNAL_MATCH_FUNC,
+                                         0, 0, NULL, expose_event_cb, NULL);
+  }
+
+  sample = g_new0(PwmSample, 1);
+  sample->received = g_get_monotonic_time();
+  sample->cpu = clock();
+  g_object_set_data_full(G_OBJECT(gtkconv->imhtml), "pwm_sample", sample,
+                         g_free);
+}
+
+
+/**
+ * A callback for when an IM or chat message was written to the history
+ *
+ * @param[in] account    Unused
+ * @param[in] who        Unused
+ * @param[in] message    Unused
+ * @param[in] conv       The conversation displaying the message
+ * @param[in] flags      Unused
+**/
+static void
+displayed_msg_cb(U PurpleAccount *account, U const char *who,
+                 U char *message, PurpleConversation *conv,
+                 U PurpleMessageFlags flags)
+{
+  PidginConversation *gtkconv;  /*< The conversation displaying the message  */
+  PwmSample *sample;            /*< The message being measured               */
+
+  gtkconv = PIDGIN_CONVERSATION(conv);
+  sample = g_object_get_data(G_OBJECT(gtkconv->imhtml), "pwm_sample");
+
+  /* Sanity check: Only finish processing samples once. */
+  if ( sample == NULL || sample->displayed )
+    return;
+
+  /* Messages in histories that aren't on the screen will never be drawn. */
+  if ( !gtk_widget_get_mapped(gtkconv->imhtml) ) {
+    g_object_set_data(G_OBJECT(gtkconv->imhtml), "pwm_sample", NULL);
+    return;
+  }
+
+  sample->cpu = clock() - sample->cpu;
+  sample->displayed = TRUE;
+
+  g_object_connect(G_OBJECT(gtkconv->imhtml), "signal-after::expose-event",
+                   G_CALLBACK(expose_event_cb), gtkconv, NULL);
+}
+
+
+/**
+ * Start measuring the display latency of received messages
+**/
+void
+pwm_latency_start(void)
+{
+  void *conv_handle;            /*< The conversations handle                 */
+  void *gtkconv_handle;         /*< The Pidgin conversations handle          */
+
+  /* Sanity check: Don't connect the callbacks twice. */
+  if ( latency.started )
+    return;
+
+  conv_handle = purple_conversations_get_handle();
+  gtkconv_handle = pidgin_conversations_get_handle();
+
+  purple_signal_connect(conv_handle, "received-im-msg", &latency,
+                        PURPLE_CALLBACK(received_msg_cb), NULL);
+  purple_signal_connect(conv_handle, "received-chat-msg", &latency,
+                        PURPLE_CALLBACK(received_msg_cb), NULL);
+  purple_signal_connect(gtkconv_handle, "displayed-im-msg", &latency,
+                        PURPLE_CALLBACK(displayed_msg_cb), NULL);
+  purple_signal_connect(gtkconv_handle, "displayed-chat-msg", &latency,
+                        PURPLE_CALLBACK(displayed_msg_cb), NULL);
+
+  latency.started = TRUE;
+}
+
+
+/**
+ * Stop measuring latency, and report the samples that were not yet reported
+ *
+ * @note This must be called before the plugin is unloaded from memory.
+**/
+void
+pwm_latency_stop(void)
+{
+  PidginConversation *gtkconv;  /*< A conversation that could have a sample  */
+  GList *item;                  /*< A conversation in the list (iteration)   */
+
+  if ( !latency.started )
+    return;
+
+  purple_signals_disconnect_by_handle(&latency);
+
+  /* Drop the samples that are still waiting to be drawn. */
+  for ( item = purple_get_conversations(); item != NULL; item = item->next ) {
+    gtkconv = PIDGIN_CONVERSATION(item->data);
+    if ( gtkconv == NULL || gtkconv->imhtml == NULL )
+      continue;
+    g_signal_handlers_disconnect_matched(gtkconv->imhtml, G_SIGNAL_MATCH_FUNC,
+                                         0, 0, NULL, expose_event_cb, NULL);
+    g_object_set_data(G_OBJECT(gtkconv->imhtml), "pwm_sample", NULL);
+  }
+
+  report_summary(&latency.merged, "merged");
+  report_summary(&latency.stock, "stock");
+
+  latency.started = FALSE;
+}
@@ -27,18 +27,49 @@
 #include <gtkconv.h>
 #include <gtkimhtml.h>
 
+#include <account.h>
+#include <blist.h>
 #include <prefs.h>
 
 #include <gdk/gdkkeysyms.h>
 
+#include "probes.h"
 #include "window_merge.h"
 
+/** Milliseconds between checks for the end of a tab drag */
+#define DRAG_SYNC_INTERVAL 50
+
+/** The keys bound with Ctrl+Shift as shortcuts in the merged window */
+static const guint shortcut_keys[] = { GDK_b, GDK_f, GDK_m, GDK_o, GDK_u, 0 };
+
 
+/**
+ * Return the side of the Buddy List where a paned layout has conversations
+ *
+ * @param[in] paned      The GtkPaned containing the Buddy List
+ * @param[in] gtkblist   The Buddy List in the paned layout
+ * @return               The static name of the conversations' side
+**/
+static const char *
+paned_get_side(GObject *paned, PidginBuddyList *gtkblist)
+{
+  gboolean blist_first;         /*< Whether the Buddy List is the first pane */
+
+  blist_first = gtk_paned_get_child1(GTK_PANED(paned)) == gtkblist->notebook;
+
+  if ( GTK_IS_VPANED(paned) )
+    return blist_first ? "bottom" : "top";
+  else
+    return blist_first ? "right" : "left";
+}
+
+
 /**
  * A callback for when the position of a GtkPaned slider changes
  *
  * This function is responsible for storing the width or height of the Buddy
- * List as a preference after the user changes it by dragging the slider.
+ * List in the layout state after the user changes it by dragging the slider.
+ * Each side has its own size, since the space available usually differs.
  *
  * @param[in] gobject    Pointer to the GtkPaned structure that was resized
  * @param[in] pspec      Unused
@@ -48,10 +79,20 @@ static void
 notify_position_cb(GObject *gobject, U GParamSpec *pspec, gpointer data)
 {
   PidginBuddyList *gtkblist;    /*< Buddy List window containing these panes */
+  PidginWindow *gtkconvwin;     /*< Conversation window merged into gtkblist */
   gint max_position;            /*< The "max-position" property of gobject   */
   gint size;                    /*< Current size of the Buddy List pane      */
 
   gtkblist = data;
+
+  gtkconvwin = pwm_blist_get_convs(gtkblist);
+
+  /* Sanity check: The slider isn't the Buddy List's size with a pane gone. */
+  if ( pwm_fetch(gtkblist, "blist_strip") != NULL ||
+       pwm_fetch(gtkblist, "detached") != NULL ||
+       (gtkconvwin != NULL && !gtk_widget_get_visible(gtkconvwin->notebook)) )
+    return;
+
   size = gtk_paned_get_position(GTK_PANED(gobject));
 
   /* If the Buddy List is not the first pane, invert the size preference. */
@@ -60,11 +101,8 @@ notify_position_cb(GObject *gobject, U GParamSpec *pspec, gpointer data)
     size = max_position - size;
   }
 
-  /* Store this size as a user preference (depending on paned orientation). */
-  if ( GTK_IS_VPANED(gobject) )
-    purple_prefs_set_int(PREF_HEIGHT, size);
-  else
-    purple_prefs_set_int(PREF_WIDTH, size);
+  /* Store this size as the layout state for the current side. */
+  pwm_state_set_int("sizes", paned_get_side(gobject, gtkblist), size);
 }
 
 
@@ -89,11 +127,8 @@ notify_max_position_cb(GObject *gobject, U GParamSpec *pspec, gpointer data)
 
   gtkblist = data;
 
-  /* Fetch the user's preferred Buddy List size (depending on orientation). */
-  if ( GTK_IS_VPANED(gobject) )
-    size = purple_prefs_get_int(PREF_HEIGHT);
-  else
-    size = purple_prefs_get_int(PREF_WIDTH);
+  /* Fetch the user's preferred Buddy List size for the current side. */
+  size = pwm_state_get_int("sizes", paned_get_side(gobject, gtkblist), 300);
 
   /* If the Buddy List is not the first pane, invert the size preference. */
   if ( gtk_paned_get_child1(GTK_PANED(gobject)) != gtkblist->notebook ) {
@@ -148,6 +183,363 @@ focus_in_event_cb(U GtkWidget *widget, U GdkEventFocus *event, gpointer data)
 }
 
 
+/**
+ * A callback for the keyboard shortcuts of the merged window
+ *
+ * @param[in] group      Unused
+ * @param[in] window     Unused
+ * @param[in] keyval     The key of the shortcut that was pressed
+ * @param[in] modifier   Unused
+ * @param[in] data       Pointer to the merged Buddy List
+ * @return               Whether the shortcut was handled
+**/
+static gboolean
+shortcut_cb(U GtkAccelGroup *group, U GObject *window, guint keyval,
+            U GdkModifierType modifier, gpointer data)
+{
+  PidginBuddyList *gtkblist;    /*< The merged Buddy List                    */
+
+  gtkblist = data;
+
+  switch ( keyval ) {
+    case GDK_b:
+      pwm_set_blist_collapsed(gtkblist,
+                              pwm_fetch(gtkblist, "blist_strip") == NULL);
+      return TRUE;
+    case GDK_f:
+      pwm_search_show(gtkblist);
+      return TRUE;
+    case GDK_m:
+      pwm_set_notebook_detached(gtkblist,
+                                pwm_fetch(gtkblist, "detached") == NULL);
+      return TRUE;
+    case GDK_o:
+      pwm_switcher_show(gtkblist);
+      return TRUE;
+    case GDK_u:
+      pwm_switcher_next_unread(gtkblist);
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+
+/**
+ * A callback for when an account is chosen from the "Send To" menu
+ *
+ * @param[in] item       The menu item of the buddy to send to
+ * @param[in] data       Unused
+**/
+static void
+send_to_toggled_cb(GtkCheckMenuItem *item, U gpointer data)
+{
+  PurpleConversation *conv;     /*< The conversation with the chosen buddy   */
+
+  /* Sanity check: Only act on the newly selected buddy. */
+  if ( !gtk_check_menu_item_get_active(item) )
+    return;
+
+  conv = purple_conversation_new(PURPLE_CONV_TYPE_IM,
+                                 g_object_get_data(G_OBJECT(item),
+                                                   "pwm_account"),
+                                 g_object_get_data(G_OBJECT(item),
+                                                   "pwm_name"));
+  pidgin_conv_switch_active_conversation(conv);
+}
+
+
+/**
+ * A callback for when the "Send To" menu item is selected, to fill its menu
+ *
+ * The menu lists the online buddies in the contact of the active IM, and it
+ * is only built when it is about to be opened.  Pidgin rebuilds its own menu
+ * every time a tab is switched.
+ *
+ * @param[in] send_to    The "Send To" menu item
+ * @param[in] data       The conversation window merged into the Buddy List
+**/
+static void
+send_to_select_cb(GtkMenuItem *send_to, gpointer data)
+{
+  PurpleConversation *conv;     /*< The active conversation of the window    */
+  PurpleAccount *account;       /*< The account of a buddy                   */
+  PurpleBlistNode *node;        /*< A buddy in the contact (iteration)       */
+  PidginConversation *gtkconv;  /*< The active conversation UI of the window */
+  PurpleBuddy *buddy;           /*< The buddy of the active conversation     */
+  GtkWidget *menu;              /*< The "Send To" submenu being built        */
+  GtkWidget *item;              /*< A menu item for a buddy                  */
+  GSList *group = NULL;         /*< The group of the buddies' radio items    */
+  gchar *label;                 /*< The text of a buddy's menu item          */
+
+  menu = gtk_menu_item_get_submenu(send_to);
+  gtk_container_foreach(GTK_CONTAINER(menu), (GtkCallback)gtk_widget_destroy,
+                        NULL);
+
+  gtkconv = pidgin_conv_window_get_active_gtkconv(data);
+  conv = gtkconv != NULL ? gtkconv->active_conv : NULL;
+  buddy = conv != NULL &&
+          purple_conversation_get_type(conv) == PURPLE_CONV_TYPE_IM ?
+          purple_find_buddy(purple_conversation_get_account(conv),
+                            purple_conversation_get_name(conv)) : NULL;
+  node = buddy != NULL ? purple_blist_node_get_first_child(
+                           PURPLE_BLIST_NODE(purple_buddy_get_contact(buddy)))
+                       : NULL;
+
+  for ( ; node != NULL; node = purple_blist_node_get_sibling_next(node) ) {
+    if ( !PURPLE_BLIST_NODE_IS_BUDDY(node) )
+      continue;
+    account = purple_buddy_get_account(PURPLE_BUDDY(node));
+    if ( !purple_account_is_connected(account) )
+      continue;
+
+    label = g_strdup_printf("%s (%s)",
+                            purple_buddy_get_name(PURPLE_BUDDY(node)),
+                            purple_account_get_username(account));
+    item = gtk_radio_menu_item_new_with_label(group, label);
+    group = gtk_radio_menu_item_get_group(GTK_RADIO_MENU_ITEM(item));
+    g_free(label);
+
+    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(item),
+                                   PURPLE_BUDDY(node) == buddy);
+    g_object_set_data(G_OBJECT(item), "pwm_account", account);
+    g_object_set_data_full(G_OBJECT(item), "pwm_name",
+                           g_strdup(purple_buddy_get_name(PURPLE_BUDDY(node))),
+                           g_free);
+    g_object_connect(G_OBJECT(item), "signal::toggled",
+                     G_CALLBACK(send_to_toggled_cb), NULL, NULL);
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
+  }
+
+  /* Say so when there is nobody else to send to. */
+  if ( group == NULL ) {
+    /* TRANSLATORS: This is displayed in the "Send To" menu when the active
+       conversation has no other buddies or accounts to send messages to. */
+    item = gtk_menu_item_new_with_label(_("None"));
+    gtk_widget_set_sensitive(item, FALSE);
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
+  }
+
+  gtk_widget_show_all(menu);
+}
+
+
+/**
+ * An idle callback to merge a Buddy List after it has been drawn
+ *
+ * @param[in] data       Pointer to the Buddy List waiting to be merged
+ * @return               Whether to call this function again
+**/
+static gboolean
+deferred_merge_cb(gpointer data)
+{
+  PidginBuddyList *gtkblist;    /*< The Buddy List waiting to be merged      */
+
+  gtkblist = data;
+
+  /* Sanity check: Don't touch a Buddy List that was destroyed meanwhile. */
+  if ( gtkblist != pidgin_blist_get_default_gtk_blist() )
+    return FALSE;
+
+  pwm_clear(gtkblist, "defer_idle");
+  pwm_merge_conversation(gtkblist);
+
+  return FALSE;
+}
+
+
+/**
+ * A callback for when the Buddy List window is first drawn
+ *
+ * This only schedules the deferred merge, so drawing the rest of the window
+ * is not delayed by it.  It disconnects itself, since it is only needed once.
+ *
+ * @param[in] widget     The Buddy List window being drawn
+ * @param[in] event      Unused
+ * @param[in] data       Pointer to the Buddy List waiting to be merged
+ * @return               Whether to stop processing other event handlers
+**/
+static gboolean
+deferred_expose_event_cb(GtkWidget *widget, U GdkEventExpose *event,
+                         gpointer data)
+{
+  g_object_disconnect(G_OBJECT(widget), "any_signal",
+                      G_CALLBACK(deferred_expose_event_cb), data, NULL);
+  pwm_store((PidginBuddyList *)data, "defer_idle",
+            GUINT_TO_POINTER(g_idle_add(deferred_merge_cb, data)));
+
+  return FALSE;
+}
+
+
+/**
+ * Stop waiting to merge a Buddy List, leaving its reserved panes in place
+ *
+ * @param[in] gtkblist   The Buddy List that was waiting to be merged
+**/
+static void
+stop_deferred_merge(PidginBuddyList *gtkblist)
+{
+  guint source;                 /*< The idle source ID of a scheduled merge  */
+
+  source = GPOINTER_TO_UINT(pwm_clear(gtkblist, "defer_idle"));
+  if ( source != 0 )
+    g_source_remove(source);
+  g_signal_handlers_disconnect_by_func(gtkblist->window,
+                                       deferred_expose_event_cb, gtkblist);
+  pwm_clear(gtkblist, "deferred");
+}
+
+
+/**
+ * Remove the reserved panes of a deferred merge from the Buddy List
+ *
+ * @param[in] gtkblist   The Buddy List that was waiting to be merged
+**/
+static void
+cancel_deferred_merge(PidginBuddyList *gtkblist)
+{
+  stop_deferred_merge(gtkblist);
+
+  /* Restore the Buddy List's original structure, and destroy the panes. */
+  pwm_widget_replace(pwm_fetch(gtkblist, "paned"), gtkblist->notebook, NULL);
+  pwm_clear(gtkblist, "paned");
+  pwm_clear(gtkblist, "reserve");
+}
+
+
+/**
+ * Move the conversation notebook into the panes reserved by a deferred merge
+ *
+ * The reserved panes are already drawn at their final size, so the notebook
+ * simply trades places with the empty widget holding its spot.  That widget
+ * then marks the notebook's original spot in the conversation window.  The
+ * panes are only reconstructed if the side preference changed meanwhile.
+ *
+ * @param[in] gtkblist   The Buddy List whose reserved panes are being filled
+**/
+static void
+fill_reserved_panes(PidginBuddyList *gtkblist)
+{
+  PidginWindow *gtkconvwin;     /*< Conversation window merged into gtkblist */
+  GtkWidget *paned;             /*< The panes reserved in the Buddy List     */
+  GtkWidget *reserve;           /*< Empty widget in the conversation area   */
+  const char *side;             /*< Where convs are placed relative to blist */
+
+  stop_deferred_merge(gtkblist);
+  gtkconvwin = pwm_blist_get_convs(gtkblist);
+  paned = pwm_fetch(gtkblist, "paned");
+  reserve = pwm_clear(gtkblist, "reserve");
+
+  pwm_widget_swap(gtkconvwin->notebook, reserve);
+  gtk_widget_hide(reserve);
+  gtk_widget_set_no_show_all(reserve, TRUE);
+  pwm_store(gtkblist, "placeholder", reserve);
+
+  /* Rebuild the panes only if they are now on the wrong side. */
+  side = purple_prefs_get_string(PREF_SIDE);
+  if ( side == NULL || *side != *paned_get_side(G_OBJECT(paned), gtkblist) )
+    pwm_create_paned_layout(gtkblist, side);
+}
+
+
+/**
+ * A callback for when a tab is added to or removed from the merged notebook
+ *
+ * @param[in] notebook   Unused
+ * @param[in] child      Unused
+ * @param[in] page_num   Unused
+ * @param[in] data       Pointer to the merged Buddy List
+**/
+static void
+notebook_page_cb(U GtkNotebook *notebook, U GtkWidget *child,
+                 U guint page_num, gpointer data)
+{
+  pwm_update_idle_layout(data);
+}
+
+
+/**
+ * Place the panes' slider for the Buddy List's saved size on its side
+ *
+ * This is used when the conversation pane reappears, since the slider was
+ * left wherever it was when the pane was taken away.
+ *
+ * @param[in] gtkblist   The merged Buddy List whose slider is placed
+**/
+static void
+restore_slider(PidginBuddyList *gtkblist)
+{
+  GtkAllocation allocation;     /*< The allocated area of the panes          */
+  GtkWidget *paned;             /*< The panes of the merged window           */
+  gint handle_size;             /*< The width of the slider handle           */
+  gint size;                    /*< The saved size of the Buddy List pane    */
+
+  paned = pwm_fetch(gtkblist, "paned");
+
+  /* Sanity check: A collapsed Buddy List keeps its strip. */
+  if ( paned == NULL || pwm_fetch(gtkblist, "blist_strip") != NULL )
+    return;
+
+  size = pwm_state_get_int("sizes", paned_get_side(G_OBJECT(paned), gtkblist),
+                           300);
+  if ( gtk_paned_get_child1(GTK_PANED(paned)) != gtkblist->notebook ) {
+    gtk_widget_get_allocation(paned, &allocation);
+    gtk_widget_style_get(paned, "handle-size", &handle_size, NULL);
+    size = (GTK_IS_VPANED(paned) ? allocation.height : allocation.width) -
+           2 * (gint)gtk_container_get_border_width(GTK_CONTAINER(paned)) -
+           handle_size - size;
+  }
+  if ( size > 0 )
+    gtk_paned_set_position(GTK_PANED(paned), size);
+}
+
+
+/**
+ * Hide the conversation pane while it only has the dummy tab, or show it
+ *
+ * A hidden pane gives the Buddy List the whole window, and nothing in it is
+ * allocated or drawn, so the wrapped instructions label doesn't reflow as the
+ * window is resized.  The Buddy List's saved size is set before the pane is
+ * shown again, so the first conversation is laid out in a single pass.
+ *
+ * @param[in] gtkblist   The merged Buddy List whose conversation pane changes
+**/
+void
+pwm_update_idle_layout(PidginBuddyList *gtkblist)
+{
+  PidginWindow *gtkconvwin;     /*< Conversation window merged into gtkblist */
+  gboolean idle;                /*< Whether only the dummy tab is displayed  */
+
+  gtkconvwin = pwm_blist_get_convs(gtkblist);
+
+  /* Sanity check: Only change the panes of a merged Buddy List. */
+  if ( gtkconvwin == NULL )
+    return;
+
+  idle = purple_prefs_get_bool(PREF_IDLE) &&
+         pwm_fetch(gtkblist, "detached") == NULL &&
+         pwm_fetch(gtkblist, "blist_strip") == NULL &&
+         pidgin_conv_get_window(pwm_fetch(gtkblist, "fake_tab")) != NULL &&
+         gtk_notebook_get_n_pages(GTK_NOTEBOOK(gtkconvwin->notebook)) == 1;
+
+  /* Sanity check: Don't change the pane if it is already set. */
+  if ( idle != gtk_widget_get_visible(gtkconvwin->notebook) )
+    return;
+
+  pwm_record_event(gtkblist, G_STRFUNC, NULL);
+
+  if ( idle ) {
+    gtk_widget_hide(gtkconvwin->notebook);
+    return;
+  }
+
+  /* Place the slider for the Buddy List's saved size in the current panes. */
+  restore_slider(gtkblist);
+  gtk_widget_show(gtkconvwin->notebook);
+}
+
+
 /**
  * Create a conversation window and merge it with the given Buddy List window
  *
@@ -162,11 +554,20 @@ pwm_merge_conversation(PidginBuddyList *gtkblist)
 {
   PidginWindow *gtkconvwin;     /*< The mutilated conversations for gtkblist */
   GtkBindingSet *binding_set;   /*< The binding set of GtkIMHtml widgets     */
+  GtkAccelGroup *shortcuts;     /*< The merged window's keyboard shortcuts   */
+  const guint *key;             /*< A shortcut key being bound (iteration)   */
+  gint64 start;                 /*< Monotonic time the merge started         */
+  gint64 dummy_start;           /*< Monotonic time the dummy tab was started */
 
   /* Sanity check: If the Buddy List is already merged, don't mess with it. */
   if ( pwm_blist_get_convs(gtkblist) != NULL )
     return;
 
+  pwm_record_event(gtkblist, G_STRFUNC, NULL);
+  PWM_PROBE1(merge__entry, gtkblist);
+  pwm_watchdog_enter(G_STRFUNC);
+  start = g_get_monotonic_time();
+
   binding_set = gtk_binding_set_by_class(g_type_class_ref(GTK_TYPE_IMHTML));
   gtkconvwin = pidgin_conv_window_new();
 
@@ -179,16 +580,39 @@ pwm_merge_conversation(PidginBuddyList *gtkblist)
             g_strdup(gtk_window_get_title(GTK_WINDOW(gtkblist->window))));
 
   /* Move the conversation notebook into the Buddy List window. */
-  pwm_create_paned_layout(gtkblist, purple_prefs_get_string(PREF_SIDE));
+  if ( pwm_fetch(gtkblist, "deferred") != NULL )
+    fill_reserved_panes(gtkblist);
+  else
+    pwm_create_paned_layout(gtkblist, purple_prefs_get_string(PREF_SIDE));
+
+  /* Stop the Buddy List from measuring every row when the panes resize. */
+  pwm_init_blist_rows(gtkblist);
 
   /* Display the instructions tab for new users. */
+  dummy_start = g_get_monotonic_time();
   pwm_init_dummy_conversation(gtkblist);
   pwm_show_dummy_conversation(gtkblist);
+  pwm_startup_record("dummy", dummy_start);
+
+  /* Only lay out the conversation tab that is displayed. */
+  pwm_init_lazy_tabs(gtkblist);
+
+  /* Hold back messages while the merged window can't be seen. */
+  pwm_display_watch(gtkblist);
 
   /* Pass focus events from Buddy List to conversation window. */
   g_object_connect(G_OBJECT(gtkblist->window), "signal::focus-in-event",
                    G_CALLBACK(focus_in_event_cb), gtkconvwin->window, NULL);
 
+  /* Add the merged window's own keyboard shortcuts. */
+  shortcuts = gtk_accel_group_new();
+  for ( key = shortcut_keys; *key != 0; key++ )
+    gtk_accel_group_connect(shortcuts, *key, GDK_CONTROL_MASK | GDK_SHIFT_MASK,
+                            0, g_cclosure_new(G_CALLBACK(shortcut_cb),
+                                              gtkblist, NULL));
+  gtk_window_add_accel_group(GTK_WINDOW(gtkblist->window), shortcuts);
+  pwm_store(gtkblist, "shortcuts", shortcuts);
+
   /* Point the conversation window structure at the Buddy List's window. */
   pwm_store(gtkblist, "conv_window", gtkconvwin->window);
   gtkconvwin->window = gtkblist->window;
@@ -205,9 +629,92 @@ pwm_merge_conversation(PidginBuddyList *gtkblist)
   gtk_binding_entry_skip(binding_set, GDK_Tab,          GDK_CONTROL_MASK);
   gtk_binding_entry_skip(binding_set, GDK_KP_Tab,       GDK_CONTROL_MASK);
   gtk_binding_entry_skip(binding_set, GDK_ISO_Left_Tab, GDK_CONTROL_MASK);
+
+  /* Bring back the tabs of the last session without opening them yet. */
+  if ( purple_prefs_get_bool(PREF_SESSION) )
+    pwm_session_restore(gtkblist);
+
+  /* Hide the conversation pane whenever it only has the instructions tab. */
+  g_object_connect(G_OBJECT(gtkconvwin->notebook),
+                   "signal::page-added", G_CALLBACK(notebook_page_cb),
+                   gtkblist,
+                   "signal::page-removed", G_CALLBACK(notebook_page_cb),
+                   gtkblist,
+                   NULL);
+  pwm_update_idle_layout(gtkblist);
+
+  /* Time the merge, and the wait until the merged window is ready for use. */
+  pwm_startup_record("merge", start);
+  pwm_startup_finish();
+  pwm_watchdog_leave();
+  PWM_PROBE3(merge__return, gtkblist, gtkconvwin->notebook,
+             PWM_PROBE_TABS(gtkblist));
 }
 
 
+/**
+ * Reserve space in the Buddy List window to merge conversations after drawing
+ *
+ * Creating the conversation window and dummy tab is expensive enough to delay
+ * the first display of the Buddy List.  This only splits the window into the
+ * usual panes, with an empty widget where conversations will go, so that the
+ * Buddy List is drawn at its final size.  The real merge is done when idle
+ * after the window is first drawn, or as soon as a conversation needs it, and
+ * it moves the conversation notebook into these same panes.
+ *
+ * @param[in] gtkblist   The Buddy List that will be able to show conversations
+**/
+void
+pwm_defer_merge_conversation(PidginBuddyList *gtkblist)
+{
+  GtkWidget *paned;             /*< Panes reserving the conversation area   */
+  GtkWidget *reserve;           /*< Empty widget in the conversation area   */
+  const char *side;             /*< Where convs are placed relative to blist */
+
+  /* Sanity check: Only defer merging a pristine Buddy List. */
+  if ( pwm_blist_get_convs(gtkblist) != NULL ||
+       pwm_fetch(gtkblist, "deferred") != NULL )
+    return;
+
+  pwm_record_event(gtkblist, G_STRFUNC, NULL);
+  side = purple_prefs_get_string(PREF_SIDE);
+  reserve = gtk_label_new(NULL);
+  gtk_widget_show(reserve);
+
+  /* Create the requested vertical or horizontal paned layout. */
+  if ( side != NULL && (*side == 't' || *side == 'b') )
+    paned = gtk_vpaned_new();
+  else
+    paned = gtk_hpaned_new();
+  gtk_widget_show(paned);
+
+  /* Pack the panes in the same order as pwm_create_paned_layout(). */
+  if ( side != NULL && (*side == 't' || *side == 'l') ) {
+    gtk_paned_pack1(GTK_PANED(paned), reserve, TRUE, TRUE);
+    pwm_widget_replace(gtkblist->notebook, paned, paned);
+  } else {
+    pwm_widget_replace(gtkblist->notebook, paned, paned);
+    gtk_paned_pack2(GTK_PANED(paned), reserve, TRUE, TRUE);
+  }
+  gtk_container_child_set(GTK_CONTAINER(paned), gtkblist->notebook,
+                          "resize", FALSE, NULL);
+  pwm_store(gtkblist, "paned", paned);
+  pwm_store(gtkblist, "reserve", reserve);
+  pwm_store(gtkblist, "deferred", GINT_TO_POINTER(TRUE));
+
+  /* Outline the slider while dragging instead of resizing panes live. */
+  pwm_init_paned_drag(paned);
+
+  /* When the size of the panes is determined, reset the Buddy List size. */
+  g_object_connect(G_OBJECT(paned), "signal::notify::max-position",
+                   G_CALLBACK(notify_max_position_cb), gtkblist, NULL);
+
+  /* Schedule the real merge once the Buddy List has been drawn. */
+  g_object_connect(G_OBJECT(gtkblist->window), "signal-after::expose-event",
+                   G_CALLBACK(deferred_expose_event_cb), gtkblist, NULL);
+}
+
+
 /**
  * Restore the Buddy List to its former glory by splitting off conversations
  *
@@ -221,16 +728,58 @@ void
 pwm_split_conversation(PidginBuddyList *gtkblist)
 {
   PidginWindow *gtkconvwin;     /*< Conversation window merged into gtkblist */
+  GtkAccelGroup *shortcuts;     /*< The merged window's keyboard shortcuts   */
   GtkWidget *paned;             /*< The panes on the Buddy List window       */
   gchar *title;                 /*< Original title of the Buddy List window  */
 
+  /* Sanity check: A Buddy List still waiting to be merged is simply reset. */
+  if ( pwm_fetch(gtkblist, "deferred") != NULL ) {
+    cancel_deferred_merge(gtkblist);
+    return;
+  }
+
+  pwm_record_event(gtkblist, G_STRFUNC, NULL);
+  PWM_PROBE2(split__entry, gtkblist, PWM_PROBE_TABS(gtkblist));
+  pwm_watchdog_enter(G_STRFUNC);
+
   gtkconvwin = pwm_blist_get_convs(gtkblist);
   paned = pwm_fetch(gtkblist, "paned");
   title = pwm_fetch(gtkblist, "title");
 
+  /* Put a detached notebook back, so it is restored like any other. */
+  pwm_set_notebook_detached(gtkblist, FALSE);
+
+  /* Put a collapsed Buddy List back in its pane before the panes go away. */
+  pwm_set_blist_collapsed(gtkblist, FALSE);
+
+  /* Show the conversation pane, since it will be in its own window. */
+  g_object_disconnect(G_OBJECT(gtkconvwin->notebook), "any_signal",
+                      G_CALLBACK(notebook_page_cb), gtkblist, NULL);
+  gtk_widget_show(gtkconvwin->notebook);
+
+  /* Forget the end of a tab drag, since there will be nothing to update. */
+  if ( pwm_fetch(gtkblist, "drag_sync") != NULL )
+    g_source_remove(GPOINTER_TO_UINT(pwm_clear(gtkblist, "drag_sync")));
+
   /* Ensure the conversation window's menu items are returned. */
   pwm_set_conv_menus_visible(gtkblist, FALSE);
 
+  /* Give the "Send To" menu back to Pidgin to rebuild on the next switch. */
+  if ( pwm_fetch(gtkblist, "send_to") != NULL ) {
+    gtkconvwin->menu.send_to = pwm_clear(gtkblist, "send_to");
+    g_object_disconnect(G_OBJECT(gtkconvwin->menu.send_to), "any_signal",
+                        G_CALLBACK(send_to_select_cb), gtkconvwin, NULL);
+  }
+
+  /* Write any messages that were held while the window was hidden. */
+  pwm_display_unwatch(gtkblist);
+
+  /* Ensure every conversation tab is displayed normally again. */
+  pwm_free_lazy_tabs(gtkblist);
+
+  /* Remove the last session's placeholders while they can still be found. */
+  pwm_session_clear(gtkblist);
+
   /* End the association between the Buddy List and its conversation window. */
   g_object_steal_data(G_OBJECT(gtkblist->notebook), "pwm_convs");
   g_object_steal_data(G_OBJECT(gtkconvwin->notebook), "pwm_blist");
@@ -243,17 +792,23 @@ pwm_split_conversation(PidginBuddyList *gtkblist)
   g_object_disconnect(G_OBJECT(gtkblist->window), "any_signal",
                       G_CALLBACK(focus_in_event_cb), gtkconvwin->window, NULL);
 
+  /* Remove the merged window's own keyboard shortcuts. */
+  shortcuts = pwm_clear(gtkblist, "shortcuts");
+  gtk_window_remove_accel_group(GTK_WINDOW(gtkblist->window), shortcuts);
+  g_object_unref(shortcuts);
+
   /* Restore the conversation window's notebook. */
   pwm_widget_replace(pwm_fetch(gtkblist, "placeholder"),
                      gtkconvwin->notebook, NULL);
   pwm_clear(gtkblist, "placeholder");
 
-  /* Free the dummy conversation, and display the window if it survives. */
+  /* Free the dummy, and show the window if it survives. */
   pwm_free_dummy_conversation(gtkblist);
   if ( g_list_find(pidgin_conv_windows_get_list(), gtkconvwin) != NULL )
     pidgin_conv_window_show(gtkconvwin);
 
   /* Restore the Buddy List's original structure, and destroy the panes. */
+  pwm_free_blist_rows(gtkblist);
   pwm_widget_replace(paned, gtkblist->notebook, NULL);
   pwm_clear(gtkblist, "paned");
 
@@ -262,6 +817,8 @@ pwm_split_conversation(PidginBuddyList *gtkblist)
   gtk_window_set_title(GTK_WINDOW(gtkblist->window), title);
   g_free(title);
   pwm_clear(gtkblist, "title");
+  pwm_watchdog_leave();
+  PWM_PROBE1(split__return, gtkblist);
 }
 
 
@@ -286,7 +843,13 @@ pwm_create_paned_layout(PidginBuddyList *gtkblist, const char *side)
   GtkWidget *placeholder;       /*< Marks the conv notebook's original spot  */
   GValue value = G_VALUE_INIT;  /*< For passing a property value to a widget */
 
+  pwm_record_event(gtkblist, G_STRFUNC, NULL);
+  PWM_PROBE3(layout__entry, gtkblist, side, PWM_PROBE_TABS(gtkblist));
+  pwm_watchdog_enter(G_STRFUNC);
   gtkconvwin = pwm_blist_get_convs(gtkblist);
+
+  /* Expand a collapsed Buddy List, so it can be moved to the new panes. */
+  pwm_set_blist_collapsed(gtkblist, FALSE);
   old_paned = pwm_fetch(gtkblist, "paned");
 
   /* Create the requested vertical or horizontal paned layout. */
@@ -297,6 +860,9 @@ pwm_create_paned_layout(PidginBuddyList *gtkblist, const char *side)
   gtk_widget_show(paned);
   pwm_store(gtkblist, "paned", paned);
 
+  /* Outline the slider while dragging instead of resizing panes live. */
+  pwm_init_paned_drag(paned);
+
   /* When the size of the panes is determined, reset the Buddy List size. */
   g_object_connect(G_OBJECT(paned), "signal::notify::max-position",
                    G_CALLBACK(notify_max_position_cb), gtkblist, NULL);
@@ -304,6 +870,7 @@ pwm_create_paned_layout(PidginBuddyList *gtkblist, const char *side)
   /* If the Buddy List is pristine, make the panes and replace its notebook. */
   if ( old_paned == NULL ) {
     placeholder = gtk_label_new(NULL);
+    gtk_widget_set_no_show_all(placeholder, TRUE);
     if ( side != NULL && (*side == 't' || *side == 'l') ) {
       pwm_widget_replace(gtkconvwin->notebook, placeholder, paned);
       pwm_widget_replace(gtkblist->notebook, paned, paned);
@@ -334,6 +901,8 @@ pwm_create_paned_layout(PidginBuddyList *gtkblist, const char *side)
   g_value_set_boolean(&value, FALSE);
   gtk_container_child_set_property(GTK_CONTAINER(paned), gtkblist->notebook,
                                    "resize", &value);
+  pwm_watchdog_leave();
+  PWM_PROBE3(layout__return, gtkblist, paned, PWM_PROBE_TABS(gtkblist));
 }
 
 
@@ -354,12 +923,16 @@ pwm_create_paned_layout(PidginBuddyList *gtkblist, const char *side)
  * right-justified item.  This gives the appearance of appending any newly
  * added menu items when they are all migrated to the Buddy List again.
  *
+ * The items stay hidden while a tab restored from the last session is being
+ * displayed, since their actions expect the current tab to be a conversation.
+ *
  * @param[in] gtkblist   The Buddy List whose menu needs adjusting
  * @param[in] visible    Whether the menu items are being shown or hidden
 **/
 void
 pwm_set_conv_menus_visible(PidginBuddyList *gtkblist, gboolean visible)
 {
+  PidginConversation *gtkconv;  /*< The conversation of the current tab      */
   PidginWindow *gtkconvwin;     /*< Conversation window merged into gtkblist */
   GtkMenu *submenu;             /*< A submenu of a conversation menu item    */
   GtkContainer *from_menu;      /*< Menu bar of the window losing the items  */
@@ -373,22 +946,41 @@ pwm_set_conv_menus_visible(PidginBuddyList *gtkblist, gboolean visible)
   gint index_left;              /*< Position to insert left-justified items  */
   gint index_right;             /*< Position to insert right-justified items */
 
+  pwm_record_event(gtkblist, G_STRFUNC, NULL);
   gtkconvwin = pwm_blist_get_convs(gtkblist);
 
   /* Sanity check: Only act on a merged Buddy List window. */
   if ( gtkconvwin == NULL )
     return;
 
+  /* Sanity check: A detached notebook keeps its menus in its own window. */
+  if ( visible && pwm_fetch(gtkblist, "detached") != NULL )
+    return;
+
+  /* Sanity check: A restored tab has no conversation for the menus to use. */
+  gtkconv = pidgin_conv_window_get_active_gtkconv(gtkconvwin);
+  if ( visible && gtkconv != NULL && gtkconv->active_conv == NULL &&
+       gtkconv != pwm_fetch(gtkblist, "fake_tab") )
+    return;
+
+  PWM_PROBE3(menus__entry, gtkblist, visible, PWM_PROBE_TABS(gtkblist));
+
   blist_menu = gtk_widget_get_parent(gtkblist->menutray);
   convs_menu = gtkconvwin->menu.menubar;
   from_menu = GTK_CONTAINER(visible ? convs_menu : blist_menu);
   to_menu   = GTK_CONTAINER(visible ? blist_menu : convs_menu);
   migrated_items = pwm_fetch(gtkblist, "conv_menus");
 
-  /* XXX: Drop the "Send To" menu to avoid segfaults. */
+  /* XXX: Pidgin's "Send To" menu segfaults, so build it here when opened. */
   if ( visible && gtkconvwin->menu.send_to != NULL ) {
-    gtk_widget_destroy(gtkconvwin->menu.send_to);
+    item = gtkconvwin->menu.send_to;
     gtkconvwin->menu.send_to = NULL;
+    gtk_menu_item_set_submenu(GTK_MENU_ITEM(item), gtk_menu_new());
+    g_object_connect(G_OBJECT(item), "signal::select",
+                     G_CALLBACK(send_to_select_cb), gtkconvwin, NULL);
+    gtk_widget_set_no_show_all(item, FALSE);
+    gtk_widget_show(item);
+    pwm_store(gtkblist, "send_to", item);
   }
 
   /* Locate the position before the first right-aligned menu item. */
@@ -437,4 +1029,329 @@ pwm_set_conv_menus_visible(PidginBuddyList *gtkblist, gboolean visible)
     pwm_store(gtkblist, "conv_menus", migrated_items);
   else
     pwm_clear(gtkblist, "conv_menus");
+
+  PWM_PROBE3(menus__return, gtkblist, visible, PWM_PROBE_TABS(gtkblist));
+}
+
+
+/**
+ * Update the dummy tab, menus, and window title for the current conversations
+ *
+ * This does the work of the conversation signal callbacks once after a batch
+ * of conversations was moved, instead of once for each conversation.
+ *
+ * @param[in] gtkblist   The Buddy List whose conversations were moved
+**/
+static void
+sync_conversation_state(PidginBuddyList *gtkblist)
+{
+  PidginWindow *gtkconvwin;     /*< Conversation window merged into gtkblist */
+
+  gtkconvwin = pwm_blist_get_convs(gtkblist);
+
+  if ( pwm_count_real_convs(gtkconvwin) > 0 ) {
+    pwm_hide_dummy_conversation(gtkblist);
+    pwm_set_conv_menus_visible(gtkblist, TRUE);
+  } else {
+    pwm_show_dummy_conversation(gtkblist);
+    gtk_window_set_icon_list(GTK_WINDOW(gtkblist->window), NULL);
+    gtk_window_set_title(GTK_WINDOW(gtkblist->window),
+                         pwm_fetch(gtkblist, "title"));
+    pwm_set_conv_menus_visible(gtkblist, FALSE);
+  }
+
+  pwm_update_idle_layout(gtkblist);
+}
+
+
+/**
+ * A timeout callback to settle the merged window once a tab drag has ended
+ *
+ * @param[in] data       Pointer to the Buddy List whose tabs were dragged
+ * @return               Whether to call this function again
+**/
+static gboolean
+drag_sync_cb(gpointer data)
+{
+  PidginBuddyList *gtkblist;    /*< The Buddy List whose tabs were dragged   */
+  PidginConversation *gtkconv;  /*< The active conversation after the drag   */
+  PidginWindow *gtkconvwin;     /*< Conversation window merged into gtkblist */
+
+  gtkblist = data;
+  gtkconvwin = pwm_blist_get_convs(gtkblist);
+
+  /* Keep waiting while the mouse button is still held on a tab. */
+  if ( gtkconvwin->in_drag || gtkconvwin->in_predrag )
+    return TRUE;
+
+  pwm_record_event(gtkblist, G_STRFUNC, NULL);
+  pwm_watchdog_enter(G_STRFUNC);
+  pwm_clear(gtkblist, "drag_sync");
+  sync_conversation_state(gtkblist);
+
+  /* Focus the entry field, as if the active conversation was just opened. */
+  gtkconv = pidgin_conv_window_get_active_gtkconv(gtkconvwin);
+  if ( gtkconv != pwm_fetch(gtkblist, "fake_tab") )
+    gtk_widget_grab_focus(gtkconv->entry);
+  pwm_watchdog_leave();
+
+  return FALSE;
+}
+
+
+/**
+ * Update the merged window once when a tab drag ends, instead of during it
+ *
+ * Pressing a tab switches to it and starts a possible drag, and dropping it
+ * can move it out and back in again.  Each of these steps would otherwise
+ * move the menus and reset the dummy tab and window title, so the drag is
+ * treated as one session and only its net result is applied at the end.
+ *
+ * @param[in] gtkblist   The Buddy List whose tabs are being dragged
+**/
+void
+pwm_sync_after_drag(PidginBuddyList *gtkblist)
+{
+  /* Sanity check: Only schedule one update for each drag. */
+  if ( pwm_fetch(gtkblist, "drag_sync") != NULL )
+    return;
+
+  pwm_store(gtkblist, "drag_sync", GUINT_TO_POINTER(
+              g_timeout_add(DRAG_SYNC_INTERVAL, drag_sync_cb, gtkblist)));
+}
+
+
+/**
+ * Move every conversation from other visible windows into the Buddy List
+ *
+ * The signal callbacks ignore the Buddy List while the conversations are being
+ * moved, and drawing is frozen, so the merged window only changes once.
+ *
+ * @param[in] gtkblist   The Buddy List that will receive all conversations
+**/
+void
+pwm_attach_all_conversations(PidginBuddyList *gtkblist)
+{
+  PidginConversation *gtkconv;  /*< A conversation being moved               */
+  PidginWindow *gtkconvwin;     /*< Conversation window merged into gtkblist */
+  PidginWindow *win;            /*< A window losing its conversations        */
+  GdkWindow *window;            /*< The Buddy List's window, if realized     */
+  GList *windows;               /*< Copy of the list of conversation windows */
+  GList *gtkconvs;              /*< Copy of the conversations of a window    */
+  GList *item;                  /*< A window in the list (iteration)         */
+  GList *conv;                  /*< A conversation in the list (iteration)   */
+
+  gtkconvwin = pwm_blist_get_convs(gtkblist);
+
+  /* Sanity check: Only act on a merged Buddy List window. */
+  if ( gtkconvwin == NULL )
+    return;
+
+  pwm_record_event(gtkblist, G_STRFUNC, NULL);
+  PWM_PROBE2(attach__entry, gtkblist, PWM_PROBE_TABS(gtkblist));
+  pwm_watchdog_enter(G_STRFUNC);
+  window = gtk_widget_get_window(gtkblist->window);
+  if ( window != NULL )
+    gdk_window_freeze_updates(window);
+  pwm_store(gtkblist, "batch", GINT_TO_POINTER(TRUE));
+
+  /* Copy the lists, since windows are destroyed when they are emptied. */
+  windows = g_list_copy(pidgin_conv_windows_get_list());
+  for ( item = windows; item != NULL; item = item->next ) {
+    win = item->data;
+
+    /* Skip the merged window, and the window holding hidden conversations. */
+    if ( win == gtkconvwin || !gtk_widget_get_visible(win->window) )
+      continue;
+
+    gtkconvs = g_list_copy(win->gtkconvs);
+    for ( conv = gtkconvs; conv != NULL; conv = conv->next ) {
+      gtkconv = conv->data;
+      pidgin_conv_window_remove_gtkconv(win, gtkconv);
+      pidgin_conv_window_add_gtkconv(gtkconvwin, gtkconv);
+    }
+    g_list_free(gtkconvs);
+  }
+  g_list_free(windows);
+
+  /* Update the merged window for its new conversations all at once. */
+  pwm_clear(gtkblist, "batch");
+  sync_conversation_state(gtkblist);
+  if ( window != NULL )
+    gdk_window_thaw_updates(window);
+  pwm_watchdog_leave();
+  PWM_PROBE2(attach__return, gtkblist, PWM_PROBE_TABS(gtkblist));
+}
+
+
+/**
+ * Move every conversation out of the Buddy List into a single new window
+ *
+ * The dummy tab is displayed first, so the merged conversation window is not
+ * destroyed when its last real conversation leaves.
+ *
+ * @param[in] gtkblist   The Buddy List that will lose all conversations
+**/
+void
+pwm_detach_all_conversations(PidginBuddyList *gtkblist)
+{
+  PidginConversation *dummy;    /*< The dummy conversation of gtkblist       */
+  PidginConversation *gtkconv;  /*< A conversation being moved               */
+  PidginWindow *gtkconvwin;     /*< Conversation window merged into gtkblist */
+  PidginWindow *win;            /*< The window receiving the conversations   */
+  GdkWindow *window;            /*< The Buddy List's window, if realized     */
+  GList *gtkconvs;              /*< Copy of the merged conversations         */
+  GList *conv;                  /*< A conversation in the list (iteration)   */
+
+  dummy = pwm_fetch(gtkblist, "fake_tab");
+  gtkconvwin = pwm_blist_get_convs(gtkblist);
+
+  /* Sanity check: Only act on a merged window with real conversations. */
+  if ( gtkconvwin == NULL || pidgin_conv_get_window(dummy) != NULL )
+    return;
+
+  pwm_record_event(gtkblist, G_STRFUNC, NULL);
+  PWM_PROBE2(detach__entry, gtkblist, PWM_PROBE_TABS(gtkblist));
+  pwm_watchdog_enter(G_STRFUNC);
+  window = gtk_widget_get_window(gtkblist->window);
+  if ( window != NULL )
+    gdk_window_freeze_updates(window);
+  pwm_store(gtkblist, "batch", GINT_TO_POINTER(TRUE));
+  pwm_show_dummy_conversation(gtkblist);
+
+  /* Fill the new window while it is hidden, so it is only laid out once. */
+  /* Placeholders, including the dummy, stay in the merged window. */
+  win = pidgin_conv_window_new();
+  gtkconvs = g_list_copy(gtkconvwin->gtkconvs);
+  for ( conv = gtkconvs; conv != NULL; conv = conv->next ) {
+    gtkconv = conv->data;
+    if ( gtkconv->active_conv == NULL )
+      continue;
+    pidgin_conv_window_remove_gtkconv(gtkconvwin, gtkconv);
+    pidgin_conv_window_add_gtkconv(win, gtkconv);
+  }
+  g_list_free(gtkconvs);
+  pidgin_conv_window_show(win);
+
+  /* Reset the merged window for having no conversations all at once. */
+  pwm_clear(gtkblist, "batch");
+  sync_conversation_state(gtkblist);
+  if ( window != NULL )
+    gdk_window_thaw_updates(window);
+  pwm_watchdog_leave();
+  PWM_PROBE2(detach__return, gtkblist, PWM_PROBE_TABS(gtkblist));
+}
+
+
+/**
+ * A callback for events on the window of a detached conversation notebook
+ *
+ * Closing the window would close every merged conversation and destroy the
+ * conversation window structure, so the notebook is attached again instead.
+ * The generic "event" signal is used, since it is emitted before Pidgin's own
+ * "delete-event" handler can run.
+ *
+ * @param[in] widget     Unused
+ * @param[in] event      The event on the window
+ * @param[in] data       Pointer to the Buddy List that owns the notebook
+ * @return               Whether to stop processing other event handlers
+**/
+static gboolean
+detached_event_cb(U GtkWidget *widget, GdkEvent *event, gpointer data)
+{
+  if ( event->type != GDK_DELETE )
+    return FALSE;
+
+  pwm_set_notebook_detached(data, FALSE);
+  return TRUE;
+}
+
+
+/**
+ * Move the merged conversation notebook into its own window, or back again
+ *
+ * This is a lighter alternative to pwm_split_conversation() for getting a
+ * separate conversation window for a while.  The panes, dummy tab, lazy tabs,
+ * and keyboard shortcuts are all kept, and the notebook is swapped with its
+ * placeholder without being unrealized, so toggling doesn't depend on the
+ * number of tabs.  Only the menus and window title are moved.
+ *
+ * The placeholder is never shown, so the Buddy List fills its window while
+ * the notebook is detached, as in the idle layout.  The slider is placed for
+ * the Buddy List's saved size when the notebook is attached again.
+ *
+ * @param[in] gtkblist   The merged Buddy List whose notebook is moved
+ * @param[in] detached   Whether the notebook is moved to its own window
+**/
+void
+pwm_set_notebook_detached(PidginBuddyList *gtkblist, gboolean detached)
+{
+  PidginWindow *gtkconvwin;     /*< Conversation window merged into gtkblist */
+  GtkWidget *conv_window;       /*< The conversation window's own window     */
+  GList *icons;                 /*< The icons of the conversation window     */
+
+  gtkconvwin = pwm_blist_get_convs(gtkblist);
+
+  /* Sanity check: Only move the notebook of a merged window that changes. */
+  if ( gtkconvwin == NULL ||
+       detached == (pwm_fetch(gtkblist, "detached") != NULL) )
+    return;
+
+  pwm_record_event(gtkblist, G_STRFUNC, NULL);
+  pwm_watchdog_enter(G_STRFUNC);
+  conv_window = pwm_fetch(gtkblist, "conv_window");
+
+  if ( detached ) {
+    /* Take the conversation menus and title back from the Buddy List. */
+    pwm_set_conv_menus_visible(gtkblist, FALSE);
+    pwm_store(gtkblist, "detached", GINT_TO_POINTER(TRUE));
+    pwm_update_idle_layout(gtkblist);
+    gtk_window_set_icon_list(GTK_WINDOW(gtkblist->window), NULL);
+    gtk_window_set_title(GTK_WINDOW(gtkblist->window),
+                         pwm_fetch(gtkblist, "title"));
+
+    /* The Buddy List's visibility no longer matters to the conversations. */
+    pwm_display_unwatch(gtkblist);
+    g_signal_handlers_block_by_func(gtkblist->window, focus_in_event_cb,
+                                    conv_window);
+
+    /* Swap the notebook into its realized window, and show the window. */
+    gtkconvwin->window = conv_window;
+    gtk_widget_realize(conv_window);
+    pwm_widget_swap(gtkconvwin->notebook, pwm_fetch(gtkblist, "placeholder"));
+    gtk_widget_hide(pwm_fetch(gtkblist, "placeholder"));
+    gtk_window_add_accel_group(GTK_WINDOW(conv_window),
+                               pwm_fetch(gtkblist, "shortcuts"));
+    g_object_connect(G_OBJECT(conv_window), "signal::event",
+                     G_CALLBACK(detached_event_cb), gtkblist, NULL);
+    pidgin_conv_window_show(gtkconvwin);
+    pidgin_conv_window_switch_gtkconv(gtkconvwin,
+      pidgin_conv_window_get_active_gtkconv(gtkconvwin));
+  } else {
+    /* Hide the conversation window, and put the notebook back in the panes
+       at the Buddy List's saved size. */
+    g_object_disconnect(G_OBJECT(conv_window), "any_signal",
+                        G_CALLBACK(detached_event_cb), gtkblist, NULL);
+    gtk_window_remove_accel_group(GTK_WINDOW(conv_window),
+                                  pwm_fetch(gtkblist, "shortcuts"));
+    pidgin_conv_window_hide(gtkconvwin);
+    pwm_widget_swap(gtkconvwin->notebook, pwm_fetch(gtkblist, "placeholder"));
+    gtkconvwin->window = gtkblist->window;
+    restore_slider(gtkblist);
+
+    g_signal_handlers_unblock_by_func(gtkblist->window, focus_in_event_cb,
+                                      conv_window);
+    pwm_display_watch(gtkblist);
+
+    /* Give the Buddy List the conversation window's title and icons. */
+    pwm_clear(gtkblist, "detached");
+    icons = gtk_window_get_icon_list(GTK_WINDOW(conv_window));
+    gtk_window_set_icon_list(GTK_WINDOW(gtkblist->window), icons);
+    g_list_free(icons);
+    gtk_window_set_title(GTK_WINDOW(gtkblist->window),
+                         gtk_window_get_title(GTK_WINDOW(conv_window)));
+    sync_conversation_state(gtkblist);
+  }
+
+  pwm_watchdog_leave();
 }
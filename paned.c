@@ -0,0 +1,294 @@
+/**
+ * @file paned.c
+ * Handles user interaction with the slider between the merged window panes
+ *
+ * GtkPaned normally resizes both of its children on every motion event while
+ * its slider is being dragged.  That is cheap for the Buddy List, but a large
+ * conversation history is rewrapped and repainted for each pixel of movement.
+ * The functions in this file replace live resizing with an outline of the
+ * slider, so the panes are only resized once when the slider is released.
+ *
+ * @section LICENSE
+ * Copyright (C) 2012 David Michael <fedora.dm0@gmail.com>
+ *
+ * This file is part of Window Merge.
+ *
+ * Window Merge is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * Window Merge is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Window Merge.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "plugin.h"
+
+#include <gtkblist.h>
+#include <gtkconv.h>
+
+#include <prefs.h>
+
+#include "window_merge.h"
+
+
+/**
+ * The state of a slider drag, stored on the GtkPaned for its duration
+**/
+typedef struct {
+  GdkGC *gc;                    /*< Inverting graphics context for outlines  */
+  GdkWindow *frozen;            /*< Toplevel window with updates suspended   */
+  gint offset;                  /*< Pointer position within the handle       */
+  gint position;                /*< Slider position of the drawn outline     */
+} PwmPanedDrag;
+
+
+/**
+ * Draw (or erase, when drawn twice) the outline of the slider at a position
+ *
+ * @param[in] paned      The GtkPaned whose slider is being dragged
+ * @param[in] drag       The state of the current slider drag
+**/
+static void
+draw_outline(GtkWidget *paned, PwmPanedDrag *drag)
+{
+  GtkAllocation allocation;     /*< The allocated area of the paned widget   */
+  gint border;                  /*< The border width of the paned container  */
+  gint handle_size;             /*< The width of the slider handle           */
+
+  gtk_widget_get_allocation(paned, &allocation);
+  gtk_widget_style_get(paned, "handle-size", &handle_size, NULL);
+  border = gtk_container_get_border_width(GTK_CONTAINER(paned));
+
+  if ( GTK_IS_VPANED(paned) )
+    gdk_draw_rectangle(gtk_widget_get_window(paned), drag->gc, TRUE,
+                       allocation.x + border,
+                       allocation.y + border + drag->position,
+                       allocation.width - 2 * border, handle_size);
+  else
+    gdk_draw_rectangle(gtk_widget_get_window(paned), drag->gc, TRUE,
+                       allocation.x + border + drag->position,
+                       allocation.y + border,
+                       handle_size, allocation.height - 2 * border);
+}
+
+
+/**
+ * Release the resources held for a slider drag
+ *
+ * This is also called if the paned widget is destroyed in the middle of a
+ * drag, so the window is never left with its updates frozen.
+ *
+ * @param[in] data       The state of the slider drag being freed
+**/
+static void
+free_drag(gpointer data)
+{
+  PwmPanedDrag *drag;           /*< The state of the finished slider drag    */
+
+  drag = data;
+  gdk_window_thaw_updates(drag->frozen);
+  g_object_unref(G_OBJECT(drag->frozen));
+  g_object_unref(G_OBJECT(drag->gc));
+  g_free(drag);
+}
+
+
+/**
+ * End a slider drag, optionally moving the slider to the outlined position
+ *
+ * @param[in] paned      The GtkPaned whose slider was being dragged
+ * @param[in] apply      Whether to resize the panes to the final position
+ * @param[in] time       The timestamp of the event ending the drag
+**/
+static void
+end_drag(GtkWidget *paned, gboolean apply, guint32 time)
+{
+  PwmPanedDrag *drag;           /*< The state of the current slider drag     */
+  char position[16];            /*< The final slider position as text        */
+
+  drag = g_object_steal_data(G_OBJECT(paned), "pwm_drag");
+
+  /* Sanity check: Only finish drags that were started here. */
+  if ( drag == NULL )
+    return;
+
+  /* Erase the outline, and let the window catch up on its painting. */
+  draw_outline(paned, drag);
+  gdk_display_pointer_ungrab(gtk_widget_get_display(paned), time);
+
+  /* Resize the panes only once, now that the user has decided on a size. */
+  if ( apply ) {
+    gtk_paned_set_position(GTK_PANED(paned), drag->position);
+    g_snprintf(position, sizeof(position), "%d", drag->position);
+    pwm_workload_record("pane", NULL, position);
+  }
+
+  free_drag(drag);
+}
+
+
+/**
+ * A callback for when a mouse button is pressed on the paned widget
+ *
+ * This starts outlining the slider instead of letting GtkPaned resize the
+ * panes live.  The pointer is grabbed on the handle so that motion events keep
+ * arriving when the slider is dragged over the panes.
+ *
+ * @param[in] widget     The GtkPaned receiving the event
+ * @param[in] event      The button press event
+ * @param[in] data       Unused
+ * @return               Whether to stop GtkPaned from handling the event
+**/
+static gboolean
+button_press_event_cb(GtkWidget *widget, GdkEventButton *event,
+                      U gpointer data)
+{
+  PwmPanedDrag *drag;           /*< The state of the new slider drag         */
+  GdkWindow *handle;            /*< The input window of the slider handle    */
+
+  handle = gtk_paned_get_handle_window(GTK_PANED(widget));
+
+  /* Let GtkPaned handle anything other than a single click on its handle. */
+  if ( !purple_prefs_get_bool(PREF_OUTLINE) || event->window != handle ||
+       event->type != GDK_BUTTON_PRESS || event->button != 1 ||
+       g_object_get_data(G_OBJECT(widget), "pwm_drag") != NULL )
+    return FALSE;
+
+  if ( gdk_pointer_grab(handle, FALSE,
+                        GDK_POINTER_MOTION_HINT_MASK |
+                        GDK_BUTTON1_MOTION_MASK |
+                        GDK_BUTTON_RELEASE_MASK,
+                        NULL, NULL, event->time) != GDK_GRAB_SUCCESS )
+    return FALSE;
+
+  drag = g_new0(PwmPanedDrag, 1);
+  drag->offset = GTK_IS_VPANED(widget) ? event->y : event->x;
+  drag->position = gtk_paned_get_position(GTK_PANED(widget));
+
+  /* Prepare to draw an outline that inverts everything it covers. */
+  drag->gc = gdk_gc_new(gtk_widget_get_window(widget));
+  gdk_gc_set_function(drag->gc, GDK_INVERT);
+  gdk_gc_set_subwindow(drag->gc, GDK_INCLUDE_INFERIORS);
+
+  /* Suspend repainting the window so nothing draws over the outline. */
+  drag->frozen = g_object_ref(gtk_widget_get_window(
+                   gtk_widget_get_toplevel(widget)));
+  gdk_window_freeze_updates(drag->frozen);
+
+  g_object_set_data_full(G_OBJECT(widget), "pwm_drag", drag, free_drag);
+  draw_outline(widget, drag);
+
+  return TRUE;
+}
+
+
+/**
+ * A callback for when the pointer moves during a slider drag
+ *
+ * @param[in] widget     The GtkPaned receiving the event
+ * @param[in] event      Unused
+ * @param[in] data       Unused
+ * @return               Whether to stop GtkPaned from handling the event
+**/
+static gboolean
+motion_notify_event_cb(GtkWidget *widget, U GdkEventMotion *event,
+                       U gpointer data)
+{
+  PwmPanedDrag *drag;           /*< The state of the current slider drag     */
+  gint min_position;            /*< The "min-position" property of widget    */
+  gint max_position;            /*< The "max-position" property of widget    */
+  gint position;                /*< The new slider position under the mouse  */
+  gint x, y;                    /*< Pointer coordinates relative to widget   */
+
+  drag = g_object_get_data(G_OBJECT(widget), "pwm_drag");
+
+  /* Sanity check: Only handle motion during drags that were started here. */
+  if ( drag == NULL )
+    return FALSE;
+
+  /* Determine where the slider would go, limited to the paned's bounds. */
+  gtk_widget_get_pointer(widget, &x, &y);
+  position = (GTK_IS_VPANED(widget) ? y : x) - drag->offset -
+             gtk_container_get_border_width(GTK_CONTAINER(widget));
+  g_object_get(G_OBJECT(widget), "min-position", &min_position,
+                                 "max-position", &max_position, NULL);
+  position = CLAMP(position, min_position, max_position);
+
+  /* Move the outline by erasing it and drawing it at its new position. */
+  if ( position != drag->position ) {
+    draw_outline(widget, drag);
+    drag->position = position;
+    draw_outline(widget, drag);
+  }
+
+  return TRUE;
+}
+
+
+/**
+ * A callback for when the mouse button is released to drop the slider
+ *
+ * @param[in] widget     The GtkPaned receiving the event
+ * @param[in] event      The button release event
+ * @param[in] data       Unused
+ * @return               Whether to stop GtkPaned from handling the event
+**/
+static gboolean
+button_release_event_cb(GtkWidget *widget, GdkEventButton *event,
+                        U gpointer data)
+{
+  if ( event->button != 1 ||
+       g_object_get_data(G_OBJECT(widget), "pwm_drag") == NULL )
+    return FALSE;
+
+  end_drag(widget, TRUE, event->time);
+
+  return TRUE;
+}
+
+
+/**
+ * A callback for when another client or widget takes the pointer grab
+ *
+ * @param[in] widget     The GtkPaned that lost its grab
+ * @param[in] event      Unused
+ * @param[in] data       Unused
+ * @return               Whether to stop other handlers of the event
+**/
+static gboolean
+grab_broken_event_cb(GtkWidget *widget, U GdkEventGrabBroken *event,
+                     U gpointer data)
+{
+  end_drag(widget, FALSE, GDK_CURRENT_TIME);
+
+  return FALSE;
+}
+
+
+/**
+ * Replace live resizing with an outline when the user drags a paned slider
+ *
+ * @param[in] paned      The GtkPaned that was created for the merged window
+ *
+ * @note The outline is only used while the PREF_OUTLINE preference is set.
+**/
+void
+pwm_init_paned_drag(GtkWidget *paned)
+{
+  g_object_connect(G_OBJECT(paned),
+                   "signal::button-press-event",
+                   G_CALLBACK(button_press_event_cb), NULL,
+                   "signal::motion-notify-event",
+                   G_CALLBACK(motion_notify_event_cb), NULL,
+                   "signal::button-release-event",
+                   G_CALLBACK(button_release_event_cb), NULL,
+                   "signal::grab-broken-event",
+                   G_CALLBACK(grab_broken_event_cb), NULL,
+                   NULL);
+}
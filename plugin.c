@@ -27,12 +27,22 @@
 #include <gtkconv.h>
 #include <gtkplugin.h>
 
+#include <core.h>
+#include <notify.h>
 #include <pluginpref.h>
 #include <prefs.h>
+#include <request.h>
+#include <util.h>
 #include <version.h>
 
+#include "probes.h"
 #include "window_merge.h"
 
+#ifdef ENABLE_USDT
+/* The semaphores that enable the arguments of each static tracepoint */
+PWM_PROBE_NAMES(PWM_PROBE_DEFINE)
+#endif
+
 
 /**
  * A preference callback to reconstruct the layout panes when settings change
@@ -51,10 +61,151 @@ pref_convs_side_cb(U const char *name, U PurplePrefType type,
   /* XXX: There should be an interface to list available Buddy List windows. */
   gtkblist = pidgin_blist_get_default_gtk_blist();
 
+  /* Sanity check: A Buddy List waiting to be merged will use the new side. */
+  if ( pwm_blist_get_convs(gtkblist) == NULL )
+    return;
+
+  pwm_record_event(gtkblist, "pref-convs-side", NULL);
+  pwm_watchdog_enter(G_STRFUNC);
   pwm_create_paned_layout(gtkblist, pvalue);
+  pwm_watchdog_leave();
+}
+
+
+/**
+ * A preference callback to toggle fixed-height rows in a merged Buddy List
+ *
+ * This is also called when Pidgin's buddy icon preference changes, since the
+ * rows only have a fixed height while icons are hidden.
+ *
+ * @param[in] name       Unused
+ * @param[in] type       Unused
+ * @param[in] pvalue     Unused
+ * @param[in] data       Unused
+**/
+static void
+pref_rows_cb(U const char *name, U PurplePrefType type,
+             U gconstpointer pvalue, U gpointer data)
+{
+  PidginBuddyList *gtkblist;    /*< The Buddy List being changed             */
+
+  /* XXX: There should be an interface to list available Buddy List windows. */
+  gtkblist = pidgin_blist_get_default_gtk_blist();
+
+  /* Only a merged Buddy List uses fixed-height rows. */
+  pwm_update_blist_fixed_rows(gtkblist);
+}
+
+
+/**
+ * A preference callback to hide or show an idle conversation pane
+ *
+ * @param[in] name       Unused
+ * @param[in] type       Unused
+ * @param[in] pvalue     Unused
+ * @param[in] data       Unused
+**/
+static void
+pref_idle_cb(U const char *name, U PurplePrefType type,
+             U gconstpointer pvalue, U gpointer data)
+{
+  /* XXX: There should be an interface to list available Buddy List windows. */
+  pwm_update_idle_layout(pidgin_blist_get_default_gtk_blist());
+}
+
+
+/**
+ * A preference callback to start or stop measuring message display latency
+ *
+ * @param[in] name       Unused
+ * @param[in] type       Unused
+ * @param[in] pvalue     Pointer to the value of the preference
+ * @param[in] data       Unused
+**/
+static void
+pref_latency_cb(U const char *name, U PurplePrefType type,
+                gconstpointer pvalue, U gpointer data)
+{
+  if ( GPOINTER_TO_INT(pvalue) )
+    pwm_latency_start();
+  else
+    pwm_latency_stop();
+}
+
+
+/**
+ * A preference callback to start or stop recording a workload trace
+ *
+ * @param[in] name       Unused
+ * @param[in] type       Unused
+ * @param[in] pvalue     Pointer to the value of the preference
+ * @param[in] data       Unused
+**/
+static void
+pref_workload_cb(U const char *name, U PurplePrefType type,
+                 gconstpointer pvalue, U gpointer data)
+{
+  if ( GPOINTER_TO_INT(pvalue) )
+    pwm_workload_start();
+  else
+    pwm_workload_stop();
+}
+
+
+/**
+ * A preference callback to start or stop indexing merged conversations
+ *
+ * @param[in] name       Unused
+ * @param[in] type       Unused
+ * @param[in] pvalue     Pointer to the value of the preference
+ * @param[in] data       Unused
+**/
+static void
+pref_search_cb(U const char *name, U PurplePrefType type,
+               gconstpointer pvalue, U gpointer data)
+{
+  if ( GPOINTER_TO_INT(pvalue) )
+    pwm_search_start();
+  else
+    pwm_search_stop();
+}
+
+
+/**
+ * A preference callback to restart the watchdog with a new stall threshold
+ *
+ * @param[in] name       Unused
+ * @param[in] type       Unused
+ * @param[in] pvalue     Pointer to the value of the preference
+ * @param[in] data       Unused
+**/
+static void
+pref_watchdog_cb(U const char *name, U PurplePrefType type,
+                 gconstpointer pvalue, U gpointer data)
+{
+  pwm_watchdog_stop();
+  pwm_watchdog_start(GPOINTER_TO_INT(pvalue));
 }
 
 
+/**
+ * A preference callback to change when messages are held back from display
+ *
+ * @param[in] name       Unused
+ * @param[in] type       Unused
+ * @param[in] pvalue     Unused
+ * @param[in] data       Unused
+**/
+static void
+pref_display_cb(U const char *name, U PurplePrefType type,
+                U gconstpointer pvalue, U gpointer data)
+{
+  pwm_display_stop();
+  pwm_display_start(purple_prefs_get_int(PREF_FLOOD),
+                    purple_prefs_get_bool(PREF_QUIET));
+}
+
+
 /**
  * A callback for when a conversation is opened
  *
@@ -76,13 +227,30 @@ conversation_created_cb(PurpleConversation *conv)
   gtkconv = PIDGIN_CONVERSATION(conv);
   gtkconvwin = pidgin_conv_get_window(gtkconv);
   gtkblist = pwm_convs_get_blist(gtkconvwin);
+  pwm_record_event(gtkblist, "conversation-created", conv);
+  PWM_PROBE2(conversation_created__entry, conv, PWM_PROBE_TABS(gtkblist));
 
-  /* Sanity check: This callback should only continue for merged windows. */
-  if ( gtkblist == NULL )
+  /* Sanity check: Only continue for merged windows not moving conv batches. */
+  if ( gtkblist == NULL || pwm_fetch(gtkblist, "batch") != NULL ) {
+    PWM_PROBE2(conversation_created__return, conv, -1);
     return;
+  }
+
+  /* Settle the window once a drag ends, if pressing a tab switched to it. */
+  if ( gtkconvwin->in_drag || gtkconvwin->in_predrag ) {
+    pwm_sync_after_drag(gtkblist);
+    PWM_PROBE2(conversation_created__return, conv, -1);
+    return;
+  }
+
+  /* Load the last log of a new conversation without blocking the window. */
+  if ( purple_prefs_get_bool(PREF_HISTORY) )
+    pwm_preload_history(gtkconv);
 
   /* If there is a tab in addition to the instructions tab, remove it. */
-  if ( pidgin_conv_window_get_gtkconv_count(gtkconvwin) > 1 ) {
+  if ( pwm_count_real_convs(gtkconvwin) > 1 ||
+       pidgin_conv_get_window(pwm_fetch(gtkblist, "fake_tab")) != NULL ) {
+    pwm_watchdog_enter(G_STRFUNC);
     pwm_hide_dummy_conversation(gtkblist);
     pwm_set_conv_menus_visible(gtkblist, TRUE);
 
@@ -90,7 +258,10 @@ conversation_created_cb(PurpleConversation *conv)
     while ( gtk_events_pending() )
       gtk_main_iteration();
     gtk_widget_grab_focus(gtkconv->entry);
+    pwm_watchdog_leave();
   }
+
+  PWM_PROBE2(conversation_created__return, conv, PWM_PROBE_TABS(gtkblist));
 }
 
 
@@ -114,28 +285,36 @@ deleting_conversation_cb(PurpleConversation *conv)
 
   gtkconvwin = pidgin_conv_get_window(PIDGIN_CONVERSATION(conv));
   gtkblist = pwm_convs_get_blist(gtkconvwin);
+  pwm_record_event(gtkblist, "deleting-conversation", conv);
+  PWM_PROBE2(deleting_conversation__entry, conv, PWM_PROBE_TABS(gtkblist));
 
-  /* Sanity check: This callback should only continue for merged windows. */
-  if ( gtkblist == NULL )
+  /* Sanity check: Only continue for merged windows not moving conv batches. */
+  if ( gtkblist == NULL || pwm_fetch(gtkblist, "batch") != NULL ) {
+    PWM_PROBE2(deleting_conversation__return, conv, -1);
     return;
+  }
 
   /* If the last conv is being deleted, reset help, icons, title, and menu. */
-  if ( pidgin_conv_window_get_gtkconv_count(gtkconvwin) <= 1 ) {
+  if ( pwm_count_real_convs(gtkconvwin) <= 1 ) {
+    pwm_watchdog_enter(G_STRFUNC);
     pwm_show_dummy_conversation(gtkblist);
     gtk_window_set_icon_list(GTK_WINDOW(gtkblist->window), NULL);
     gtk_window_set_title(GTK_WINDOW(gtkblist->window),
                          pwm_fetch(gtkblist, "title"));
     pwm_set_conv_menus_visible(gtkblist, FALSE);
+    pwm_watchdog_leave();
   }
+
+  PWM_PROBE2(deleting_conversation__return, conv, PWM_PROBE_TABS(gtkblist));
 }
 
 
 /**
  * A callback for when a conversation tab is being dragged out of its window
  *
- * The only purpose this serves is to treat dragging a conversation out of a
- * Buddy List as if it was being deleted, in terms of when to create a dummy
- * conversation tab.
+ * When a conversation is dragged out of a Buddy List, the dummy tab is shown
+ * right away if it was the last one, so the window isn't destroyed.  The rest
+ * of the menu and title changes wait until the drag session is over.
  *
  * @param[in] src        The window from which a conversation is being dragged
  * @param[in] dst        The window where a conversation is being dropped
@@ -143,8 +322,23 @@ deleting_conversation_cb(PurpleConversation *conv)
 static void
 conversation_dragging_cb(PidginWindow *src, PidginWindow *dst)
 {
-  if ( src != dst && pwm_convs_get_blist(src) != NULL )
-    deleting_conversation_cb(pidgin_conv_window_get_active_conversation(src));
+  PidginBuddyList *gtkblist;    /*< The Buddy List losing a conversation     */
+  PidginConversation *gtkconv;  /*< The conversation being dragged           */
+
+  gtkblist = pwm_convs_get_blist(src);
+  gtkconv = pidgin_conv_window_get_gtkconv_at_index(src, src->drag_tab);
+  pwm_record_event(gtkblist, "conversation-dragging",
+                   gtkconv != NULL ? gtkconv->active_conv : NULL);
+  PWM_PROBE2(conversation_dragging__entry, src, dst);
+  pwm_watchdog_enter(G_STRFUNC);
+  if ( src != dst && gtkblist != NULL ) {
+    /* Only the dummy tab is needed now, to keep the window from closing. */
+    if ( pwm_count_real_convs(src) <= 1 )
+      pwm_show_dummy_conversation(gtkblist);
+    pwm_sync_after_drag(gtkblist);
+  }
+  pwm_watchdog_leave();
+  PWM_PROBE2(conversation_dragging__return, src, dst);
 }
 
 
@@ -160,8 +354,14 @@ conversation_dragging_cb(PidginWindow *src, PidginWindow *dst)
 static void
 conversation_hiding_cb(PidginConversation *gtkconv)
 {
+  pwm_record_event(NULL, "conversation-hiding",
+                   gtkconv != NULL ? gtkconv->active_conv : NULL);
+  PWM_PROBE1(conversation_hiding__entry, gtkconv);
+  pwm_watchdog_enter(G_STRFUNC);
   if ( gtkconv != NULL )
     deleting_conversation_cb(gtkconv->active_conv);
+  pwm_watchdog_leave();
+  PWM_PROBE1(conversation_hiding__return, gtkconv);
 }
 
 
@@ -183,19 +383,51 @@ conversation_hiding_cb(PidginConversation *gtkconv)
 static void
 conversation_switched_cb(PurpleConversation *conv)
 {
+  pwm_record_event(NULL, "conversation-switched", conv);
+  PWM_PROBE1(conversation_switched__entry, conv);
+  pwm_watchdog_enter(G_STRFUNC);
   conversation_created_cb(conv);
+  pwm_watchdog_leave();
+  PWM_PROBE1(conversation_switched__return, conv);
 }
 
 
 /**
  * A callback for when a Buddy List is created to merge a conv window with it
  *
+ * Unless the user disabled it, the merge is deferred until the Buddy List has
+ * been drawn, so the plugin doesn't delay the window's first appearance.
+ *
  * @param[in] blist      The Buddy List that was created
 **/
 static void
 gtkblist_created_cb(U PurpleBuddyList *blist)
 {
-  pwm_merge_conversation(PIDGIN_BLIST(blist));
+  pwm_record_event(PIDGIN_BLIST(blist), "gtkblist-created", NULL);
+  PWM_PROBE1(gtkblist_created__entry, PIDGIN_BLIST(blist));
+  pwm_watchdog_enter(G_STRFUNC);
+  pwm_startup_watch(PIDGIN_BLIST(blist));
+  if ( purple_prefs_get_bool(PREF_DEFER) )
+    pwm_defer_merge_conversation(PIDGIN_BLIST(blist));
+  else
+    pwm_merge_conversation(PIDGIN_BLIST(blist));
+  pwm_watchdog_leave();
+  PWM_PROBE2(gtkblist_created__return, PIDGIN_BLIST(blist),
+             PWM_PROBE_TABS(PIDGIN_BLIST(blist)));
+}
+
+
+/**
+ * A callback for when Pidgin is quitting, to save the merged window's tabs
+ *
+ * @param[in] data       Unused
+**/
+static void
+quitting_cb(U gpointer data)
+{
+  /* XXX: There should be an interface to list available Buddy List windows. */
+  if ( purple_prefs_get_bool(PREF_SESSION) )
+    pwm_session_save(pidgin_blist_get_default_gtk_blist());
 }
 
 
@@ -211,14 +443,25 @@ conv_placement_by_blist(PidginConversation *gtkconv)
   PidginWindow *gtkconvwin;     /*< The Buddy List's associated conv window  */
 
   gtkblist = pidgin_blist_get_default_gtk_blist();
+
+  /* Finish a deferred merge now, so conversations are placed in order. */
+  if ( gtkblist != NULL && pwm_fetch(gtkblist, "deferred") != NULL )
+    pwm_merge_conversation(gtkblist);
   gtkconvwin = pwm_blist_get_convs(gtkblist);
 
+  pwm_record_event(gtkblist, "conversation-placement", gtkconv->active_conv);
+  PWM_PROBE2(conversation_placement__entry, gtkconv,
+             PWM_PROBE_TABS(gtkblist));
+  pwm_watchdog_enter(G_STRFUNC);
   if ( gtkconvwin != NULL )
     pidgin_conv_window_add_gtkconv(gtkconvwin, gtkconv);
 
   /* XXX: A fallback placement avoids segfaults after the plugin's disabled. */
   else
     pidgin_conv_placement_get_fnc("last")(gtkconv);
+  pwm_watchdog_leave();
+  PWM_PROBE2(conversation_placement__return, gtkconv,
+             PWM_PROBE_TABS(gtkblist));
 }
 
 
@@ -235,6 +478,11 @@ plugin_load(PurplePlugin *plugin)
   void *conv_handle;            /*< The conversations handle                 */
   void *gtkblist_handle;        /*< The Pidgin Buddy List handle             */
   void *gtkconv_handle;         /*< The Pidgin conversations handle          */
+  gint64 start;                 /*< Monotonic time a startup phase started   */
+
+  /* Time the plugin's startup phases when Pidgin is starting, if asked. */
+  if ( purple_prefs_get_bool(PREF_STARTUP) )
+    pwm_startup_begin();
 
   /* XXX: There should be an interface to list available Buddy List windows. */
   gtkblist = pidgin_blist_get_default_gtk_blist();
@@ -242,13 +490,54 @@ plugin_load(PurplePlugin *plugin)
   gtkblist_handle = pidgin_blist_get_handle();
   gtkconv_handle = pidgin_conversations_get_handle();
 
+  /* Read the layout state before anything is laid out. */
+  pwm_state_load();
+
+  /* Keep a history of plugin events in case something crashes. */
+  pwm_recorder_start();
+
+  /* Watch for main loop stalls if the user asked for reports. */
+  pwm_watchdog_start(purple_prefs_get_int(PREF_WATCHDOG));
+  purple_prefs_connect_callback(plugin, PREF_WATCHDOG, pref_watchdog_cb, NULL);
+
+  /* Measure how long messages take to be displayed if the user asked. */
+  if ( purple_prefs_get_bool(PREF_LATENCY) )
+    pwm_latency_start();
+  purple_prefs_connect_callback(plugin, PREF_LATENCY, pref_latency_cb, NULL);
+
+  /* Record the session's events for replaying if the user asked. */
+  if ( purple_prefs_get_bool(PREF_WORKLOAD) )
+    pwm_workload_start();
+  purple_prefs_connect_callback(plugin, PREF_WORKLOAD, pref_workload_cb, NULL);
+
+  /* Index the merged conversations for searching them if the user asked. */
+  if ( purple_prefs_get_bool(PREF_SEARCH) )
+    pwm_search_start();
+  purple_prefs_connect_callback(plugin, PREF_SEARCH, pref_search_cb, NULL);
+
+  /* Track conversation names and unread tabs for jumping between them. */
+  pwm_switcher_start();
+
+  /* Hold back messages in the merged window while they can't be seen. */
+  pwm_display_start(purple_prefs_get_int(PREF_FLOOD),
+                    purple_prefs_get_bool(PREF_QUIET));
+  purple_prefs_connect_callback(plugin, PREF_FLOOD, pref_display_cb, NULL);
+  purple_prefs_connect_callback(plugin, PREF_QUIET, pref_display_cb, NULL);
+
   /* Add the conversation placement option provided by this plugin. */
+  start = g_get_monotonic_time();
   pidgin_conv_placement_add_fnc(PLUGIN_TOKEN, _(PWM_STR_CP_BLIST),
                                 &conv_placement_by_blist);
   purple_prefs_trigger_callback(PIDGIN_PREFS_ROOT "/conversations/placement");
+  pwm_startup_record("placement", start);
 
   /* Rebuild the layout when the preference changes. */
   purple_prefs_connect_callback(plugin, PREF_SIDE, pref_convs_side_cb, NULL);
+  purple_prefs_connect_callback(plugin, PREF_ROWS, pref_rows_cb, NULL);
+  purple_prefs_connect_callback(plugin,
+                                PIDGIN_PREFS_ROOT "/blist/show_buddy_icons",
+                                pref_rows_cb, NULL);
+  purple_prefs_connect_callback(plugin, PREF_IDLE, pref_idle_cb, NULL);
 
   /* Toggle the instruction panel as conversations come and go. */
   purple_signal_connect(conv_handle, "conversation-created", plugin,
@@ -262,14 +551,23 @@ plugin_load(PurplePlugin *plugin)
   purple_signal_connect(gtkconv_handle, "conversation-switched", plugin,
                         PURPLE_CALLBACK(conversation_switched_cb), NULL);
 
+  /* Remember the merged tabs for the next session before they are closed. */
+  purple_signal_connect(purple_get_core(), "quitting", plugin,
+                        PURPLE_CALLBACK(quitting_cb), NULL);
+
   /* Hijack Buddy Lists as they are created. */
   purple_signal_connect(gtkblist_handle, "gtkblist-created", plugin,
                         PURPLE_CALLBACK(gtkblist_created_cb), NULL);
 
   /* If a default Buddy List is already available, use it immediately. */
-  if ( gtkblist != NULL && gtkblist->window != NULL )
+  pwm_watchdog_enter(G_STRFUNC);
+  if ( gtkblist != NULL && gtkblist->window != NULL ) {
+    pwm_startup_watch(gtkblist);
     pwm_merge_conversation(gtkblist);
+  }
+  pwm_watchdog_leave();
 
+  pwm_startup_record("load", 0);
   return TRUE;
 }
 
@@ -290,6 +588,37 @@ plugin_unload(U PurplePlugin *plugin)
   /* XXX: There should be an interface to list available Buddy List windows. */
   pwm_split_conversation(pidgin_blist_get_default_gtk_blist());
 
+  /* Stop reading logs before the plugin's code is unloaded. */
+  pwm_history_stop();
+
+  /* Stop indexing histories before the plugin's code is unloaded. */
+  pwm_search_stop();
+
+  /* Close the quick switcher before the plugin's code is unloaded. */
+  pwm_switcher_stop();
+
+  /* Save the final layout state before the plugin's code is unloaded. */
+  pwm_state_unload();
+
+  /* Drop unfinished startup timing before the plugin's code is unloaded. */
+  pwm_startup_end();
+
+  /* Report the last latency samples before the plugin's code is unloaded. */
+  pwm_latency_stop();
+
+  /* Write batched messages before the plugin's code is unloaded. */
+  pwm_display_stop();
+
+  /* Close the workload trace before the plugin's code is unloaded. */
+  pwm_workload_cancel();
+  pwm_workload_stop();
+
+  /* Stop the watchdog thread before the plugin's code is unloaded. */
+  pwm_watchdog_stop();
+
+  /* Restore the crash handlers before the plugin's code is unloaded. */
+  pwm_recorder_stop();
+
   return TRUE;
 }
 
@@ -328,9 +657,356 @@ get_plugin_pref_frame(U PurplePlugin *plugin)
 
   purple_plugin_pref_frame_add(frame, ppref);
 
+  /* TRANSLATORS: This is the name of the plugin preference for drawing only
+     an outline of the pane slider until the user finishes dragging it. */
+  ppref = purple_plugin_pref_new_with_name_and_label(PREF_OUTLINE, _(""
+            "Resize panes when the slider is released"));
+  purple_plugin_pref_frame_add(frame, ppref);
+
+  /* TRANSLATORS: This is the name of the plugin preference for giving every
+     Buddy List row the same height, so large lists resize faster.  It has no
+     effect while buddy icons are shown or a contact is expanded. */
+  ppref = purple_plugin_pref_new_with_name_and_label(PREF_ROWS, _(""
+            "Use fixed-height Buddy List rows while attached, unless buddy "
+            "icons are shown or contacts are expanded"));
+  purple_plugin_pref_frame_add(frame, ppref);
+
+  /* TRANSLATORS: This is the name of the plugin preference for giving the
+     whole Buddy List window to the Buddy List when no conversations are
+     attached, instead of showing the instructions tab. */
+  ppref = purple_plugin_pref_new_with_name_and_label(PREF_IDLE, _(""
+            "Hide the conversation pane while it is empty"));
+  purple_plugin_pref_frame_add(frame, ppref);
+
+  /* TRANSLATORS: This is the name of the plugin preference for how many tabs
+     the user is likely to select next are prepared in the background. */
+  ppref = purple_plugin_pref_new_with_name_and_label(PREF_WARM, _(""
+            "Tabs to prepare in advance for switching"));
+  purple_plugin_pref_set_bounds(ppref, 0, 50);
+  purple_plugin_pref_frame_add(frame, ppref);
+
+  /* TRANSLATORS: This is the name of the plugin preference for displaying the
+     end of the last log in new conversations without freezing the window. */
+  ppref = purple_plugin_pref_new_with_name_and_label(PREF_HISTORY, _(""
+            "Load the last log into new attached conversations"));
+  purple_plugin_pref_frame_add(frame, ppref);
+
+  /* TRANSLATORS: This is the name of the plugin preference for how many
+     messages per second a conversation can receive before its messages are
+     displayed in batches to keep the window responsive. */
+  ppref = purple_plugin_pref_new_with_name_and_label(PREF_FLOOD, _(""
+            "Batch messages arriving faster than (per second, 0 to disable)"));
+  purple_plugin_pref_set_bounds(ppref, 0, 1000);
+  purple_plugin_pref_frame_add(frame, ppref);
+
+  /* TRANSLATORS: This is the name of the plugin preference for keeping a copy
+     of the text of each attached conversation, so they can all be searched
+     at once from the Buddy List window. */
+  ppref = purple_plugin_pref_new_with_name_and_label(PREF_SEARCH, _(""
+            "Index attached conversations for searching them together"));
+  purple_plugin_pref_frame_add(frame, ppref);
+
+  /* TRANSLATORS: This is the name of the plugin preference for waiting to
+     display new messages until the Buddy List window can be seen again.  The
+     signals other plugins receive when a message is displayed are delayed
+     along with it, which the second sentence warns about. */
+  ppref = purple_plugin_pref_new_with_name_and_label(PREF_QUIET, _(""
+            "Hold new messages while the Buddy List window is minimized "
+            "or hidden.  Plugins that act on displayed messages are "
+            "delayed too"));
+  purple_plugin_pref_frame_add(frame, ppref);
+
+  /* TRANSLATORS: This is the name of the plugin preference for reopening the
+     attached conversations from the last session, as tabs that load when they
+     are selected. */
+  ppref = purple_plugin_pref_new_with_name_and_label(PREF_SESSION, _(""
+            "Restore attached conversations from the last session"));
+  purple_plugin_pref_frame_add(frame, ppref);
+
+  /* TRANSLATORS: This is the name of the plugin preference for waiting until
+     the Buddy List window is drawn before attaching conversations to it. */
+  ppref = purple_plugin_pref_new_with_name_and_label(PREF_DEFER, _(""
+            "Attach conversations after the Buddy List is drawn"));
+  purple_plugin_pref_frame_add(frame, ppref);
+
+  /* TRANSLATORS: This is the name of the plugin preference for logging any
+     time the program stops responding for at least the given milliseconds. */
+  ppref = purple_plugin_pref_new_with_name_and_label(PREF_WATCHDOG, _(""
+            "Report delays longer than (ms, 0 to disable)"));
+  purple_plugin_pref_set_bounds(ppref, 0, 60000);
+  purple_plugin_pref_frame_add(frame, ppref);
+
+  /* TRANSLATORS: This is the name of the plugin preference for recording how
+     long received messages take to be displayed, to compare window types. */
+  ppref = purple_plugin_pref_new_with_name_and_label(PREF_LATENCY, _(""
+            "Record message display times in the statistics file"));
+  purple_plugin_pref_frame_add(frame, ppref);
+
+  /* TRANSLATORS: This is the name of the plugin preference for recording how
+     long each phase of the plugin's startup takes, to compare Buddy Lists. */
+  ppref = purple_plugin_pref_new_with_name_and_label(PREF_STARTUP, _(""
+            "Record startup times in the statistics file"));
+  purple_plugin_pref_frame_add(frame, ppref);
+
+  /* TRANSLATORS: This is the name of the plugin preference for writing the
+     session's events to a file, so a slow session can be replayed later. */
+  ppref = purple_plugin_pref_new_with_name_and_label(PREF_WORKLOAD, _(""
+            "Record a workload trace for replaying"));
+  purple_plugin_pref_frame_add(frame, ppref);
+
   return frame;
 }
 
+/**
+ * A plugin action to move all conversations into the Buddy List window
+ *
+ * @param[in] action     Unused
+**/
+static void
+attach_all_action_cb(U PurplePluginAction *action)
+{
+  /* XXX: There should be an interface to list available Buddy List windows. */
+  pwm_attach_all_conversations(pidgin_blist_get_default_gtk_blist());
+}
+
+
+/**
+ * A plugin action to move all conversations out of the Buddy List window
+ *
+ * @param[in] action     Unused
+**/
+static void
+detach_all_action_cb(U PurplePluginAction *action)
+{
+  /* XXX: There should be an interface to list available Buddy List windows. */
+  pwm_detach_all_conversations(pidgin_blist_get_default_gtk_blist());
+}
+
+
+/**
+ * A plugin action to collapse the Buddy List pane of the merged window or
+ * expand it again
+ *
+ * @param[in] action     Unused
+**/
+static void
+collapse_action_cb(U PurplePluginAction *action)
+{
+  PidginBuddyList *gtkblist;    /*< The default Buddy List                   */
+
+  /* XXX: There should be an interface to list available Buddy List windows. */
+  gtkblist = pidgin_blist_get_default_gtk_blist();
+  if ( pwm_blist_get_convs(gtkblist) != NULL )
+    pwm_set_blist_collapsed(gtkblist,
+                            pwm_fetch(gtkblist, "blist_strip") == NULL);
+}
+
+
+/**
+ * A plugin action to move merged conversations to their own window and back
+ *
+ * @param[in] action     Unused
+**/
+static void
+toggle_action_cb(U PurplePluginAction *action)
+{
+  PidginBuddyList *gtkblist;    /*< The default Buddy List                   */
+
+  /* XXX: There should be an interface to list available Buddy List windows. */
+  gtkblist = pidgin_blist_get_default_gtk_blist();
+  pwm_set_notebook_detached(gtkblist, pwm_blist_get_convs(gtkblist) != NULL &&
+                                      pwm_fetch(gtkblist, "detached") == NULL);
+}
+
+
+/**
+ * A plugin action to choose a merged conversation to switch to by name
+ *
+ * @param[in] action     Unused
+**/
+static void
+switcher_action_cb(U PurplePluginAction *action)
+{
+  PidginBuddyList *gtkblist;    /*< The default Buddy List                   */
+
+  /* XXX: There should be an interface to list available Buddy List windows. */
+  gtkblist = pidgin_blist_get_default_gtk_blist();
+  if ( gtkblist != NULL && gtkblist->window != NULL )
+    pwm_switcher_show(gtkblist);
+}
+
+
+/**
+ * A plugin action to search the text of the merged conversations
+ *
+ * @param[in] action     Unused
+**/
+static void
+search_action_cb(U PurplePluginAction *action)
+{
+  PidginBuddyList *gtkblist;    /*< The default Buddy List                   */
+
+  /* XXX: There should be an interface to list available Buddy List windows. */
+  gtkblist = pidgin_blist_get_default_gtk_blist();
+  if ( gtkblist != NULL && gtkblist->window != NULL )
+    pwm_search_show(gtkblist);
+}
+
+
+/**
+ * A plugin action to save the history of recent plugin events
+ *
+ * @param[in] action     The action that was activated
+**/
+static void
+save_events_action_cb(PurplePluginAction *action)
+{
+  gchar *path;                  /*< The path of the saved event history      */
+
+  path = pwm_recorder_dump();
+
+  if ( path != NULL )
+    /* TRANSLATORS: This is displayed when recent events were written to the
+       file named below the message, to be attached to bug reports. */
+    purple_notify_info(action->plugin, _(PWM_STR_NAME),
+                       _("The history of recent events was saved."), path);
+  else
+    /* TRANSLATORS: This is displayed when recent events could not be written
+       to a file in the user's configuration directory. */
+    purple_notify_error(action->plugin, _(PWM_STR_NAME),
+                        _("The history of recent events could not be saved."),
+                        NULL);
+
+  g_free(path);
+}
+
+
+/**
+ * A plugin action to save a census of the widgets in the merged window
+ *
+ * @param[in] action     The action that was activated
+**/
+static void
+save_census_action_cb(PurplePluginAction *action)
+{
+  gchar *path;                  /*< The path of the saved census             */
+
+  /* XXX: There should be an interface to list available Buddy List windows. */
+  path = pwm_census_dump(pidgin_blist_get_default_gtk_blist());
+
+  if ( path != NULL )
+    /* TRANSLATORS: This is displayed when the widgets of the merged window
+       were counted and written to the file named below the message. */
+    purple_notify_info(action->plugin, _(PWM_STR_NAME),
+                       _("A census of the window's widgets was saved."),
+                       path);
+  else
+    /* TRANSLATORS: This is displayed when the widgets of the merged window
+       could not be counted or written to a file. */
+    purple_notify_error(action->plugin, _(PWM_STR_NAME),
+                        _("A census of the window's widgets could not be "
+                          "saved."), NULL);
+
+  g_free(path);
+}
+
+
+/**
+ * A callback for when a workload trace file was chosen for replaying
+ *
+ * @param[in] data       The plugin that requested the file
+ * @param[in] filename   The path of the chosen trace file
+**/
+static void
+replay_file_cb(gpointer data, const char *filename)
+{
+  if ( !pwm_workload_replay(filename) )
+    /* TRANSLATORS: This is displayed when a recorded workload trace could not
+       be replayed, which needs a trace file, no trace being recorded, and a
+       connected account. */
+    purple_notify_error(data, _(PWM_STR_NAME),
+                        _("The workload trace could not be replayed."),
+                        _("Choose a recorded trace, stop recording traces, "
+                          "and connect an account to replay it with."));
+}
+
+
+/**
+ * A plugin action to choose a recorded workload trace and replay it
+ *
+ * @param[in] action     The action that was activated
+**/
+static void
+replay_workload_action_cb(PurplePluginAction *action)
+{
+  purple_request_file(action->plugin, _("Replay Workload Trace"),
+                      purple_user_dir(), FALSE,
+                      G_CALLBACK(replay_file_cb), NULL,
+                      NULL, NULL, NULL, action->plugin);
+}
+
+
+/**
+ * Return the list of actions the plugin adds to the Tools menu
+ *
+ * @param[in] plugin     Unused
+ * @param[in] context    Unused
+ * @return               A newly allocated list of plugin actions
+**/
+static GList *
+plugin_actions(U PurplePlugin *plugin, U gpointer context)
+{
+  GList *actions = NULL;        /*< The list of actions being created        */
+
+  /* TRANSLATORS: This is the name of a menu item that moves conversations
+     from every other window into the Buddy List window at once. */
+  actions = g_list_append(actions, purple_plugin_action_new(
+              _("Attach All Conversations"), attach_all_action_cb));
+
+  /* TRANSLATORS: This is the name of a menu item that moves conversations
+     out of the Buddy List window into a single separate window at once. */
+  actions = g_list_append(actions, purple_plugin_action_new(
+              _("Detach All Conversations"), detach_all_action_cb));
+
+  /* TRANSLATORS: This is the name of a menu item that temporarily moves the
+     Buddy List's conversation tabs to their own window, or back again. */
+  actions = g_list_append(actions, purple_plugin_action_new(
+              _("Toggle Separate Conversation Window"), toggle_action_cb));
+
+  /* TRANSLATORS: This is the name of a menu item that shrinks the Buddy List
+     to a thin strip beside the conversations, or restores it. */
+  actions = g_list_append(actions, purple_plugin_action_new(
+              _("Toggle Buddy List Pane"), collapse_action_cb));
+
+  /* TRANSLATORS: This is the name of a menu item that opens a window for
+     searching the text of every conversation in the Buddy List window. */
+  actions = g_list_append(actions, purple_plugin_action_new(
+              _("Search Conversations..."), search_action_cb));
+
+  /* TRANSLATORS: This is the name of a menu item that opens a window for
+     switching to a conversation by typing part of its name. */
+  actions = g_list_append(actions, purple_plugin_action_new(
+              _("Switch to Conversation..."), switcher_action_cb));
+
+  /* TRANSLATORS: This is the name of a menu item that writes the history of
+     recent plugin events to a file, to be attached to bug reports. */
+  actions = g_list_append(actions, purple_plugin_action_new(
+              _("Save Event History"), save_events_action_cb));
+
+  /* TRANSLATORS: This is the name of a menu item that counts the widgets and
+     windows making up the Buddy List window, and writes them to a file. */
+  actions = g_list_append(actions, purple_plugin_action_new(
+              _("Save Widget Census"), save_census_action_cb));
+
+  /* TRANSLATORS: This is the name of a menu item that replays the recorded
+     events of a session, to measure the plugin on the same workload. */
+  actions = g_list_append(actions, purple_plugin_action_new(
+              _("Replay Workload Trace"), replay_workload_action_cb));
+
+  return actions;
+}
+
+
 /**
  * The plugin API's UI structure for registering the preferences window
 **/
@@ -366,14 +1042,51 @@ plugin_init(PurplePlugin *plugin)
   /* Initialize the root of the plugin's preferences path. */
   purple_prefs_add_none(PREF_ROOT);
 
-  /* Set the default size of the Buddy List in vertical panes. */
-  purple_prefs_add_int(PREF_HEIGHT, 300);
-
-  /* Set the default size of the Buddy List in horizontal panes. */
-  purple_prefs_add_int(PREF_WIDTH, 300);
-
   /* Set the default side of the Buddy List window to attach conversations. */
   purple_prefs_add_string(PREF_SIDE, "right");
+
+  /* Only redraw the conversation pane when its slider is released. */
+  purple_prefs_add_bool(PREF_OUTLINE, TRUE);
+
+  /* Keep the Buddy List rows measured normally unless the user opts in. */
+  purple_prefs_add_bool(PREF_ROWS, FALSE);
+
+  /* Keep showing new users the instructions tab unless they opt out. */
+  purple_prefs_add_bool(PREF_IDLE, FALSE);
+
+  /* Leave loading logs to the History plugin unless the user opts in. */
+  purple_prefs_add_bool(PREF_HISTORY, FALSE);
+
+  /* Keep a few likely next tabs laid out for switching quickly. */
+  purple_prefs_add_int(PREF_WARM, 4);
+
+  /* Batch messages in busy chats that would otherwise freeze the window. */
+  purple_prefs_add_int(PREF_FLOOD, 20);
+
+  /* Draw every message right away, since holding them delays the displaying
+     and displayed message signals that other plugins rely on. */
+  purple_prefs_add_bool(PREF_QUIET, FALSE);
+
+  /* Don't keep a copy of every conversation's text unless the user opts in. */
+  purple_prefs_add_bool(PREF_SEARCH, FALSE);
+
+  /* Start each session without old tabs unless the user opts in. */
+  purple_prefs_add_bool(PREF_SESSION, FALSE);
+
+  /* Let the Buddy List appear before merging it at startup. */
+  purple_prefs_add_bool(PREF_DEFER, TRUE);
+
+  /* Don't watch for main loop stalls unless the user is debugging them. */
+  purple_prefs_add_int(PREF_WATCHDOG, 0);
+
+  /* Don't measure message display latency unless the user is comparing it. */
+  purple_prefs_add_bool(PREF_LATENCY, FALSE);
+
+  /* Don't measure startup unless the user is comparing it. */
+  purple_prefs_add_bool(PREF_STARTUP, FALSE);
+
+  /* Don't record workload traces unless the user is reproducing a problem. */
+  purple_prefs_add_bool(PREF_WORKLOAD, FALSE);
 }
 
 /**
@@ -416,7 +1129,7 @@ static PurplePluginInfo info = {
   NULL,
   NULL,
   &prefs_info,
-  NULL,
+  plugin_actions,
 
   NULL,
   NULL,
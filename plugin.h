@@ -44,10 +44,24 @@
 #define PLUGIN_URL     PACKAGE_URL
 #define PLUGIN_VERSION PACKAGE_VERSION
 
-#define PREF_ROOT   "/plugins/" PLUGIN_TYPE "/" PLUGIN_TOKEN
-#define PREF_HEIGHT PREF_ROOT "/blist_height"
-#define PREF_WIDTH  PREF_ROOT "/blist_width"
-#define PREF_SIDE   PREF_ROOT "/convs_side"
+#define PREF_ROOT     "/plugins/" PLUGIN_TYPE "/" PLUGIN_TOKEN
+#define PREF_DEFER    PREF_ROOT "/defer_merge"
+#define PREF_FLOOD    PREF_ROOT "/flood_rate"
+#define PREF_HEIGHT   PREF_ROOT "/blist_height" /* Migrated to state.c */
+#define PREF_HISTORY  PREF_ROOT "/preload_history"
+#define PREF_IDLE     PREF_ROOT "/hide_idle_pane"
+#define PREF_LATENCY  PREF_ROOT "/measure_latency"
+#define PREF_OUTLINE  PREF_ROOT "/drag_outline"
+#define PREF_QUIET    PREF_ROOT "/quiet_hidden"
+#define PREF_WIDTH    PREF_ROOT "/blist_width"  /* Migrated to state.c */
+#define PREF_WARM     PREF_ROOT "/warm_tabs"
+#define PREF_WATCHDOG PREF_ROOT "/watchdog_ms"
+#define PREF_WORKLOAD PREF_ROOT "/record_workload"
+#define PREF_ROWS     PREF_ROOT "/fixed_rows"
+#define PREF_SESSION  PREF_ROOT "/restore_session"
+#define PREF_SEARCH   PREF_ROOT "/search_convs"
+#define PREF_SIDE     PREF_ROOT "/convs_side"
+#define PREF_STARTUP  PREF_ROOT "/measure_startup"
 
 /* Tell the libpurple headers to build this correctly. */
 #define PURPLE_PLUGINS
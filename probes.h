@@ -0,0 +1,98 @@
+/**
+ * @file probes.h
+ * Defines static tracepoints for measuring the plugin on running systems
+ *
+ * When configured with --enable-usdt, these macros expand to USDT probes from
+ * sys/sdt.h under the provider "window_merge".  They can then be traced with
+ * tools such as perf, bpftrace, or SystemTap, e.g.:
+ *
+ *   bpftrace -e 'usdt:window_merge.so:window_merge:merge__entry { ... }'
+ *
+ * Every probe has a semaphore that the tracing tool increments while it is
+ * attached, and a probe's arguments are only evaluated while its semaphore is
+ * set.  Tab counts walk the list of conversations in the merged window, so an
+ * untraced probe costs a single test, and builds without --enable-usdt compile
+ * the probes away entirely.
+ *
+ * @section LICENSE
+ * Copyright (C) 2012 David Michael <fedora.dm0@gmail.com>
+ *
+ * This file is part of Window Merge.
+ *
+ * Window Merge is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * Window Merge is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Window Merge.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+#ifdef ENABLE_USDT
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+/* Apply a macro to the name of every probe in the plugin. */
+#define PWM_PROBE_NAMES(X) \
+  X(attach__entry) X(attach__return) \
+  X(conversation_created__entry) X(conversation_created__return) \
+  X(conversation_dragging__entry) X(conversation_dragging__return) \
+  X(conversation_hiding__entry) X(conversation_hiding__return) \
+  X(conversation_placement__entry) X(conversation_placement__return) \
+  X(conversation_switched__entry) X(conversation_switched__return) \
+  X(deleting_conversation__entry) X(deleting_conversation__return) \
+  X(detach__entry) X(detach__return) \
+  X(dummy_hide__entry) X(dummy_hide__return) \
+  X(dummy_show__entry) X(dummy_show__return) \
+  X(gtkblist_created__entry) X(gtkblist_created__return) \
+  X(layout__entry) X(layout__return) \
+  X(menus__entry) X(menus__return) \
+  X(merge__entry) X(merge__return) \
+  X(replace__entry) X(replace__return) \
+  X(split__entry) X(split__return)
+
+/* Name the semaphore of a probe, as expected by sys/sdt.h. */
+#define PWM_PROBE_SEMAPHORE(name) window_merge_##name##_semaphore
+
+/* Declare or define the semaphore of a probe (defined once in plugin.c). */
+#define PWM_PROBE_DECLARE(name) \
+  extern unsigned short PWM_PROBE_SEMAPHORE(name);
+#define PWM_PROBE_DEFINE(name) \
+  unsigned short PWM_PROBE_SEMAPHORE(name) \
+    __attribute__((section(".probes"))) = 0;
+PWM_PROBE_NAMES(PWM_PROBE_DECLARE)
+
+/* Test whether a tracer is attached to a probe. */
+#define PWM_PROBE_ENABLED(name) \
+  G_UNLIKELY(PWM_PROBE_SEMAPHORE(name) != 0)
+
+#define PWM_PROBE1(name, a) \
+  G_STMT_START { if ( PWM_PROBE_ENABLED(name) ) \
+    DTRACE_PROBE1(window_merge, name, a); } G_STMT_END
+#define PWM_PROBE2(name, a, b) \
+  G_STMT_START { if ( PWM_PROBE_ENABLED(name) ) \
+    DTRACE_PROBE2(window_merge, name, a, b); } G_STMT_END
+#define PWM_PROBE3(name, a, b, c) \
+  G_STMT_START { if ( PWM_PROBE_ENABLED(name) ) \
+    DTRACE_PROBE3(window_merge, name, a, b, c); } G_STMT_END
+
+#else
+#define PWM_PROBE1(name, a)       /* disabled */
+#define PWM_PROBE2(name, a, b)    /* disabled */
+#define PWM_PROBE3(name, a, b, c) /* disabled */
+#endif
+
+/* Count the tabs in a merged Buddy List for a traced probe, or -1. */
+#define PWM_PROBE_TABS(gtkblist) \
+  (pwm_blist_get_convs(gtkblist) == NULL ? -1 : \
+   (int)pidgin_conv_window_get_gtkconv_count(pwm_blist_get_convs(gtkblist)))
+
+#endif /* ifndef __PROBES_H__ */
@@ -0,0 +1,308 @@
+/**
+ * @file recorder.c
+ * Keeps a short history of plugin events to explain how a crash happened
+ *
+ * Every plugin event is recorded in a fixed ring buffer that never allocates
+ * memory, so it is cheap enough to leave running all the time.  The history
+ * is written to a file when Pidgin crashes or when the user requests it.
+ *
+ * Writing the file from a signal handler means only async-signal-safe calls
+ * can be made, so the records are formatted by hand and written with write().
+ * Event names must be static strings, since they are stored as pointers.
+ *
+ * @section LICENSE
+ * Copyright (C) 2012 David Michael <fedora.dm0@gmail.com>
+ *
+ * This file is part of Window Merge.
+ *
+ * Window Merge is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * Window Merge is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Window Merge.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "plugin.h"
+
+#include <gtkblist.h>
+#include <gtkconv.h>
+
+#include <glib/gstdio.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "window_merge.h"
+
+/** The number of most recent events kept in the history */
+#define RECORDER_SIZE 512
+
+/** The longest path that can be used for the crash file */
+#define RECORDER_PATH_MAX 1024
+
+
+/**
+ * A single recorded plugin event
+**/
+typedef struct {
+  gint64 time;                  /*< Monotonic time of the event (usec)       */
+  const char *event;            /*< Static name of the event                 */
+  gconstpointer conv;           /*< The conversation involved, if any        */
+  gint tabs;                    /*< Tabs in the merged notebook, or -1       */
+  gboolean dummy;               /*< Whether the dummy tab was displayed      */
+  gboolean menus;               /*< Whether conv menus were on the blist     */
+} PwmRecord;
+
+
+/**
+ * The recorder's state, allocated statically so crashes can still read it
+**/
+static struct {
+  PwmRecord records[RECORDER_SIZE]; /*< The ring buffer of events            */
+  guint count;                  /*< Total number of events recorded          */
+  char path[RECORDER_PATH_MAX]; /*< Where to write the history on crashes    */
+#ifndef _WIN32
+  struct sigaction old_abrt;    /*< The previous SIGABRT handler             */
+  struct sigaction old_segv;    /*< The previous SIGSEGV handler             */
+#endif
+  gboolean started;             /*< Whether the crash handlers are installed */
+} recorder;
+
+
+/**
+ * Append an unsigned number to a buffer in the given base
+ *
+ * @param[in] buf        The end of the text in the buffer
+ * @param[in] value      The number to format
+ * @param[in] base       The base to use, either 10 or 16
+ * @return               The new end of the text in the buffer
+**/
+static char *
+format_number(char *buf, guint64 value, guint base)
+{
+  char digits[24];              /*< The digits in reverse order              */
+  gint n = 0;                   /*< The number of digits                     */
+
+  do {
+    digits[n++] = "0123456789abcdef"[value % base];
+    value /= base;
+  } while ( value != 0 );
+
+  while ( n > 0 )
+    *buf++ = digits[--n];
+
+  return buf;
+}
+
+
+/**
+ * Append a string to a buffer, truncated to a maximum length
+ *
+ * @param[in] buf        The end of the text in the buffer
+ * @param[in] str        The string to append
+ * @param[in] max        The maximum number of characters to append
+ * @return               The new end of the text in the buffer
+**/
+static char *
+format_string(char *buf, const char *str, gint max)
+{
+  while ( str != NULL && *str != '\0' && max-- > 0 )
+    *buf++ = *str++;
+
+  return buf;
+}
+
+
+/**
+ * Write the event history to a file descriptor, from oldest to newest
+ *
+ * This function is async-signal-safe.
+ *
+ * @param[in] fd         The file descriptor to write
+**/
+static void
+write_records(int fd)
+{
+  PwmRecord *record;            /*< The record being written                 */
+  char line[160];               /*< The text of the record being written     */
+  char *end;                    /*< The end of the text in the line          */
+  guint first;                  /*< The oldest record still in the buffer    */
+  guint i;                      /*< The record number (iteration)            */
+
+  end = format_string(line, "# usec event conv tabs dummy menus\n", 64);
+  if ( write(fd, line, end - line) < 0 )
+    return;
+
+  first = recorder.count > RECORDER_SIZE ? recorder.count - RECORDER_SIZE : 0;
+  for ( i = first; i < recorder.count; i++ ) {
+    record = &recorder.records[i % RECORDER_SIZE];
+    end = format_number(line, record->time, 10);
+    *end++ = ' ';
+    end = format_string(end, record->event, 64);
+    end = format_string(end, " 0x", 3);
+    end = format_number(end, GPOINTER_TO_SIZE(record->conv), 16);
+    *end++ = ' ';
+    if ( record->tabs < 0 )
+      *end++ = '-';
+    else
+      end = format_number(end, record->tabs, 10);
+    *end++ = ' ';
+    *end++ = record->dummy ? '1' : '0';
+    *end++ = ' ';
+    *end++ = record->menus ? '1' : '0';
+    *end++ = '\n';
+    if ( write(fd, line, end - line) < 0 )
+      return;
+  }
+}
+
+
+#ifndef _WIN32
+/**
+ * A signal handler to save the event history before Pidgin crashes
+ *
+ * The previous handler is restored and the signal raised again, so Pidgin's
+ * own crash handling proceeds as if this handler was never installed.
+ *
+ * @param[in] signum     The signal that was caught
+**/
+static void
+crash_handler(int signum)
+{
+  int fd;                       /*< The crash file being written             */
+
+  fd = open(recorder.path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if ( fd >= 0 ) {
+    write_records(fd);
+    close(fd);
+  }
+
+  sigaction(signum, signum == SIGSEGV ? &recorder.old_segv :
+                                        &recorder.old_abrt, NULL);
+  raise(signum);
+}
+#endif
+
+
+/**
+ * Record a plugin event along with the state of the merged window
+ *
+ * @param[in] gtkblist   The Buddy List involved in the event, if known
+ * @param[in] event      The static name of the event
+ * @param[in] conv       The conversation involved in the event, if any
+ *
+ * @note The conversation is always a PurpleConversation, never the Pidgin
+ *       conversation or window, so records of one conversation are comparable.
+**/
+void
+pwm_record_event(PidginBuddyList *gtkblist, const char *event,
+                 gconstpointer conv)
+{
+  PidginConversation *gtkconv;  /*< The dummy conversation of gtkblist       */
+  PidginWindow *gtkconvwin;     /*< Conversation window merged into gtkblist */
+  PwmRecord *record;            /*< The slot for the new record              */
+
+  gtkconvwin = pwm_blist_get_convs(gtkblist);
+  record = &recorder.records[recorder.count % RECORDER_SIZE];
+
+  record->time = g_get_monotonic_time();
+  record->event = event;
+  record->conv = conv;
+  record->tabs = -1;
+  record->dummy = FALSE;
+  record->menus = FALSE;
+
+  /* Only a merged Buddy List has any interesting state. */
+  if ( gtkconvwin != NULL ) {
+    gtkconv = pwm_fetch(gtkblist, "fake_tab");
+    record->tabs = pidgin_conv_window_get_gtkconv_count(gtkconvwin);
+    record->dummy = gtkconv != NULL && pidgin_conv_get_window(gtkconv) != NULL;
+    record->menus = pwm_fetch(gtkblist, "conv_menus") != NULL;
+  }
+
+  recorder.count++;
+}
+
+
+/**
+ * Save the event history to the plugin's event file
+ *
+ * @return               A newly allocated path to the file, or NULL on error
+**/
+gchar *
+pwm_recorder_dump(void)
+{
+  gchar *path;                  /*< The path of the event file               */
+  int fd;                       /*< The event file being written             */
+
+  path = pwm_user_file("-events.log");
+  fd = g_open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+  if ( fd < 0 ) {
+    g_free(path);
+    return NULL;
+  }
+
+  write_records(fd);
+  close(fd);
+
+  return path;
+}
+
+
+/**
+ * Start saving the event history when the program crashes
+**/
+void
+pwm_recorder_start(void)
+{
+#ifndef _WIN32
+  struct sigaction action;      /*< The crash handler to be installed        */
+  gchar *path;                  /*< The path of the event file               */
+
+  /* Sanity check: Don't replace the handlers that chain to the originals. */
+  if ( recorder.started )
+    return;
+
+  /* Determine the file name now, since it can't be done while crashing. */
+  path = pwm_user_file("-events.log");
+  g_strlcpy(recorder.path, path, sizeof(recorder.path));
+  g_free(path);
+
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = crash_handler;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGSEGV, &action, &recorder.old_segv);
+  sigaction(SIGABRT, &action, &recorder.old_abrt);
+
+  recorder.started = TRUE;
+#endif
+}
+
+
+/**
+ * Stop saving the event history on crashes, restoring the original handlers
+ *
+ * @note This must be called before the plugin is unloaded from memory.
+**/
+void
+pwm_recorder_stop(void)
+{
+#ifndef _WIN32
+  if ( !recorder.started )
+    return;
+
+  sigaction(SIGSEGV, &recorder.old_segv, NULL);
+  sigaction(SIGABRT, &recorder.old_abrt, NULL);
+
+  recorder.started = FALSE;
+#endif
+}
@@ -0,0 +1,888 @@
+/**
+ * @file search.c
+ * Searches the text of every conversation in the merged window at once
+ *
+ * Finding something in one of many merged conversations would otherwise mean
+ * switching to each tab (laying out its history) and using its Find bar.  The
+ * functions in this file keep an index of each merged conversation's lines,
+ * folded for case-insensitive matching, so a search across all tabs only
+ * scans memory and never touches a conversation widget until a result is
+ * chosen.  Indexing is off unless the user enables it, since it keeps a copy
+ * of the text, and only the newest lines of each conversation are kept.
+ *
+ * New messages are indexed as they are displayed.  The text that was already
+ * in a history (e.g. from the History plugin) is split and folded in a worker
+ * thread.  Each indexed line keeps a text mark, so choosing a result can jump
+ * straight to its tab and line even after more text has been inserted.
+ * Conversations in other windows are not indexed, and a conversation's index
+ * is dropped when it is found outside of a merged window.
+ *
+ * @section LICENSE
+ * Copyright (C) 2012 David Michael <fedora.dm0@gmail.com>
+ *
+ * This file is part of Window Merge.
+ *
+ * Window Merge is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * Window Merge is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Window Merge.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "plugin.h"
+
+#include <gtkblist.h>
+#include <gtkconv.h>
+#include <gtkutils.h>
+
+#include <conversation.h>
+#include <signals.h>
+#include <util.h>
+
+#include <gdk/gdkkeysyms.h>
+#include <gio/gio.h>
+#include <string.h>
+
+#include "window_merge.h"
+
+/** The most results listed for a search */
+#define SEARCH_RESULTS 100
+
+/** The most lines indexed for each conversation */
+#define SEARCH_LINES 5000
+
+
+/**
+ * A line of a conversation's history in the index
+**/
+typedef struct {
+  GtkTextMark *mark;            /*< The start of the line in the history     */
+  gint line;                    /*< The line number, only while scanning     */
+  gchar *text;                  /*< The case-folded text of the line         */
+} PwmSearchLine;
+
+
+/**
+ * The index of a conversation's history
+ *
+ * The list of indexes holds one reference.  A task scanning the history holds
+ * another until its ready callback runs, which can be after the index was
+ * dropped from the list.
+**/
+typedef struct {
+  PurpleConversation *conv;     /*< The conversation, or NULL once closed    */
+  GPtrArray *lines;             /*< The indexed lines, from oldest to newest */
+  GtkTextMark *next;            /*< Where the next displayed message starts  */
+  GtkTextMark *scan;            /*< The start of the text being scanned      */
+  GCancellable *cancel;         /*< Cancels scanning on unload               */
+  guint idle;                   /*< The source ID starting the scan          */
+  gint refs;                    /*< The number of references to the index    */
+} PwmSearchIndex;
+
+
+/**
+ * The search index and its window, only accessed from the main thread
+**/
+static struct {
+  GList *indexes;               /*< The conversation indexes                 */
+  GtkWidget *window;            /*< The search window, if it was created     */
+  GtkWidget *entry;             /*< The search text entry                    */
+  GtkListStore *results;        /*< The results of the current search        */
+  gboolean started;             /*< Whether conversations are being indexed  */
+} search;
+
+
+/** The columns of the search results */
+enum {
+  RESULT_CONV,                  /*< The conversation of the result           */
+  RESULT_MARK,                  /*< The start of the line (a reference)      */
+  RESULT_NAME,                  /*< The title of the conversation            */
+  RESULT_TEXT,                  /*< The text of the line                     */
+  RESULT_COLUMNS
+};
+
+
+/**
+ * Free an indexed line
+ *
+ * @param[in] data       The line to free
+**/
+static void
+free_line(gpointer data)
+{
+  PwmSearchLine *line;          /*< The line being freed                     */
+
+  line = data;
+  if ( line->mark != NULL )
+    gtk_text_buffer_delete_mark(gtk_text_mark_get_buffer(line->mark),
+                                line->mark);
+  g_free(line->text);
+  g_free(line);
+}
+
+
+/**
+ * Free the lines of a scan that won't be added to an index
+ *
+ * @param[in] lines      The scanned lines, which have no marks yet
+**/
+static void
+free_scanned_lines(GPtrArray *lines)
+{
+  g_ptr_array_set_free_func(lines, free_line);
+  g_ptr_array_unref(lines);
+}
+
+
+/**
+ * Drop the oldest lines of an index beyond the most that are kept
+ *
+ * @param[in] index      The index that had lines added
+**/
+static void
+trim_lines(PwmSearchIndex *index)
+{
+  if ( index->lines->len > SEARCH_LINES )
+    g_ptr_array_remove_range(index->lines, 0,
+                             index->lines->len - SEARCH_LINES);
+}
+
+
+/**
+ * Remove an index's marks from its history, and forget its conversation
+ *
+ * This must be done before the history is destroyed.
+ *
+ * @param[in] index      The index of a conversation being closed
+**/
+static void
+detach_index(PwmSearchIndex *index)
+{
+  if ( index->conv == NULL )
+    return;
+
+  purple_conversation_set_data(index->conv, "pwm_search", NULL);
+  index->conv = NULL;
+
+  if ( index->idle != 0 )
+    g_source_remove(index->idle);
+  index->idle = 0;
+  if ( index->next != NULL )
+    gtk_text_buffer_delete_mark(gtk_text_mark_get_buffer(index->next),
+                                index->next);
+  index->next = NULL;
+  if ( index->scan != NULL )
+    gtk_text_buffer_delete_mark(gtk_text_mark_get_buffer(index->scan),
+                                index->scan);
+  index->scan = NULL;
+  g_ptr_array_set_size(index->lines, 0);
+  g_cancellable_cancel(index->cancel);
+}
+
+
+/**
+ * Release a reference to an index, and free it with the last one
+ *
+ * @param[in] index      The index to release
+**/
+static void
+unref_index(PwmSearchIndex *index)
+{
+  if ( --index->refs > 0 )
+    return;
+
+  g_ptr_array_unref(index->lines);
+  g_object_unref(index->cancel);
+  g_free(index);
+}
+
+
+/**
+ * Stop indexing a conversation, and release the list's reference to its index
+ *
+ * @param[in] index      The index to drop
+**/
+static void
+drop_index(PwmSearchIndex *index)
+{
+  search.indexes = g_list_remove(search.indexes, index);
+
+  detach_index(index);
+  unref_index(index);
+}
+
+
+/**
+ * Check whether a conversation is displayed in a merged window
+ *
+ * @param[in] conv       The conversation to check
+ * @return               Whether its window is merged with a Buddy List
+**/
+static gboolean
+is_merged(PurpleConversation *conv)
+{
+  PidginConversation *gtkconv;  /*< The Pidgin UI of conv                    */
+
+  gtkconv = PIDGIN_CONVERSATION(conv);
+  return gtkconv != NULL &&
+         pwm_convs_get_blist(pidgin_conv_get_window(gtkconv)) != NULL;
+}
+
+
+/**
+ * Split the existing text of a history into folded lines in a worker thread
+ *
+ * @param[in] task       The task running the scan
+ * @param[in] source     Unused
+ * @param[in] data       The text of the history
+ * @param[in] cancel     Cancels the scan
+**/
+static void
+scan_thread(GTask *task, U gpointer source, gpointer data,
+            GCancellable *cancel)
+{
+  PwmSearchLine *line;          /*< A line being indexed                     */
+  GPtrArray *lines;             /*< The lines found in the text              */
+  gchar **texts;                /*< The text split into lines                */
+  guint kept = 0;               /*< The number of lines that will be kept    */
+  gint i;                       /*< The index of a line (iteration)          */
+
+  lines = g_ptr_array_new();
+  texts = g_strsplit(data, "\n", -1);
+
+  /* Only fold the newest lines, since older ones would be dropped anyway. */
+  for ( i = g_strv_length(texts); i > 0 && kept < SEARCH_LINES; i-- )
+    if ( *g_strstrip(texts[i - 1]) != '\0' )
+      kept++;
+
+  for ( ; texts[i] != NULL && !g_cancellable_is_cancelled(cancel); i++ )
+    if ( *texts[i] != '\0' ) {
+      line = g_new0(PwmSearchLine, 1);
+      line->line = i;
+      line->text = g_utf8_casefold(texts[i], -1);
+      g_ptr_array_add(lines, line);
+    }
+  g_strfreev(texts);
+
+  g_task_return_pointer(task, lines, (GDestroyNotify)g_ptr_array_unref);
+}
+
+
+/**
+ * A callback for when a worker thread has finished scanning a history
+ *
+ * The scanned lines are placed before the lines indexed since the scan
+ * started.  Their marks are placed relative to the scan mark, which moves
+ * with any text inserted above the scanned text meanwhile.
+ *
+ * @param[in] source     Unused
+ * @param[in] result     The result of the scan task
+ * @param[in] data       The index being built
+ *
+ * @note This can run after pwm_search_stop(), when it only frees the index.
+**/
+static void
+scan_ready_cb(U GObject *source, GAsyncResult *result, gpointer data)
+{
+  PwmSearchIndex *index;        /*< The index being built                    */
+  PwmSearchLine *line;          /*< A scanned line                           */
+  GtkTextBuffer *buffer;        /*< The text buffer of the history           */
+  GtkTextIter iter;             /*< The start of a scanned line              */
+  GPtrArray *lines;             /*< The scanned lines                        */
+  gint base;                    /*< The line where the scanned text starts   */
+  guint i;                      /*< The index of a line (iteration)          */
+
+  index = data;
+  lines = g_task_propagate_pointer(G_TASK(result), NULL);
+
+  /* Sanity check: A dropped index was already removed from the list. */
+  if ( g_cancellable_is_cancelled(index->cancel) ) {
+    if ( lines != NULL )
+      free_scanned_lines(lines);
+    unref_index(index);
+    return;
+  }
+
+  buffer = gtk_text_mark_get_buffer(index->scan);
+  gtk_text_buffer_get_iter_at_mark(buffer, &iter, index->scan);
+  base = gtk_text_iter_get_line(&iter);
+  gtk_text_buffer_delete_mark(buffer, index->scan);
+  index->scan = NULL;
+
+  for ( i = 0; i < lines->len; i++ ) {
+    line = g_ptr_array_index(lines, i);
+    gtk_text_buffer_get_iter_at_line(buffer, &iter, base + line->line);
+    line->mark = gtk_text_buffer_create_mark(buffer, NULL, &iter, TRUE);
+  }
+
+  /* Put the scanned lines before the ones indexed since the scan started. */
+  for ( i = 0; i < index->lines->len; i++ )
+    g_ptr_array_add(lines, g_ptr_array_index(index->lines, i));
+  g_ptr_array_set_free_func(index->lines, NULL);
+  g_ptr_array_unref(index->lines);
+  g_ptr_array_set_free_func(lines, free_line);
+  index->lines = lines;
+  trim_lines(index);
+  unref_index(index);
+}
+
+
+/**
+ * An idle callback to start indexing the text already in a history
+ *
+ * This waits for other plugins to fill the history of a new conversation.
+ * Messages displayed before this runs are part of the scanned text.
+ *
+ * @param[in] data       The index being built
+ * @return               Whether to call this function again
+**/
+static gboolean
+start_scan_cb(gpointer data)
+{
+  PidginConversation *gtkconv;  /*< The conversation being indexed           */
+  PwmSearchIndex *index;        /*< The index being built                    */
+  GtkTextBuffer *buffer;        /*< The text buffer of the history           */
+  GtkTextIter start;            /*< The start of the history                 */
+  GtkTextIter end;              /*< The end of the history                   */
+  GTask *task;                  /*< The task scanning the text               */
+
+  index = data;
+  index->idle = 0;
+  gtkconv = PIDGIN_CONVERSATION(index->conv);
+
+  /* Sanity check: Only scan merged conversations that have a history. */
+  if ( !is_merged(index->conv) ) {
+    drop_index(index);
+    return FALSE;
+  } else if ( gtkconv->imhtml == NULL )
+    return FALSE;
+
+  buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(gtkconv->imhtml));
+  gtk_text_buffer_get_bounds(buffer, &start, &end);
+  index->next = gtk_text_buffer_create_mark(buffer, NULL, &end, TRUE);
+
+  /* Sanity check: Don't start a thread for an empty history. */
+  if ( gtk_text_iter_equal(&start, &end) )
+    return FALSE;
+
+  index->scan = gtk_text_buffer_create_mark(buffer, NULL, &start, FALSE);
+  index->refs++;
+
+  task = g_task_new(NULL, index->cancel, scan_ready_cb, index);
+  g_task_set_task_data(task, gtk_text_buffer_get_text(buffer, &start, &end,
+                                                      FALSE), g_free);
+  g_task_run_in_thread(task, scan_thread);
+  g_object_unref(task);
+
+  return FALSE;
+}
+
+
+/**
+ * Start indexing a conversation
+ *
+ * @param[in] conv       The conversation to index
+**/
+static void
+add_index(PurpleConversation *conv)
+{
+  PwmSearchIndex *index;        /*< The new index                            */
+
+  index = g_new0(PwmSearchIndex, 1);
+  index->refs = 1;
+  index->conv = conv;
+  index->lines = g_ptr_array_new_with_free_func(free_line);
+  index->cancel = g_cancellable_new();
+  index->idle = g_idle_add(start_scan_cb, index);
+  purple_conversation_set_data(conv, "pwm_search", index);
+  search.indexes = g_list_prepend(search.indexes, index);
+}
+
+
+/**
+ * A callback for when a conversation is created
+ *
+ * The index is dropped when its scan starts if conv isn't merged by then.
+ *
+ * @param[in] conv       The new conversation
+**/
+static void
+conversation_created_cb(PurpleConversation *conv)
+{
+  add_index(conv);
+}
+
+
+/**
+ * A callback for when a conversation is being closed
+ *
+ * @param[in] conv       The conversation on its way out the door
+**/
+static void
+deleting_conversation_cb(PurpleConversation *conv)
+{
+  PwmSearchIndex *index;        /*< The index of conv                        */
+
+  index = purple_conversation_get_data(conv, "pwm_search");
+
+  /* Sanity check: Only drop indexed conversations. */
+  if ( index != NULL )
+    drop_index(index);
+}
+
+
+/**
+ * A callback for when a conversation's scrollback is cleared
+ *
+ * Clearing the history leaves the marks of its lines at the start of the
+ * empty buffer, so the index is dropped and scanned again when idle, after
+ * Pidgin's own handler of this signal has emptied the history.
+ *
+ * @param[in] conv       The conversation that was cleared
+**/
+static void
+cleared_history_cb(PurpleConversation *conv)
+{
+  PwmSearchIndex *index;        /*< The index of conv                        */
+
+  index = purple_conversation_get_data(conv, "pwm_search");
+
+  /* Sanity check: Only rebuild indexed conversations. */
+  if ( index == NULL )
+    return;
+
+  drop_index(index);
+  add_index(conv);
+}
+
+
+/**
+ * A callback for when a message is about to be displayed, to mark its start
+ *
+ * This also starts indexing a conversation that was moved into a merged
+ * window, and stops indexing one that was moved out of it.
+ *
+ * @param[in] account    Unused
+ * @param[in] who        Unused
+ * @param[in] message    Unused
+ * @param[in] conv       The conversation displaying the message
+ * @param[in] flags      Unused
+ * @return               Whether to cancel displaying the message
+**/
+static gboolean
+displaying_msg_cb(U PurpleAccount *account, U const char *who,
+                  U char **message, PurpleConversation *conv,
+                  U PurpleMessageFlags flags)
+{
+  PwmSearchIndex *index;        /*< The index of conv                        */
+  GtkTextBuffer *buffer;        /*< The text buffer of the history           */
+  GtkTextIter end;              /*< The end of the history                   */
+
+  index = purple_conversation_get_data(conv, "pwm_search");
+
+  /* Index conversations as they are moved into and out of merged windows. */
+  if ( index == NULL ) {
+    if ( is_merged(conv) )
+      add_index(conv);
+    return FALSE;
+  } else if ( !is_merged(conv) ) {
+    drop_index(index);
+    return FALSE;
+  }
+
+  /* Messages displayed before the scan starts will be scanned. */
+  if ( index->next != NULL ) {
+    buffer = gtk_text_mark_get_buffer(index->next);
+    gtk_text_buffer_get_end_iter(buffer, &end);
+    gtk_text_buffer_move_mark(buffer, index->next, &end);
+  }
+
+  return FALSE;
+}
+
+
+/**
+ * A callback for when a message was displayed, to add it to the index
+ *
+ * @param[in] account    Unused
+ * @param[in] who        Unused
+ * @param[in] message    The text of the message
+ * @param[in] conv       The conversation displaying the message
+ * @param[in] flags      Unused
+**/
+static void
+displayed_msg_cb(U PurpleAccount *account, U const char *who,
+                 const char *message, PurpleConversation *conv,
+                 U PurpleMessageFlags flags)
+{
+  PwmSearchIndex *index;        /*< The index of conv                        */
+  PwmSearchLine *line;          /*< The line being indexed                   */
+  GtkTextBuffer *buffer;        /*< The text buffer of the history           */
+  GtkTextIter iter;             /*< The start of the message                 */
+  gchar *text;                  /*< The message without its markup           */
+
+  index = purple_conversation_get_data(conv, "pwm_search");
+
+  /* Sanity check: Only index messages after the scan has started. */
+  if ( index == NULL || index->next == NULL || message == NULL )
+    return;
+
+  /* Pidgin starts a new line before each message after the first one. */
+  buffer = gtk_text_mark_get_buffer(index->next);
+  gtk_text_buffer_get_iter_at_mark(buffer, &iter, index->next);
+  if ( gtk_text_iter_ends_line(&iter) && !gtk_text_iter_is_end(&iter) )
+    gtk_text_iter_forward_line(&iter);
+
+  text = purple_markup_strip_html(message);
+  line = g_new0(PwmSearchLine, 1);
+  line->mark = gtk_text_buffer_create_mark(buffer, NULL, &iter, TRUE);
+  line->text = g_utf8_casefold(text, -1);
+  g_ptr_array_add(index->lines, line);
+  trim_lines(index);
+  g_free(text);
+}
+
+
+/**
+ * List the lines of merged conversations matching the search text
+ *
+ * @param[in] entry      The search text entry
+ * @param[in] data       Unused
+**/
+static void
+entry_changed_cb(GtkEntry *entry, U gpointer data)
+{
+  PidginConversation *gtkconv;  /*< The conversation of an index             */
+  PwmSearchIndex *index;        /*< The index of a conversation              */
+  PwmSearchLine *line;          /*< An indexed line                          */
+  GtkTextBuffer *buffer;        /*< The text buffer of a history             */
+  GtkTextIter start;            /*< The start of a matching line             */
+  GtkTextIter end;              /*< The end of a matching line               */
+  GtkTreeIter row;              /*< The row of a result                      */
+  GList *item;                  /*< An index in the list (iteration)         */
+  gchar *query;                 /*< The case-folded search text              */
+  gchar *text;                  /*< The text of a matching line              */
+  guint count = 0;              /*< The number of results listed             */
+  guint i;                      /*< The index of a line (iteration)          */
+
+  gtk_list_store_clear(search.results);
+  query = g_utf8_casefold(gtk_entry_get_text(entry), -1);
+
+  /* Sanity check: Don't list every line for an empty search. */
+  if ( *query == '\0' ) {
+    g_free(query);
+    return;
+  }
+
+  for ( item = search.indexes; item != NULL && count < SEARCH_RESULTS;
+        item = item->next ) {
+    index = item->data;
+    gtkconv = index->conv != NULL ? PIDGIN_CONVERSATION(index->conv) : NULL;
+    if ( gtkconv == NULL ||
+         pwm_convs_get_blist(pidgin_conv_get_window(gtkconv)) == NULL )
+      continue;
+
+    /* List the newest matches first. */
+    for ( i = index->lines->len; i > 0 && count < SEARCH_RESULTS; i-- ) {
+      line = g_ptr_array_index(index->lines, i - 1);
+      if ( strstr(line->text, query) == NULL )
+        continue;
+
+      buffer = gtk_text_mark_get_buffer(line->mark);
+      gtk_text_buffer_get_iter_at_mark(buffer, &start, line->mark);
+      end = start;
+      if ( !gtk_text_iter_ends_line(&end) )
+        gtk_text_iter_forward_to_line_end(&end);
+      text = gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
+
+      gtk_list_store_insert_with_values(search.results, &row, -1,
+        RESULT_CONV, index->conv,
+        RESULT_MARK, line->mark,
+        RESULT_NAME, purple_conversation_get_title(index->conv),
+        RESULT_TEXT, text,
+        -1);
+      g_free(text);
+      count++;
+    }
+  }
+
+  g_free(query);
+}
+
+
+/**
+ * Jump to the line of a search result, and hide the search window
+ *
+ * @param[in] row        The row of the result
+**/
+static void
+jump_to_result(GtkTreeIter *row)
+{
+  PurpleConversation *conv;     /*< The conversation of the result           */
+  PidginConversation *gtkconv;  /*< The Pidgin UI of conv                    */
+  GtkTextMark *mark;            /*< The start of the line in the history     */
+  GtkTextBuffer *buffer;        /*< The text buffer of the history           */
+  GtkTextIter start;            /*< The start of the line                    */
+  GtkTextIter end;              /*< The end of the line                      */
+
+  gtk_tree_model_get(GTK_TREE_MODEL(search.results), row, RESULT_CONV, &conv,
+                     RESULT_MARK, &mark, -1);
+  gtk_widget_hide(search.window);
+
+  /* Sanity check: The conversation could have been closed meanwhile. */
+  if ( g_list_find(purple_get_conversations(), conv) == NULL ||
+       gtk_text_mark_get_deleted(mark) ) {
+    g_object_unref(mark);
+    return;
+  }
+
+  gtkconv = PIDGIN_CONVERSATION(conv);
+  pidgin_conv_window_switch_gtkconv(pidgin_conv_get_window(gtkconv), gtkconv);
+
+  /* Select the line, and scroll it to the middle of the history. */
+  buffer = gtk_text_mark_get_buffer(mark);
+  gtk_text_buffer_get_iter_at_mark(buffer, &start, mark);
+  end = start;
+  if ( !gtk_text_iter_ends_line(&end) )
+    gtk_text_iter_forward_to_line_end(&end);
+  gtk_text_buffer_select_range(buffer, &start, &end);
+  gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(gtkconv->imhtml), mark, 0.0,
+                               TRUE, 0.0, 0.5);
+  g_object_unref(mark);
+}
+
+
+/**
+ * A callback for when a search result is activated
+ *
+ * @param[in] view       The results view
+ * @param[in] path       The path of the activated row
+ * @param[in] column     Unused
+ * @param[in] data       Unused
+**/
+static void
+row_activated_cb(GtkTreeView *view, GtkTreePath *path,
+                 U GtkTreeViewColumn *column, U gpointer data)
+{
+  GtkTreeIter row;              /*< The activated row                        */
+
+  if ( gtk_tree_model_get_iter(gtk_tree_view_get_model(view), &row, path) )
+    jump_to_result(&row);
+}
+
+
+/**
+ * A callback for when Enter is pressed in the search entry
+ *
+ * @param[in] entry      Unused
+ * @param[in] data       The results view
+**/
+static void
+entry_activate_cb(U GtkEntry *entry, gpointer data)
+{
+  GtkTreeSelection *selection;  /*< The selection of the results view        */
+  GtkTreeIter row;              /*< The selected (or first) row              */
+
+  selection = gtk_tree_view_get_selection(data);
+  if ( gtk_tree_selection_get_selected(selection, NULL, &row) ||
+       gtk_tree_model_get_iter_first(GTK_TREE_MODEL(search.results), &row) )
+    jump_to_result(&row);
+}
+
+
+/**
+ * A callback for key presses in the search window, to hide it on Escape
+ *
+ * @param[in] widget     The search window
+ * @param[in] event      The key press event
+ * @param[in] data       Unused
+ * @return               Whether to stop processing other event handlers
+**/
+static gboolean
+key_press_event_cb(GtkWidget *widget, GdkEventKey *event, U gpointer data)
+{
+  if ( event->keyval != GDK_Escape )
+    return FALSE;
+
+  gtk_widget_hide(widget);
+  return TRUE;
+}
+
+
+/**
+ * Create the search window
+**/
+static void
+create_window(void)
+{
+  GtkCellRenderer *renderer;    /*< Draws the text of a column               */
+  GtkWidget *scrolled;          /*< Scrolls the results view                 */
+  GtkWidget *view;              /*< Displays the results                     */
+  GtkWidget *vbox;              /*< Stacks the entry over the results        */
+
+  search.results = gtk_list_store_new(RESULT_COLUMNS, G_TYPE_POINTER,
+                                      GTK_TYPE_TEXT_MARK, G_TYPE_STRING,
+                                      G_TYPE_STRING);
+
+  /* TRANSLATORS: This is the title of the window for searching the text of
+     every conversation in the Buddy List window. */
+  search.window = pidgin_create_window(_("Search Conversations"),
+                                       PIDGIN_HIG_BORDER, "pwm_search", TRUE);
+  gtk_window_set_default_size(GTK_WINDOW(search.window), 500, 350);
+  g_object_connect(G_OBJECT(search.window),
+                   "signal::delete-event",
+                   G_CALLBACK(gtk_widget_hide_on_delete), NULL,
+                   "signal::key-press-event",
+                   G_CALLBACK(key_press_event_cb), NULL,
+                   NULL);
+
+  vbox = gtk_vbox_new(FALSE, PIDGIN_HIG_BOX_SPACE);
+  gtk_container_add(GTK_CONTAINER(search.window), vbox);
+
+  view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(search.results));
+  g_object_unref(search.results);
+  renderer = gtk_cell_renderer_text_new();
+  gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1,
+    _("Conversation"), renderer, "text", RESULT_NAME, NULL);
+  renderer = gtk_cell_renderer_text_new();
+  g_object_set(G_OBJECT(renderer), "ellipsize", PANGO_ELLIPSIZE_END, NULL);
+  gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1,
+    _("Message"), renderer, "text", RESULT_TEXT, NULL);
+  g_object_connect(G_OBJECT(view), "signal::row-activated",
+                   G_CALLBACK(row_activated_cb), NULL, NULL);
+
+  search.entry = gtk_entry_new();
+  g_object_connect(G_OBJECT(search.entry),
+                   "signal::changed", G_CALLBACK(entry_changed_cb), NULL,
+                   "signal::activate", G_CALLBACK(entry_activate_cb), view,
+                   NULL);
+
+  scrolled = gtk_scrolled_window_new(NULL, NULL);
+  gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled),
+                                 GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+  gtk_scrolled_window_set_shadow_type(GTK_SCROLLED_WINDOW(scrolled),
+                                      GTK_SHADOW_IN);
+  gtk_container_add(GTK_CONTAINER(scrolled), view);
+  gtk_box_pack_start(GTK_BOX(vbox), search.entry, FALSE, FALSE, 0);
+  gtk_box_pack_start(GTK_BOX(vbox), scrolled, TRUE, TRUE, 0);
+  gtk_widget_show_all(vbox);
+}
+
+
+/**
+ * Display the window for searching the merged window's conversations
+ *
+ * @param[in] gtkblist   The merged Buddy List to search
+**/
+void
+pwm_search_show(PidginBuddyList *gtkblist)
+{
+  PidginConversation *gtkconv;  /*< A conversation in the merged window      */
+  PidginWindow *gtkconvwin;     /*< The merged conversation window           */
+  GList *item;                  /*< A conversation in the list (iteration)   */
+
+  gtkconvwin = pwm_blist_get_convs(gtkblist);
+
+  /* Sanity check: Only search merged windows while indexing is enabled. */
+  if ( !search.started || gtkconvwin == NULL )
+    return;
+
+  /* Index conversations that were moved in without displaying messages. */
+  for ( item = pidgin_conv_window_get_gtkconvs(gtkconvwin); item != NULL;
+        item = item->next ) {
+    gtkconv = item->data;
+    if ( gtkconv->active_conv != NULL &&
+         purple_conversation_get_data(gtkconv->active_conv,
+                                      "pwm_search") == NULL )
+      add_index(gtkconv->active_conv);
+  }
+
+  if ( search.window == NULL )
+    create_window();
+
+  gtk_window_set_transient_for(GTK_WINDOW(search.window),
+                               GTK_WINDOW(gtkblist->window));
+  gtk_window_present(GTK_WINDOW(search.window));
+  gtk_editable_select_region(GTK_EDITABLE(search.entry), 0, -1);
+  gtk_widget_grab_focus(search.entry);
+
+  /* Refresh the results with the messages received since the last search. */
+  entry_changed_cb(GTK_ENTRY(search.entry), NULL);
+}
+
+
+/**
+ * Start indexing the text of every merged conversation
+ *
+ * @note Remember pwm_search_stop() before the plugin is unloaded.
+**/
+void
+pwm_search_start(void)
+{
+  void *conv_handle;            /*< The conversations handle                 */
+  void *gtkconv_handle;         /*< The Pidgin conversations handle          */
+  GList *item;                  /*< A conversation in the list (iteration)   */
+
+  /* Sanity check: Don't index conversations twice. */
+  if ( search.started )
+    return;
+
+  conv_handle = purple_conversations_get_handle();
+  gtkconv_handle = pidgin_conversations_get_handle();
+
+  purple_signal_connect(conv_handle, "conversation-created", &search,
+                        PURPLE_CALLBACK(conversation_created_cb), NULL);
+  purple_signal_connect(conv_handle, "deleting-conversation", &search,
+                        PURPLE_CALLBACK(deleting_conversation_cb), NULL);
+  purple_signal_connect(conv_handle, "cleared-message-history", &search,
+                        PURPLE_CALLBACK(cleared_history_cb), NULL);
+  purple_signal_connect(gtkconv_handle, "displaying-im-msg", &search,
+                        PURPLE_CALLBACK(displaying_msg_cb), NULL);
+  purple_signal_connect(gtkconv_handle, "displaying-chat-msg", &search,
+                        PURPLE_CALLBACK(displaying_msg_cb), NULL);
+  purple_signal_connect(gtkconv_handle, "displayed-im-msg", &search,
+                        PURPLE_CALLBACK(displayed_msg_cb), NULL);
+  purple_signal_connect(gtkconv_handle, "displayed-chat-msg", &search,
+                        PURPLE_CALLBACK(displayed_msg_cb), NULL);
+
+  for ( item = purple_get_conversations(); item != NULL; item = item->next )
+    if ( is_merged(item->data) )
+      add_index(item->data);
+
+  search.started = TRUE;
+}
+
+
+/**
+ * Stop indexing conversations without waiting for worker threads to finish
+ *
+ * Each scan still running holds a reference to its cancelled index, which
+ * the scan's ready callback frees when the worker thread returns.
+ *
+ * @note This must be called before the plugin is unloaded from memory.
+**/
+void
+pwm_search_stop(void)
+{
+  if ( !search.started )
+    return;
+
+  purple_signals_disconnect_by_handle(&search);
+
+  if ( search.window != NULL ) {
+    gtk_widget_destroy(search.window);
+    search.window = NULL;
+  }
+
+  while ( search.indexes != NULL )
+    drop_index(search.indexes->data);
+
+  search.started = FALSE;
+}
@@ -0,0 +1,510 @@
+/**
+ * @file session.c
+ * Restores the merged conversations of the last session as placeholder tabs
+ *
+ * The conversations in the merged window are saved in the layout state when
+ * Pidgin quits.  At the next startup they are restored as placeholder tabs,
+ * which only hold a label, so restoring many tabs costs almost nothing.  The
+ * real conversation is opened when its placeholder is selected, and it takes
+ * the placeholder's place whenever it is created (e.g. by a new message).
+ *
+ * Placeholders are kept in the window's list of conversations like the dummy
+ * tab, so the window isn't destroyed while it only has placeholders.  Having
+ * no Purple conversation, they aren't counted as conversations by the plugin,
+ * and the conversation menus are hidden while one is displayed.  A chat that
+ * can't be rejoined says so in its tab, and it is tried again when its account
+ * signs on.
+ *
+ * @section LICENSE
+ * Copyright (C) 2012 David Michael <fedora.dm0@gmail.com>
+ *
+ * This file is part of Window Merge.
+ *
+ * Window Merge is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * Window Merge is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Window Merge.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "plugin.h"
+
+#include <gtkblist.h>
+#include <gtkconv.h>
+#include <pidginstock.h>
+
+#include <account.h>
+#include <blist.h>
+#include <connection.h>
+#include <conversation.h>
+#include <server.h>
+#include <signals.h>
+#include <util.h>
+
+#include <stdlib.h>
+
+#include "window_merge.h"
+
+
+/**
+ * A saved conversation displayed as a placeholder tab
+**/
+typedef struct {
+  PidginConversation *gtkconv;  /*< The placeholder conversation UI          */
+  PurpleConversationType type;  /*< Whether it is an IM or a chat            */
+  gchar *protocol;              /*< The protocol ID of the account           */
+  gchar *username;              /*< The user name of the account             */
+  gchar *name;                  /*< The name of the conversation             */
+  guint idle;                   /*< The source ID opening the conversation   */
+  gboolean waiting;             /*< Whether it opens when its account is on  */
+} PwmSessionTab;
+
+
+/**
+ * The placeholder tabs of the restored session
+**/
+static struct {
+  PidginBuddyList *gtkblist;    /*< The Buddy List displaying placeholders   */
+  GList *tabs;                  /*< The placeholder tabs still displayed     */
+  gboolean restored;            /*< Whether the last session was restored    */
+} session;
+
+
+/**
+ * Remove a placeholder tab, and free its memory
+ *
+ * @param[in] tab        The placeholder tab to free
+**/
+static void
+free_tab(PwmSessionTab *tab)
+{
+  session.tabs = g_list_remove(session.tabs, tab);
+
+  if ( tab->idle != 0 )
+    g_source_remove(tab->idle);
+  pwm_placeholder_free(tab->gtkconv);
+  g_free(tab->protocol);
+  g_free(tab->username);
+  g_free(tab->name);
+  g_free(tab);
+}
+
+
+/**
+ * Find the placeholder tab for a conversation
+ *
+ * @param[in] conv       The conversation to find
+ * @return               Its placeholder tab, or NULL if there isn't one
+**/
+static PwmSessionTab *
+find_tab(PurpleConversation *conv)
+{
+  PurpleAccount *account;       /*< The account of the conversation          */
+  PwmSessionTab *tab;           /*< A placeholder tab                        */
+  GList *item;                  /*< A placeholder list item (iteration)      */
+
+  account = purple_conversation_get_account(conv);
+
+  for ( item = session.tabs; item != NULL; item = item->next ) {
+    tab = item->data;
+    if ( tab->type == purple_conversation_get_type(conv) &&
+         g_str_equal(tab->protocol, purple_account_get_protocol_id(account)) &&
+         g_str_equal(tab->username, purple_account_get_username(account)) &&
+         purple_strequal(tab->name, purple_conversation_get_name(conv)) )
+      return tab;
+  }
+
+  return NULL;
+}
+
+
+/**
+ * Display why a placeholder's conversation couldn't be opened
+ *
+ * @param[in] tab        The placeholder tab that couldn't be opened
+ * @param[in] format     The markup of the explanation, with a %s for the title
+**/
+static void
+show_tab_problem(PwmSessionTab *tab, const char *format)
+{
+  gchar *markup;                /*< The text displayed in the placeholder    */
+  gchar *escaped;               /*< The title escaped for markup             */
+
+  escaped = g_markup_escape_text(gtk_label_get_text(
+                                   GTK_LABEL(tab->gtkconv->tab_label)), -1);
+  markup = g_strdup_printf(format, escaped);
+  gtk_label_set_markup(GTK_LABEL(tab->gtkconv->tab_cont), markup);
+  g_free(markup);
+  g_free(escaped);
+
+  g_object_set(G_OBJECT(tab->gtkconv->icon),
+               "stock", PIDGIN_STOCK_DIALOG_WARNING, NULL);
+  g_object_set(G_OBJECT(tab->gtkconv->menu_icon),
+               "stock", PIDGIN_STOCK_DIALOG_WARNING, NULL);
+}
+
+
+/**
+ * An idle callback to open the real conversation of a selected placeholder
+ *
+ * The conversation replaces the placeholder when it is created.  Chats are
+ * joined if their account is online and they are in the Buddy List.  A chat
+ * whose account is offline waits for the account to sign on.
+ *
+ * @param[in] data       The placeholder tab that was selected
+ * @return               Whether to call this function again
+**/
+static gboolean
+open_tab_cb(gpointer data)
+{
+  PurpleAccount *account;       /*< The account of the conversation          */
+  PurpleChat *chat;             /*< The Buddy List entry of a chat           */
+  PwmSessionTab *tab;           /*< The placeholder tab that was selected    */
+
+  tab = data;
+  tab->idle = 0;
+  account = purple_accounts_find(tab->username, tab->protocol);
+
+  /* Sanity check: The account could have been deleted since last session. */
+  if ( account == NULL ) {
+    /* TRANSLATORS: This is displayed in a tab restored from the last session
+       whose account was removed.  The inserted string is its name. */
+    show_tab_problem(tab, _(""
+      "<span size='larger' weight='bold'>%s</span>\n\n"
+      "This conversation can't be opened, since its account was removed."));
+    return FALSE;
+  }
+
+  if ( tab->type == PURPLE_CONV_TYPE_IM ) {
+    purple_conversation_new(PURPLE_CONV_TYPE_IM, account, tab->name);
+    return FALSE;
+  }
+
+  /* Wait for the account to sign on before joining a chat. */
+  if ( !purple_account_is_connected(account) ) {
+    tab->waiting = TRUE;
+    /* TRANSLATORS: This is displayed in a tab restored from the last session
+       for a chat whose account is offline.  The inserted string is the name
+       of the chat. */
+    show_tab_problem(tab, _(""
+      "<span size='larger' weight='bold'>%s</span>\n\n"
+      "This chat can't be rejoined while its account is offline.  "
+      "It will be rejoined when the account signs on."));
+    return FALSE;
+  }
+
+  chat = purple_blist_find_chat(account, tab->name);
+  if ( chat != NULL )
+    serv_join_chat(purple_account_get_connection(account),
+                   purple_chat_get_components(chat));
+  else
+    /* TRANSLATORS: This is displayed in a tab restored from the last session
+       for a chat that was removed from the Buddy List.  The inserted string
+       is its name. */
+    show_tab_problem(tab, _(""
+      "<span size='larger' weight='bold'>%s</span>\n\n"
+      "This chat can't be rejoined, since it isn't in the Buddy List."));
+
+  return FALSE;
+}
+
+
+/**
+ * A callback for when the merged notebook has switched to a page
+ *
+ * The conversation menus are hidden while a placeholder is displayed, since
+ * their actions would run on a tab without a conversation.  A detached
+ * notebook keeps its menus, so they are made insensitive instead.
+ *
+ * @param[in] notebook   The merged conversation notebook
+ * @param[in] page       Unused
+ * @param[in] page_num   The index of the page being displayed
+ * @param[in] data       Unused
+**/
+static void
+switch_page_cb(GtkNotebook *notebook, U gpointer page, guint page_num,
+               U gpointer data)
+{
+  PidginWindow *gtkconvwin;     /*< Conversation window merged into gtkblist */
+  PwmSessionTab *tab;           /*< The placeholder tab being displayed      */
+
+  tab = g_object_get_data(G_OBJECT(gtk_notebook_get_nth_page(notebook,
+                                                              page_num)),
+                          "pwm_session_tab");
+  gtkconvwin = pwm_blist_get_convs(session.gtkblist);
+
+  pwm_set_conv_menus_visible(session.gtkblist, tab == NULL &&
+                             pwm_count_real_convs(gtkconvwin) > 0);
+  gtk_widget_set_sensitive(gtkconvwin->menu.menubar, tab == NULL);
+
+  /* Open the conversation outside of the notebook's signal handlers. */
+  if ( tab != NULL && tab->idle == 0 )
+    tab->idle = g_idle_add(open_tab_cb, tab);
+}
+
+
+/**
+ * A callback for when an account signs on, to rejoin its waiting chats
+ *
+ * @param[in] gc         The connection of the account
+ * @param[in] data       Unused
+**/
+static void
+signed_on_cb(PurpleConnection *gc, U gpointer data)
+{
+  PurpleAccount *account;       /*< The account that signed on               */
+  PwmSessionTab *tab;           /*< A placeholder tab                        */
+  GList *item;                  /*< A placeholder list item (iteration)      */
+
+  account = purple_connection_get_account(gc);
+
+  for ( item = session.tabs; item != NULL; item = item->next ) {
+    tab = item->data;
+    if ( tab->waiting &&
+         g_str_equal(tab->protocol, purple_account_get_protocol_id(account)) &&
+         g_str_equal(tab->username, purple_account_get_username(account)) ) {
+      tab->waiting = FALSE;
+      if ( tab->idle == 0 )
+        tab->idle = g_idle_add(open_tab_cb, tab);
+    }
+  }
+}
+
+
+/**
+ * A callback for when a placeholder tab's "close" button is clicked
+ *
+ * @param[in] button     Unused
+ * @param[in] data       The placeholder tab being closed
+**/
+static void
+close_clicked_cb(U GtkButton *button, gpointer data)
+{
+  free_tab(data);
+}
+
+
+/**
+ * A callback for when a conversation is created, to replace its placeholder
+ *
+ * The new conversation's tab is moved to the placeholder's position, and it
+ * is selected if the placeholder was selected.
+ *
+ * @param[in] conv       The new conversation
+ * @param[in] data       Unused
+**/
+static void
+conversation_created_cb(PurpleConversation *conv, U gpointer data)
+{
+  PidginConversation *gtkconv;  /*< The new Pidgin conversation              */
+  PidginWindow *gtkconvwin;     /*< The window displaying the conversation   */
+  PwmSessionTab *tab;           /*< The placeholder of the conversation      */
+  GtkNotebook *notebook;        /*< The notebook holding the placeholder     */
+  gboolean selected;            /*< Whether the placeholder was selected     */
+  gint position;                /*< The index of the placeholder's page      */
+
+  tab = find_tab(conv);
+  gtkconv = PIDGIN_CONVERSATION(conv);
+
+  /* Sanity check: Only replace placeholders with displayed conversations. */
+  if ( tab == NULL || gtkconv == NULL )
+    return;
+
+  gtkconvwin = pidgin_conv_get_window(gtkconv);
+
+  /* Move the conversation to its placeholder if they share a window. */
+  if ( gtkconvwin == pidgin_conv_get_window(tab->gtkconv) ) {
+    notebook = GTK_NOTEBOOK(gtkconvwin->notebook);
+    position = gtk_notebook_page_num(notebook, tab->gtkconv->tab_cont);
+    selected = gtk_notebook_get_current_page(notebook) == position;
+    gtk_notebook_reorder_child(notebook, gtkconv->tab_cont, position);
+    if ( selected )
+      gtk_notebook_set_current_page(notebook, position);
+  }
+
+  free_tab(tab);
+}
+
+
+/**
+ * Display placeholder tabs for the conversations saved in the layout state
+ *
+ * Conversations that are already open are skipped.  The last session is only
+ * restored once, so merging the Buddy List again doesn't bring back old tabs.
+ *
+ * @param[in] gtkblist   The merged Buddy List to display the placeholders
+ *
+ * @note Remember pwm_session_clear() before the Buddy List is split.
+**/
+void
+pwm_session_restore(PidginBuddyList *gtkblist)
+{
+  PurpleAccount *account;       /*< The account of a saved conversation      */
+  PurpleBuddy *buddy;           /*< The buddy of a saved IM, if any          */
+  PidginWindow *gtkconvwin;     /*< Conversation window merged into gtkblist */
+  PwmSessionTab *tab;           /*< A placeholder tab being restored         */
+  const char *title;            /*< The text of a placeholder's tab          */
+  gchar **entries;              /*< The saved conversations                  */
+  gchar **fields;               /*< The fields of a saved conversation       */
+  gchar *markup;                /*< The text displayed in a placeholder      */
+  gchar *escaped;               /*< The title escaped for markup             */
+  guint i;                      /*< The index of a conversation (iteration)  */
+
+  gtkconvwin = pwm_blist_get_convs(gtkblist);
+
+  /* Sanity check: Only restore the last session once, into a merged window. */
+  if ( gtkconvwin == NULL || session.restored )
+    return;
+
+  session.restored = TRUE;
+  entries = pwm_state_get_strv("session", "tabs");
+  if ( entries == NULL )
+    return;
+
+  session.gtkblist = gtkblist;
+  purple_signal_connect(purple_conversations_get_handle(),
+                        "conversation-created", &session,
+                        PURPLE_CALLBACK(conversation_created_cb), NULL);
+  purple_signal_connect(purple_connections_get_handle(), "signed-on",
+                        &session, PURPLE_CALLBACK(signed_on_cb), NULL);
+  g_object_connect(G_OBJECT(gtkconvwin->notebook),
+                   "signal_after::switch-page",
+                   G_CALLBACK(switch_page_cb), NULL, NULL);
+
+  /* Each entry is the type, protocol, user name, and conversation name. */
+  for ( i = 0; entries[i] != NULL; i++ ) {
+    fields = g_strsplit(entries[i], "\t", 4);
+    account = g_strv_length(fields) == 4 ?
+              purple_accounts_find(fields[2], fields[1]) : NULL;
+
+    if ( account == NULL ||
+         purple_find_conversation_with_account(atoi(fields[0]), fields[3],
+                                               account) != NULL ) {
+      g_strfreev(fields);
+      continue;
+    }
+
+    /* Name the tab after the buddy when the buddy's alias is known. */
+    buddy = purple_find_buddy(account, fields[3]);
+    title = buddy != NULL ? purple_buddy_get_contact_alias(buddy) : fields[3];
+    escaped = g_markup_escape_text(title, -1);
+
+    /* TRANSLATORS: This is displayed in a tab that was restored from the last
+       session.  The inserted string is the name of the conversation. */
+    markup = g_strdup_printf(_(""
+               "<span size='larger' weight='bold'>%s</span>\n\n"
+               "This conversation will open when its tab is selected."),
+               escaped);
+    g_free(escaped);
+
+    tab = g_new0(PwmSessionTab, 1);
+    tab->type = atoi(fields[0]);
+    tab->protocol = g_strdup(fields[1]);
+    tab->username = g_strdup(fields[2]);
+    tab->name = g_strdup(fields[3]);
+    tab->gtkconv = pwm_placeholder_new(markup);
+    g_free(markup);
+    g_strfreev(fields);
+
+    pwm_placeholder_show(gtkconvwin, tab->gtkconv, title,
+                         PIDGIN_STOCK_STATUS_OFFLINE, TRUE);
+    g_object_set_data(G_OBJECT(tab->gtkconv->tab_cont), "pwm_session_tab",
+                      tab);
+    g_object_connect(G_OBJECT(tab->gtkconv->close), "signal::clicked",
+                     G_CALLBACK(close_clicked_cb), tab, NULL);
+    session.tabs = g_list_append(session.tabs, tab);
+  }
+
+  g_strfreev(entries);
+}
+
+
+/**
+ * Save the conversations of the merged window in the layout state
+ *
+ * This includes placeholders that were never opened, in their tab order.
+ *
+ * @param[in] gtkblist   The merged Buddy List whose tabs are saved
+**/
+void
+pwm_session_save(PidginBuddyList *gtkblist)
+{
+  PurpleConversation *conv;     /*< The conversation of a tab                */
+  PurpleAccount *account;       /*< The account of a conversation            */
+  PidginConversation *gtkconv;  /*< The conversation UI of a tab             */
+  PidginWindow *gtkconvwin;     /*< Conversation window merged into gtkblist */
+  PwmSessionTab *tab;           /*< The placeholder of a tab, if any         */
+  GtkNotebook *notebook;        /*< The merged conversation notebook         */
+  GtkWidget *page;              /*< A page of the notebook                   */
+  GPtrArray *entries;           /*< The conversations being saved            */
+  gint i;                       /*< The index of a page (iteration)          */
+
+  gtkconvwin = pwm_blist_get_convs(gtkblist);
+
+  /* Sanity check: Only save the tabs of a merged window. */
+  if ( gtkconvwin == NULL )
+    return;
+
+  entries = g_ptr_array_new_with_free_func(g_free);
+  notebook = GTK_NOTEBOOK(gtkconvwin->notebook);
+
+  for ( i = 0; i < gtk_notebook_get_n_pages(notebook); i++ ) {
+    page = gtk_notebook_get_nth_page(notebook, i);
+    tab = g_object_get_data(G_OBJECT(page), "pwm_session_tab");
+    gtkconv = g_object_get_data(G_OBJECT(page), "PidginConversation");
+    conv = gtkconv != NULL ? gtkconv->active_conv : NULL;
+
+    if ( tab != NULL )
+      g_ptr_array_add(entries, g_strdup_printf("%d\t%s\t%s\t%s", tab->type,
+                                               tab->protocol, tab->username,
+                                               tab->name));
+    else if ( conv != NULL ) {
+      account = purple_conversation_get_account(conv);
+      g_ptr_array_add(entries, g_strdup_printf("%d\t%s\t%s\t%s",
+                        purple_conversation_get_type(conv),
+                        purple_account_get_protocol_id(account),
+                        purple_account_get_username(account),
+                        purple_conversation_get_name(conv)));
+    }
+  }
+
+  pwm_state_set_strv("session", "tabs",
+                     (const gchar * const *)entries->pdata, entries->len);
+  g_ptr_array_unref(entries);
+}
+
+
+/**
+ * Remove the placeholder tabs, and stop replacing them with conversations
+ *
+ * @param[in] gtkblist   The merged Buddy List displaying the placeholders
+ *
+ * @note This must be called while gtkblist is still merged.
+**/
+void
+pwm_session_clear(PidginBuddyList *gtkblist)
+{
+  PidginWindow *gtkconvwin;     /*< Conversation window merged into gtkblist */
+
+  gtkconvwin = pwm_blist_get_convs(gtkblist);
+
+  /* Sanity check: Only clear the merged Buddy List that has placeholders. */
+  if ( gtkconvwin == NULL || session.gtkblist != gtkblist )
+    return;
+
+  purple_signals_disconnect_by_handle(&session);
+  g_object_disconnect(G_OBJECT(gtkconvwin->notebook), "any_signal",
+                      G_CALLBACK(switch_page_cb), NULL, NULL);
+  gtk_widget_set_sensitive(gtkconvwin->menu.menubar, TRUE);
+
+  while ( session.tabs != NULL )
+    free_tab(session.tabs->data);
+  session.gtkblist = NULL;
+}
@@ -0,0 +1,199 @@
+/**
+ * @file startup.c
+ * Measures how much time the plugin adds to starting Pidgin
+ *
+ * Each phase of the plugin's startup is timed from when the plugin is loaded
+ * until the merged window first becomes idle, i.e. ready for user input.  The
+ * phases are written as a single line to the statistics file along with the
+ * number of buddies and conversations, so startups with different lists can
+ * be compared.  Nothing is measured after that first line is written, and
+ * nothing at all unless the PREF_STARTUP preference was set before loading.
+ *
+ * @section LICENSE
+ * Copyright (C) 2012 David Michael <fedora.dm0@gmail.com>
+ *
+ * This file is part of Window Merge.
+ *
+ * Window Merge is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * Window Merge is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Window Merge.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "plugin.h"
+
+#include <gtkblist.h>
+#include <gtkconv.h>
+
+#include <blist.h>
+#include <conversation.h>
+
+#include "window_merge.h"
+
+
+/**
+ * The state of the startup measurements
+**/
+static struct {
+  GString *report;              /*< The phases measured so far, if measuring */
+  GtkWidget *window;            /*< The Buddy List window being drawn        */
+  gint64 origin;                /*< Monotonic time the plugin was loaded     */
+  guint idle;                   /*< The source ID waiting for an idle window */
+} startup;
+
+
+/**
+ * Start measuring the plugin's startup, unless it was already measured
+**/
+void
+pwm_startup_begin(void)
+{
+  static gboolean measured = FALSE; /*< Whether startup was measured before  */
+
+  /* Sanity check: Only the first load of the plugin is measured. */
+  if ( measured )
+    return;
+  measured = TRUE;
+
+  startup.origin = g_get_monotonic_time();
+  startup.report = g_string_new("startup");
+}
+
+
+/**
+ * Record the duration of a startup phase
+ *
+ * @param[in] phase      The name of the phase in the statistics file
+ * @param[in] start      Monotonic time the phase started, or 0 for the origin
+**/
+void
+pwm_startup_record(const char *phase, gint64 start)
+{
+  /* Sanity check: Only record phases while measuring. */
+  if ( startup.report == NULL )
+    return;
+
+  g_string_append_printf(startup.report, " %s=%" G_GINT64_FORMAT "us", phase,
+                         g_get_monotonic_time() -
+                         (start != 0 ? start : startup.origin));
+}
+
+
+/**
+ * A callback for when the Buddy List window is first drawn
+ *
+ * @param[in] widget     The Buddy List window being drawn
+ * @param[in] event      Unused
+ * @param[in] data       Unused
+ * @return               Whether to stop processing other event handlers
+**/
+static gboolean
+first_frame_cb(GtkWidget *widget, U GdkEventExpose *event, U gpointer data)
+{
+  pwm_startup_record("first_frame", 0);
+
+  g_object_disconnect(G_OBJECT(widget), "any_signal",
+                      G_CALLBACK(first_frame_cb), NULL, NULL);
+  g_object_remove_weak_pointer(G_OBJECT(widget), (gpointer *)&startup.window);
+  startup.window = NULL;
+
+  return FALSE;
+}
+
+
+/**
+ * Record when the given Buddy List window is first drawn
+ *
+ * @param[in] gtkblist   The Buddy List that has not been drawn yet
+**/
+void
+pwm_startup_watch(PidginBuddyList *gtkblist)
+{
+  /* Sanity check: Only watch one undrawn window while measuring. */
+  if ( startup.report == NULL || startup.window != NULL ||
+       gtk_widget_get_mapped(gtkblist->window) )
+    return;
+
+  startup.window = gtkblist->window;
+  g_object_add_weak_pointer(G_OBJECT(startup.window),
+                            (gpointer *)&startup.window);
+  g_object_connect(G_OBJECT(startup.window), "signal-after::expose-event",
+                   G_CALLBACK(first_frame_cb), NULL, NULL);
+}
+
+
+/**
+ * An idle callback to finish measuring when the merged window is ready
+ *
+ * @param[in] data       Unused
+ * @return               Whether to call this function again
+**/
+static gboolean
+interactive_cb(U gpointer data)
+{
+  GSList *buddies;              /*< The buddies in the Buddy List            */
+
+  startup.idle = 0;
+  pwm_startup_record("interactive", 0);
+
+  buddies = purple_blist_get_buddies();
+  g_string_append_printf(startup.report, " buddies=%u convs=%u",
+                         g_slist_length(buddies),
+                         g_list_length(purple_get_conversations()));
+  g_slist_free(buddies);
+
+  pwm_stats_append("%s", startup.report->str);
+  pwm_startup_end();
+
+  return FALSE;
+}
+
+
+/**
+ * Finish measuring once the main loop is idle after the merge
+**/
+void
+pwm_startup_finish(void)
+{
+  /* Sanity check: Only finish measuring once. */
+  if ( startup.report == NULL || startup.idle != 0 )
+    return;
+
+  startup.idle = g_idle_add_full(G_PRIORITY_LOW, interactive_cb, NULL, NULL);
+}
+
+
+/**
+ * Stop measuring the plugin's startup, and free the measurements
+ *
+ * @note This must be called before the plugin is unloaded from memory.
+**/
+void
+pwm_startup_end(void)
+{
+  if ( startup.idle != 0 ) {
+    g_source_remove(startup.idle);
+    startup.idle = 0;
+  }
+
+  if ( startup.window != NULL ) {
+    g_object_disconnect(G_OBJECT(startup.window), "any_signal",
+                        G_CALLBACK(first_frame_cb), NULL, NULL);
+    g_object_remove_weak_pointer(G_OBJECT(startup.window),
+                                 (gpointer *)&startup.window);
+    startup.window = NULL;
+  }
+
+  if ( startup.report != NULL ) {
+    g_string_free(startup.report, TRUE);
+    startup.report = NULL;
+  }
+}
@@ -0,0 +1,403 @@
+/**
+ * @file state.c
+ * Stores the plugin's layout state in its own file instead of prefs.xml
+ *
+ * Layout state such as pane sizes changes every time the user moves the pane
+ * slider.  Storing it in libpurple preferences would rewrite the whole (often
+ * large) prefs.xml on the main thread for each change.  This file keeps the
+ * state in a small key file that is only read once when the plugin loads, and
+ * is written atomically from a worker thread a short time after changes.
+ *
+ * @section LICENSE
+ * Copyright (C) 2012 David Michael <fedora.dm0@gmail.com>
+ *
+ * This file is part of Window Merge.
+ *
+ * Window Merge is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * Window Merge is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Window Merge.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "plugin.h"
+
+#include <gtkblist.h>
+#include <gtkconv.h>
+
+#include <debug.h>
+#include <prefs.h>
+
+#include <gio/gio.h>
+
+#include "window_merge.h"
+
+/** Seconds to wait for more changes before writing the state file */
+#define STATE_SAVE_DELAY 2
+
+
+/**
+ * The contents of a state file being written by a worker thread
+**/
+typedef struct {
+  gchar *path;                  /*< Where the state file is being written    */
+  gchar *contents;              /*< The data being written to the file       */
+  guint generation;             /*< The order in which the save was started  */
+} PwmStateSave;
+
+
+/**
+ * The plugin's layout state, only accessed from the main thread
+**/
+static struct {
+  GKeyFile *keyfile;            /*< The current layout state                 */
+  guint timeout;                /*< The source ID of a scheduled save        */
+  gboolean pending;             /*< Whether changes have not started saving  */
+  gboolean saving;              /*< Whether a worker thread is saving        */
+  guint generation;             /*< The number of saves that were started    */
+  GCancellable *cancel;         /*< Cancels running saves on unload          */
+} state;
+
+
+/**
+ * The newest state that was written, shared with worker threads
+ *
+ * Holding the mutex also serializes writing the state file, so a final save
+ * while unloading can't be overwritten by an older one still in a thread.
+**/
+static struct {
+  GMutex mutex;                 /*< Lock for writing the state file          */
+  guint generation;             /*< The newest save written to the file      */
+} written;
+
+
+/**
+ * Free the data given to a worker thread for saving
+ *
+ * @param[in] data       The save data to free
+**/
+static void
+free_save(gpointer data)
+{
+  PwmStateSave *save;           /*< The save data being freed                */
+
+  save = data;
+  g_free(save->path);
+  g_free(save->contents);
+  g_free(save);
+}
+
+
+/**
+ * Write a state file unless a newer one was already written
+ *
+ * @param[in] save       The file name, contents, and order of the save
+ * @param[out] error     The reason the file couldn't be written
+ * @return               Whether the file was written or was already newer
+**/
+static gboolean
+write_state(PwmStateSave *save, GError **error)
+{
+  gboolean success = TRUE;      /*< Whether the file is up to date           */
+
+  g_mutex_lock(&written.mutex);
+  if ( save->generation > written.generation ) {
+    success = g_file_set_contents(save->path, save->contents, -1, error);
+    if ( success )
+      written.generation = save->generation;
+  }
+  g_mutex_unlock(&written.mutex);
+
+  return success;
+}
+
+
+/**
+ * Write a state file in a worker thread
+ *
+ * @param[in] task       The task running the save
+ * @param[in] source     Unused
+ * @param[in] data       The file name and contents to write
+ * @param[in] cancel     Cancels the save, after the final one was written
+**/
+static void
+save_thread(GTask *task, U gpointer source, gpointer data,
+            GCancellable *cancel)
+{
+  PwmStateSave *save;           /*< The file name and contents to write      */
+  GError *error = NULL;         /*< The reason the file couldn't be written  */
+
+  save = data;
+
+  if ( g_cancellable_is_cancelled(cancel) || write_state(save, &error) )
+    g_task_return_boolean(task, TRUE);
+  else
+    g_task_return_error(task, error);
+}
+
+
+static void start_save(void);
+
+
+/**
+ * A callback for when a worker thread has finished writing the state file
+ *
+ * @param[in] source     Unused
+ * @param[in] result     The result of the save task
+ * @param[in] data       Unused
+ *
+ * @note This can run after the state was unloaded, when the save is cancelled
+ *       and this leaves the state alone.
+**/
+static void
+save_ready_cb(U GObject *source, GAsyncResult *result, U gpointer data)
+{
+  GError *error = NULL;         /*< The reason the file couldn't be written  */
+
+  if ( !g_task_propagate_boolean(G_TASK(result), &error) ) {
+    /* Sanity check: A save cancelled on unload belongs to no loaded state. */
+    if ( g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED) ) {
+      g_error_free(error);
+      return;
+    }
+    purple_debug_error(PLUGIN_TOKEN, "Failed to save layout state: %s\n",
+                       error->message);
+    g_error_free(error);
+  }
+
+  state.saving = FALSE;
+
+  /* Save again if changes were made while this save was running. */
+  if ( state.pending && state.timeout == 0 )
+    start_save();
+}
+
+
+/**
+ * Take a copy of the current state to be written to the state file
+ *
+ * @return               The save data, to be freed with free_save()
+**/
+static PwmStateSave *
+new_save(void)
+{
+  PwmStateSave *save;           /*< The file name and contents to write      */
+
+  save = g_new0(PwmStateSave, 1);
+  save->path = pwm_user_file("-state.ini");
+  save->contents = g_key_file_to_data(state.keyfile, NULL, NULL);
+  save->generation = ++state.generation;
+
+  state.pending = FALSE;
+
+  return save;
+}
+
+
+/**
+ * Hand the current state to a worker thread to write it to the state file
+**/
+static void
+start_save(void)
+{
+  PwmStateSave *save;           /*< The file name and contents to write      */
+  GTask *task;                  /*< The task writing the file                */
+
+  save = new_save();
+  state.saving = TRUE;
+
+  task = g_task_new(NULL, state.cancel, save_ready_cb, NULL);
+  g_task_set_task_data(task, save, free_save);
+  g_task_run_in_thread(task, save_thread);
+  g_object_unref(task);
+}
+
+
+/**
+ * A timeout callback to save the state once changes have settled
+ *
+ * @param[in] data       Unused
+ * @return               Whether to call this function again
+**/
+static gboolean
+save_timeout_cb(U gpointer data)
+{
+  state.timeout = 0;
+
+  /* Only one save runs at a time, and it will start the next one. */
+  if ( !state.saving )
+    start_save();
+
+  return FALSE;
+}
+
+
+/**
+ * Read the plugin's state file, or migrate old preferences to a new one
+ *
+ * @note Remember pwm_state_unload() to make sure all changes are saved.
+**/
+void
+pwm_state_load(void)
+{
+  gchar *path;                  /*< The path of the state file               */
+  gboolean loaded;              /*< Whether an existing state file was read  */
+  gint size;                    /*< A migrated pane size preference          */
+
+  /* Sanity check: Only load the state once. */
+  if ( state.keyfile != NULL )
+    return;
+
+  state.keyfile = g_key_file_new();
+  state.cancel = g_cancellable_new();
+  path = pwm_user_file("-state.ini");
+
+  loaded = g_key_file_load_from_file(state.keyfile, path, 0, NULL);
+  g_free(path);
+
+  /* Sanity check: Only migrate preferences if there was no state file. */
+  if ( loaded )
+    return;
+
+  /* Move the Buddy List sizes from older versions out of prefs.xml. */
+  if ( purple_prefs_exists(PREF_WIDTH) ) {
+    size = purple_prefs_get_int(PREF_WIDTH);
+    pwm_state_set_int("sizes", "left", size);
+    pwm_state_set_int("sizes", "right", size);
+    purple_prefs_remove(PREF_WIDTH);
+  }
+  if ( purple_prefs_exists(PREF_HEIGHT) ) {
+    size = purple_prefs_get_int(PREF_HEIGHT);
+    pwm_state_set_int("sizes", "top", size);
+    pwm_state_set_int("sizes", "bottom", size);
+    purple_prefs_remove(PREF_HEIGHT);
+  }
+}
+
+
+/**
+ * Save any outstanding changes to the state file, and free the state
+ *
+ * The final changes are written directly, since nothing else is waiting.  A
+ * worker thread that is still running owns its own copy of the state, and it
+ * can't replace the final write with older contents.  Its save is cancelled,
+ * so its ready callback doesn't touch the state after it was unloaded.
+**/
+void
+pwm_state_unload(void)
+{
+  PwmStateSave *save;           /*< The final changes to write               */
+
+  /* Sanity check: Only unload state that was loaded. */
+  if ( state.keyfile == NULL )
+    return;
+
+  if ( state.timeout != 0 ) {
+    g_source_remove(state.timeout);
+    state.timeout = 0;
+  }
+
+  /* Write the state here too if a cancelled save might not have written it. */
+  g_cancellable_cancel(state.cancel);
+  if ( state.pending || state.saving ) {
+    save = new_save();
+    write_state(save, NULL);
+    free_save(save);
+  }
+  g_object_unref(state.cancel);
+  state.cancel = NULL;
+  state.saving = FALSE;
+
+  g_key_file_free(state.keyfile);
+  state.keyfile = NULL;
+}
+
+
+/**
+ * Return an integer from the plugin's state
+ *
+ * @param[in] group      The group containing the value
+ * @param[in] key        The name of the value
+ * @param[in] fallback   The value to return if it hasn't been set
+ * @return               The stored value, or fallback
+**/
+gint
+pwm_state_get_int(const char *group, const char *key, gint fallback)
+{
+  GError *error = NULL;         /*< The reason a value couldn't be read      */
+  gint value;                   /*< The value stored in the state            */
+
+  value = g_key_file_get_integer(state.keyfile, group, key, &error);
+  if ( error != NULL ) {
+    g_error_free(error);
+    return fallback;
+  }
+
+  return value;
+}
+
+
+/**
+ * Change an integer in the plugin's state, and schedule saving the change
+ *
+ * @param[in] group      The group containing the value
+ * @param[in] key        The name of the value
+ * @param[in] value      The new value to store
+**/
+void
+pwm_state_set_int(const char *group, const char *key, gint value)
+{
+  /* Sanity check: Don't write the file if nothing has changed. */
+  if ( g_key_file_has_key(state.keyfile, group, key, NULL) &&
+       g_key_file_get_integer(state.keyfile, group, key, NULL) == value )
+    return;
+
+  g_key_file_set_integer(state.keyfile, group, key, value);
+  state.pending = TRUE;
+
+  if ( state.timeout == 0 )
+    state.timeout = g_timeout_add_seconds(STATE_SAVE_DELAY,
+                                          save_timeout_cb, NULL);
+}
+
+
+/**
+ * Return a list of strings from the plugin's state
+ *
+ * @param[in] group      The group containing the list
+ * @param[in] key        The name of the list
+ * @return               A newly allocated NULL-terminated list, or NULL
+**/
+gchar **
+pwm_state_get_strv(const char *group, const char *key)
+{
+  return g_key_file_get_string_list(state.keyfile, group, key, NULL, NULL);
+}
+
+
+/**
+ * Change a list of strings in the plugin's state, and schedule saving it
+ *
+ * @param[in] group      The group containing the list
+ * @param[in] key        The name of the list
+ * @param[in] list       The new strings to store
+ * @param[in] length     The number of strings in list
+**/
+void
+pwm_state_set_strv(const char *group, const char *key,
+                   const gchar * const *list, gsize length)
+{
+  g_key_file_set_string_list(state.keyfile, group, key, list, length);
+  state.pending = TRUE;
+
+  if ( state.timeout == 0 )
+    state.timeout = g_timeout_add_seconds(STATE_SAVE_DELAY,
+                                          save_timeout_cb, NULL);
+}
@@ -0,0 +1,72 @@
+/**
+ * @file stats.c
+ * Collects the plugin's diagnostic measurements in a file for bug reports
+ *
+ * @section LICENSE
+ * Copyright (C) 2012 David Michael <fedora.dm0@gmail.com>
+ *
+ * This file is part of Window Merge.
+ *
+ * Window Merge is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * Window Merge is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Window Merge.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "plugin.h"
+
+#include <gtkblist.h>
+#include <gtkconv.h>
+
+#include <util.h>
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "window_merge.h"
+
+
+/**
+ * Append a timestamped line to the plugin's statistics file
+ *
+ * @param[in] format     A printf-style format string for the line
+ * @param[in] ...        Arguments for the format string
+**/
+void
+pwm_stats_append(const char *format, ...)
+{
+  FILE *file;                   /*< The statistics file opened for appending */
+  gchar *line;                  /*< The formatted line being recorded        */
+  gchar *path;                  /*< The path of the statistics file          */
+  time_t now;                   /*< The current time for the timestamp       */
+  va_list args;                 /*< The arguments to the format string       */
+
+  va_start(args, format);
+  line = g_strdup_vprintf(format, args);
+  va_end(args);
+
+  path = pwm_user_file("-stats.log");
+  file = g_fopen(path, "a");
+  g_free(path);
+
+  /* Give up quietly if the file can't be written, since it's only extra. */
+  if ( file == NULL ) {
+    g_free(line);
+    return;
+  }
+
+  now = time(NULL);
+  fprintf(file, "%s %s\n",
+          purple_utf8_strftime("%Y-%m-%d %H:%M:%S", localtime(&now)), line);
+  fclose(file);
+  g_free(line);
+}
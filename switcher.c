@@ -0,0 +1,574 @@
+/**
+ * @file switcher.c
+ * Jumps straight to any conversation, or to the next one with unread messages
+ *
+ * Reaching a tab in a merged notebook of hundreds of conversations with the
+ * keyboard means stepping through every tab in between, and each step lays
+ * out a conversation and updates the window's menus and title.  The quick
+ * switcher finds a conversation by fuzzy matching its title, name, and
+ * account, and selects it directly.
+ *
+ * Conversations with unread messages are also kept in a queue ordered by how
+ * important their messages are (mentions before text before events) and then
+ * by how long they have waited, so the most urgent one is a key press away.
+ *
+ * @section LICENSE
+ * Copyright (C) 2012 David Michael <fedora.dm0@gmail.com>
+ *
+ * This file is part of Window Merge.
+ *
+ * Window Merge is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * Window Merge is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Window Merge.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "plugin.h"
+
+#include <gtkblist.h>
+#include <gtkconv.h>
+#include <gtkutils.h>
+
+#include <account.h>
+#include <conversation.h>
+#include <signals.h>
+
+#include <gdk/gdkkeysyms.h>
+
+#include "window_merge.h"
+
+/** The most conversations listed by the quick switcher */
+#define SWITCHER_RESULTS 50
+
+
+/**
+ * The quick switcher and the unread queue, only used from the main thread
+**/
+static struct {
+  GList *unread;                /*< Unread conversations, most urgent first  */
+  GtkWidget *window;            /*< The quick switcher, if it was created    */
+  GtkWidget *entry;             /*< The quick switcher's text entry          */
+  GtkWidget *view;              /*< The quick switcher's list of matches     */
+  GtkListStore *matches;        /*< The conversations matching the entry     */
+  gboolean started;             /*< Whether conversations are being tracked  */
+} switcher;
+
+
+/** The columns of the quick switcher's matches */
+enum {
+  MATCH_CONV,                   /*< The matching conversation                */
+  MATCH_SCORE,                  /*< How well the conversation matches        */
+  MATCH_TITLE,                  /*< The title of the conversation            */
+  MATCH_ACCOUNT,                /*< The account of the conversation          */
+  MATCH_COLUMNS
+};
+
+
+/**
+ * Return the folded text that the quick switcher matches for a conversation
+ *
+ * The text is cached on the conversation until its title changes.
+ *
+ * @param[in] conv       The conversation
+ * @return               The title, name, and account of conv, case-folded
+**/
+static const gchar *
+get_key(PurpleConversation *conv)
+{
+  PurpleAccount *account;       /*< The account of conv                      */
+  gchar *key;                   /*< The text matched for conv                */
+  gchar *text;                  /*< The text before folding                  */
+
+  key = purple_conversation_get_data(conv, "pwm_switch_key");
+  if ( key != NULL )
+    return key;
+
+  account = purple_conversation_get_account(conv);
+  text = g_strdup_printf("%s %s %s %s", purple_conversation_get_title(conv),
+                         purple_conversation_get_name(conv),
+                         purple_account_get_username(account),
+                         purple_account_get_protocol_name(account));
+  key = g_utf8_casefold(text, -1);
+  g_free(text);
+  purple_conversation_set_data(conv, "pwm_switch_key", key);
+
+  return key;
+}
+
+
+/**
+ * Forget the cached text that the quick switcher matches for a conversation
+ *
+ * @param[in] conv       The conversation
+**/
+static void
+clear_key(PurpleConversation *conv)
+{
+  g_free(purple_conversation_get_data(conv, "pwm_switch_key"));
+  purple_conversation_set_data(conv, "pwm_switch_key", NULL);
+}
+
+
+/**
+ * Score how well a query matches text, with its characters in order
+ *
+ * Every query character must appear in the text after the previous one.
+ * Matches at the start of words and runs of consecutive characters score
+ * higher, and longer texts score a little lower.
+ *
+ * @param[in] text       The folded text being matched
+ * @param[in] query      The folded query
+ * @return               The score of the match, or -1 if it doesn't match
+**/
+static gint
+fuzzy_score(const gchar *text, const gchar *query)
+{
+  const gchar *last = NULL;     /*< Where the previous character matched     */
+  const gchar *t;               /*< The position in the text                 */
+  gunichar before;              /*< The character before a match             */
+  gunichar q;                   /*< A character of the query                 */
+  gint score = 0;               /*< The score of the match so far            */
+
+  for ( t = text; *query != '\0'; query = g_utf8_next_char(query) ) {
+    q = g_utf8_get_char(query);
+    while ( *t != '\0' && g_utf8_get_char(t) != q )
+      t = g_utf8_next_char(t);
+    if ( *t == '\0' )
+      return -1;
+
+    score += 1;
+    if ( t == text ) {
+      score += 8;
+    } else {
+      before = g_utf8_get_char(g_utf8_prev_char(t));
+      if ( !g_unichar_isalnum(before) )
+        score += 6;
+      if ( last != NULL && g_utf8_next_char(last) == t )
+        score += 4;
+    }
+
+    last = t;
+    t = g_utf8_next_char(t);
+  }
+
+  return score * 16 - (gint)g_utf8_strlen(text, -1);
+}
+
+
+/**
+ * List the conversations matching the quick switcher's entry
+ *
+ * @param[in] entry      The quick switcher's text entry
+ * @param[in] data       Unused
+**/
+static void
+entry_changed_cb(GtkEntry *entry, U gpointer data)
+{
+  PurpleConversation *conv;     /*< A conversation being matched             */
+  PurpleAccount *account;       /*< The account of conv                      */
+  GtkTreeIter row;              /*< The row of a match                       */
+  GList *item;                  /*< A conversation in the list (iteration)   */
+  gchar *query;                 /*< The folded text of the entry             */
+  gchar *label;                 /*< The account text of a match              */
+  gint score;                   /*< How well a conversation matches          */
+
+  /* Detach the model while refilling it, so the view is only updated once,
+     and sort it only after all of the matches have been added. */
+  gtk_tree_view_set_model(GTK_TREE_VIEW(switcher.view), NULL);
+  gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(switcher.matches),
+    GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID, GTK_SORT_DESCENDING);
+  gtk_list_store_clear(switcher.matches);
+  query = g_utf8_casefold(gtk_entry_get_text(entry), -1);
+
+  for ( item = purple_get_conversations(); item != NULL; item = item->next ) {
+    conv = item->data;
+    score = fuzzy_score(get_key(conv), query);
+    if ( score < 0 )
+      continue;
+
+    account = purple_conversation_get_account(conv);
+    label = g_strdup_printf("%s (%s)", purple_account_get_username(account),
+                            purple_account_get_protocol_name(account));
+    gtk_list_store_insert_with_values(switcher.matches, &row, -1,
+      MATCH_CONV, conv,
+      MATCH_SCORE, score,
+      MATCH_TITLE, purple_conversation_get_title(conv),
+      MATCH_ACCOUNT, label,
+      -1);
+    g_free(label);
+  }
+  g_free(query);
+
+  /* Keep only the best matches. */
+  gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(switcher.matches),
+                                       MATCH_SCORE, GTK_SORT_DESCENDING);
+  while ( gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(switcher.matches),
+                                        &row, NULL, SWITCHER_RESULTS) )
+    gtk_list_store_remove(switcher.matches, &row);
+
+  gtk_tree_view_set_model(GTK_TREE_VIEW(switcher.view),
+                          GTK_TREE_MODEL(switcher.matches));
+  if ( gtk_tree_model_get_iter_first(GTK_TREE_MODEL(switcher.matches), &row) )
+    gtk_tree_selection_select_iter(gtk_tree_view_get_selection(
+                                     GTK_TREE_VIEW(switcher.view)), &row);
+}
+
+
+/**
+ * Switch to the conversation of a quick switcher row, and hide the switcher
+ *
+ * @param[in] row        The row of the conversation
+**/
+static void
+switch_to_match(GtkTreeIter *row)
+{
+  PurpleConversation *conv;     /*< The chosen conversation                  */
+
+  gtk_tree_model_get(GTK_TREE_MODEL(switcher.matches), row, MATCH_CONV, &conv,
+                     -1);
+  gtk_widget_hide(switcher.window);
+
+  /* Sanity check: The conversation could have been closed meanwhile. */
+  if ( g_list_find(purple_get_conversations(), conv) != NULL )
+    pidgin_conv_present_conversation(conv);
+}
+
+
+/**
+ * A callback for when a quick switcher row is activated
+ *
+ * @param[in] view       The list of matches
+ * @param[in] path       The path of the activated row
+ * @param[in] column     Unused
+ * @param[in] data       Unused
+**/
+static void
+row_activated_cb(GtkTreeView *view, GtkTreePath *path,
+                 U GtkTreeViewColumn *column, U gpointer data)
+{
+  GtkTreeIter row;              /*< The activated row                        */
+
+  if ( gtk_tree_model_get_iter(gtk_tree_view_get_model(view), &row, path) )
+    switch_to_match(&row);
+}
+
+
+/**
+ * A callback for when Enter is pressed in the quick switcher's entry
+ *
+ * @param[in] entry      Unused
+ * @param[in] data       Unused
+**/
+static void
+entry_activate_cb(U GtkEntry *entry, U gpointer data)
+{
+  GtkTreeSelection *selection;  /*< The selection of the list of matches     */
+  GtkTreeIter row;              /*< The selected row                         */
+
+  selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(switcher.view));
+  if ( gtk_tree_selection_get_selected(selection, NULL, &row) )
+    switch_to_match(&row);
+}
+
+
+/**
+ * A callback for key presses in the quick switcher
+ *
+ * Escape hides the switcher, and the arrow keys move through the matches
+ * while the focus stays in the entry.
+ *
+ * @param[in] widget     The quick switcher window
+ * @param[in] event      The key press event
+ * @param[in] data       Unused
+ * @return               Whether to stop processing other event handlers
+**/
+static gboolean
+key_press_event_cb(GtkWidget *widget, GdkEventKey *event, U gpointer data)
+{
+  GtkTreeSelection *selection;  /*< The selection of the list of matches     */
+  GtkTreeModel *model;          /*< The list of matches                      */
+  GtkTreePath *path;            /*< The path of the selected row             */
+  GtkTreeIter row;              /*< The selected row                         */
+
+  if ( event->keyval == GDK_Escape ) {
+    gtk_widget_hide(widget);
+    return TRUE;
+  }
+
+  if ( event->keyval != GDK_Up && event->keyval != GDK_Down )
+    return FALSE;
+
+  selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(switcher.view));
+  if ( !gtk_tree_selection_get_selected(selection, &model, &row) )
+    return TRUE;
+
+  path = gtk_tree_model_get_path(model, &row);
+  if ( event->keyval == GDK_Up )
+    gtk_tree_path_prev(path);
+  else
+    gtk_tree_path_next(path);
+  if ( gtk_tree_model_get_iter(model, &row, path) ) {
+    gtk_tree_selection_select_iter(selection, &row);
+    gtk_tree_view_scroll_to_cell(GTK_TREE_VIEW(switcher.view), path, NULL,
+                                 FALSE, 0.0, 0.0);
+  }
+  gtk_tree_path_free(path);
+
+  return TRUE;
+}
+
+
+/**
+ * Create the quick switcher window
+**/
+static void
+create_window(void)
+{
+  GtkWidget *scrolled;          /*< Scrolls the list of matches              */
+  GtkWidget *vbox;              /*< Stacks the entry over the matches        */
+
+  switcher.matches = gtk_list_store_new(MATCH_COLUMNS, G_TYPE_POINTER,
+                                        G_TYPE_INT, G_TYPE_STRING,
+                                        G_TYPE_STRING);
+
+  /* TRANSLATORS: This is the title of the window for choosing a conversation
+     to switch to by typing part of its name. */
+  switcher.window = pidgin_create_window(_("Switch to Conversation"),
+                                         PIDGIN_HIG_BORDER, "pwm_switcher",
+                                         TRUE);
+  gtk_window_set_default_size(GTK_WINDOW(switcher.window), 400, 300);
+  g_object_connect(G_OBJECT(switcher.window),
+                   "signal::delete-event",
+                   G_CALLBACK(gtk_widget_hide_on_delete), NULL,
+                   "signal::key-press-event",
+                   G_CALLBACK(key_press_event_cb), NULL,
+                   NULL);
+
+  vbox = gtk_vbox_new(FALSE, PIDGIN_HIG_BOX_SPACE);
+  gtk_container_add(GTK_CONTAINER(switcher.window), vbox);
+
+  switcher.view = gtk_tree_view_new_with_model(
+                    GTK_TREE_MODEL(switcher.matches));
+  g_object_unref(switcher.matches);
+  gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(switcher.view), FALSE);
+  gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(switcher.view),
+    -1, NULL, gtk_cell_renderer_text_new(), "text", MATCH_TITLE, NULL);
+  gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(switcher.view),
+    -1, NULL, gtk_cell_renderer_text_new(), "text", MATCH_ACCOUNT, NULL);
+  g_object_connect(G_OBJECT(switcher.view), "signal::row-activated",
+                   G_CALLBACK(row_activated_cb), NULL, NULL);
+
+  switcher.entry = gtk_entry_new();
+  g_object_connect(G_OBJECT(switcher.entry),
+                   "signal::changed", G_CALLBACK(entry_changed_cb), NULL,
+                   "signal::activate", G_CALLBACK(entry_activate_cb), NULL,
+                   NULL);
+
+  scrolled = gtk_scrolled_window_new(NULL, NULL);
+  gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled),
+                                 GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+  gtk_scrolled_window_set_shadow_type(GTK_SCROLLED_WINDOW(scrolled),
+                                      GTK_SHADOW_IN);
+  gtk_container_add(GTK_CONTAINER(scrolled), switcher.view);
+  gtk_box_pack_start(GTK_BOX(vbox), switcher.entry, FALSE, FALSE, 0);
+  gtk_box_pack_start(GTK_BOX(vbox), scrolled, TRUE, TRUE, 0);
+  gtk_widget_show_all(vbox);
+}
+
+
+/**
+ * Display the quick switcher for choosing a conversation by name
+ *
+ * @param[in] gtkblist   The merged Buddy List opening the switcher
+**/
+void
+pwm_switcher_show(PidginBuddyList *gtkblist)
+{
+  /* Sanity check: Only switch while conversations are being tracked. */
+  if ( !switcher.started )
+    return;
+
+  if ( switcher.window == NULL )
+    create_window();
+
+  gtk_window_set_transient_for(GTK_WINDOW(switcher.window),
+                               GTK_WINDOW(gtkblist->window));
+  gtk_entry_set_text(GTK_ENTRY(switcher.entry), "");
+  entry_changed_cb(GTK_ENTRY(switcher.entry), NULL);
+  gtk_window_present(GTK_WINDOW(switcher.window));
+  gtk_widget_grab_focus(switcher.entry);
+}
+
+
+/**
+ * Compare two unread conversations by urgency, for sorting the queue
+ *
+ * @param[in] a          An unread conversation
+ * @param[in] b          Another unread conversation
+ * @return               Negative if a is more urgent, positive if b is
+**/
+static gint
+compare_unread(gconstpointer a, gconstpointer b)
+{
+  PurpleConversation *conv_a;   /*< The first conversation                   */
+  PurpleConversation *conv_b;   /*< The second conversation                  */
+  gint state_a;                 /*< The unseen state of conv_a               */
+  gint state_b;                 /*< The unseen state of conv_b               */
+
+  conv_a = (PurpleConversation *)a;
+  conv_b = (PurpleConversation *)b;
+  state_a = PIDGIN_CONVERSATION(conv_a)->unseen_state;
+  state_b = PIDGIN_CONVERSATION(conv_b)->unseen_state;
+
+  if ( state_a != state_b )
+    return state_b - state_a;
+
+  return GPOINTER_TO_INT(purple_conversation_get_data(conv_a, "pwm_unread")) -
+         GPOINTER_TO_INT(purple_conversation_get_data(conv_b, "pwm_unread"));
+}
+
+
+/**
+ * Place a conversation in the unread queue, or remove it if it was read
+ *
+ * @param[in] conv       The conversation whose unseen state may have changed
+**/
+static void
+update_unread(PurpleConversation *conv)
+{
+  static gint order = 0;        /*< Orders conversations by when they waited */
+  PidginConversation *gtkconv;  /*< The Pidgin UI of conv                    */
+
+  switcher.unread = g_list_remove(switcher.unread, conv);
+  gtkconv = PIDGIN_CONVERSATION(conv);
+
+  /* Forget when a conversation started waiting once it has been read. */
+  if ( gtkconv == NULL || gtkconv->unseen_state < PIDGIN_UNSEEN_TEXT ) {
+    purple_conversation_set_data(conv, "pwm_unread", NULL);
+    return;
+  }
+
+  if ( purple_conversation_get_data(conv, "pwm_unread") == NULL )
+    purple_conversation_set_data(conv, "pwm_unread",
+                                 GINT_TO_POINTER(++order));
+  switcher.unread = g_list_insert_sorted(switcher.unread, conv,
+                                         compare_unread);
+}
+
+
+/**
+ * Switch to the most urgent conversation with unread messages
+ *
+ * @param[in] gtkblist   The merged Buddy List whose conversations are checked
+**/
+void
+pwm_switcher_next_unread(PidginBuddyList *gtkblist)
+{
+  PidginConversation *gtkconv;  /*< The Pidgin UI of an unread conversation  */
+  GList *item;                  /*< A conversation in the queue (iteration)  */
+
+  for ( item = switcher.unread; item != NULL; item = item->next ) {
+    gtkconv = PIDGIN_CONVERSATION((PurpleConversation *)item->data);
+    if ( pwm_convs_get_blist(pidgin_conv_get_window(gtkconv)) == gtkblist ) {
+      pidgin_conv_window_switch_gtkconv(pidgin_conv_get_window(gtkconv),
+                                        gtkconv);
+      return;
+    }
+  }
+}
+
+
+/**
+ * A callback for when a conversation's title or unseen state changes
+ *
+ * @param[in] conv       The updated conversation
+ * @param[in] type       What was updated
+**/
+static void
+conversation_updated_cb(PurpleConversation *conv, PurpleConvUpdateType type)
+{
+  if ( type == PURPLE_CONV_UPDATE_TITLE )
+    clear_key(conv);
+  else if ( type == PURPLE_CONV_UPDATE_UNSEEN )
+    update_unread(conv);
+}
+
+
+/**
+ * A callback for when a conversation is being closed
+ *
+ * @param[in] conv       The conversation on its way out the door
+**/
+static void
+deleting_conversation_cb(PurpleConversation *conv)
+{
+  switcher.unread = g_list_remove(switcher.unread, conv);
+  clear_key(conv);
+}
+
+
+/**
+ * Start tracking conversations for the quick switcher and the unread queue
+ *
+ * @note Remember pwm_switcher_stop() before the plugin is unloaded.
+**/
+void
+pwm_switcher_start(void)
+{
+  void *conv_handle;            /*< The conversations handle                 */
+  GList *item;                  /*< A conversation in the list (iteration)   */
+
+  /* Sanity check: Don't connect the callbacks twice. */
+  if ( switcher.started )
+    return;
+
+  conv_handle = purple_conversations_get_handle();
+  purple_signal_connect(conv_handle, "conversation-updated", &switcher,
+                        PURPLE_CALLBACK(conversation_updated_cb), NULL);
+  purple_signal_connect(conv_handle, "deleting-conversation", &switcher,
+                        PURPLE_CALLBACK(deleting_conversation_cb), NULL);
+
+  for ( item = purple_get_conversations(); item != NULL; item = item->next )
+    update_unread(item->data);
+
+  switcher.started = TRUE;
+}
+
+
+/**
+ * Stop tracking conversations, and free the quick switcher
+ *
+ * @note This must be called before the plugin is unloaded from memory.
+**/
+void
+pwm_switcher_stop(void)
+{
+  GList *item;                  /*< A conversation in the list (iteration)   */
+
+  if ( !switcher.started )
+    return;
+
+  purple_signals_disconnect_by_handle(&switcher);
+
+  if ( switcher.window != NULL ) {
+    gtk_widget_destroy(switcher.window);
+    switcher.window = NULL;
+  }
+
+  for ( item = purple_get_conversations(); item != NULL; item = item->next ) {
+    clear_key(item->data);
+    purple_conversation_set_data(item->data, "pwm_unread", NULL);
+  }
+  g_list_free(switcher.unread);
+  switcher.unread = NULL;
+
+  switcher.started = FALSE;
+}
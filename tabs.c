@@ -0,0 +1,444 @@
+/**
+ * @file tabs.c
+ * Keeps conversation tabs that are not displayed from being resized
+ *
+ * A GtkNotebook allocates its size to every page, not only the one that is
+ * displayed.  When the window or pane slider is resized, each conversation
+ * history in the merged notebook is rewrapped, so the cost of a resize grows
+ * with the total scrollback of all open conversations.
+ *
+ * The functions in this file hide the contents of every page except the
+ * current one, leaving the (empty) page container to keep its tab displayed.
+ * Hidden widgets are not allocated, so only the displayed conversation is
+ * rewrapped on a resize.  A stale page is shown again when it is selected,
+ * and it is laid out for its new size at that point.
+ *
+ * To keep the first switch to a tab fast, a few pages the user is likely to
+ * select next are warmed up in idle time: the neighbors of the current tab,
+ * tabs with unread messages, and the most recently used tabs.  The number of
+ * warm pages is limited by a preference, and other pages are stashed again.
+ *
+ * @section LICENSE
+ * Copyright (C) 2012 David Michael <fedora.dm0@gmail.com>
+ *
+ * This file is part of Window Merge.
+ *
+ * Window Merge is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * Window Merge is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Window Merge.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "plugin.h"
+
+#include <gtkblist.h>
+#include <gtkconv.h>
+#include <gtkimhtml.h>
+
+#include <conversation.h>
+#include <prefs.h>
+#include <signals.h>
+
+#include "window_merge.h"
+
+
+/**
+ * Hide the contents of a notebook page, marking the page as stale
+ *
+ * @param[in] page       The page container widget of a conversation tab
+**/
+static void
+stash_page(GtkWidget *page)
+{
+  PidginConversation *gtkconv;  /*< The conversation displayed in the page   */
+  GtkAdjustment *adjustment;    /*< The scroll position of the history       */
+  GList *children;              /*< The widgets packed into the page         */
+  GList *child;                 /*< A widget in the list (iteration)         */
+  GList *hidden = NULL;         /*< The widgets that were hidden             */
+
+  /* Sanity check: Only stash conversation pages that aren't already stale. */
+  if ( !GTK_IS_CONTAINER(page) ||
+       g_object_get_data(G_OBJECT(page), "pwm_stale") != NULL )
+    return;
+
+  /* Remember if the history was scrolled to the end, to return there later. */
+  gtkconv = g_object_get_data(G_OBJECT(page), "PidginConversation");
+  if ( gtkconv != NULL && gtkconv->imhtml != NULL ) {
+    adjustment = gtk_text_view_get_vadjustment(GTK_TEXT_VIEW(gtkconv->imhtml));
+    g_object_set_data(G_OBJECT(page), "pwm_at_end", GINT_TO_POINTER(
+                        gtk_adjustment_get_value(adjustment) >=
+                        gtk_adjustment_get_upper(adjustment) -
+                        gtk_adjustment_get_page_size(adjustment)));
+  }
+
+  children = gtk_container_get_children(GTK_CONTAINER(page));
+  for ( child = children; child != NULL; child = child->next )
+    if ( gtk_widget_get_visible(GTK_WIDGET(child->data)) ) {
+      gtk_widget_hide(GTK_WIDGET(child->data));
+      hidden = g_list_prepend(hidden, child->data);
+    }
+  g_list_free(children);
+
+  /* Pages without visible contents are left alone. */
+  if ( hidden != NULL )
+    g_object_set_data_full(G_OBJECT(page), "pwm_stale", hidden,
+                           (GDestroyNotify)g_list_free);
+}
+
+
+/**
+ * Show the contents of a stale notebook page again
+ *
+ * @param[in] page       The page container widget of a conversation tab
+**/
+void
+pwm_refresh_tab(GtkWidget *page)
+{
+  PidginConversation *gtkconv;  /*< The conversation displayed in the page   */
+  GList *hidden;                /*< The widgets that were hidden             */
+  GList *child;                 /*< A widget in the list (iteration)         */
+
+  hidden = g_object_steal_data(G_OBJECT(page), "pwm_stale");
+
+  /* Sanity check: Only stale pages need to be refreshed. */
+  if ( hidden == NULL )
+    return;
+
+  for ( child = hidden; child != NULL; child = child->next )
+    gtk_widget_show(GTK_WIDGET(child->data));
+  g_list_free(hidden);
+
+  /* Follow new messages that arrived while the history was hidden. */
+  gtkconv = g_object_get_data(G_OBJECT(page), "PidginConversation");
+  if ( gtkconv != NULL && gtkconv->imhtml != NULL &&
+       g_object_get_data(G_OBJECT(page), "pwm_at_end") != NULL )
+    gtk_imhtml_scroll_to_end(GTK_IMHTML(gtkconv->imhtml), FALSE);
+}
+
+
+/**
+ * Add a page to a list of pages to warm up, unless it is already listed
+ *
+ * @param[in] pages      The list of pages to warm up
+ * @param[in] page       The page being added, or NULL
+ * @param[in] current    The page that is currently displayed
+ * @return               The new start of the list
+**/
+static GList *
+add_candidate(GList *pages, GtkWidget *page, GtkWidget *current)
+{
+  if ( page == NULL || page == current || g_list_find(pages, page) != NULL )
+    return pages;
+
+  return g_list_append(pages, page);
+}
+
+
+/**
+ * Return the pages most likely to be selected next, in order of likelihood
+ *
+ * @param[in] notebook   The merged conversation notebook
+ * @param[in] budget     The largest number of pages to return
+ * @return               A newly allocated list of the pages
+**/
+static GList *
+get_candidates(GtkNotebook *notebook, gint budget)
+{
+  PidginConversation *gtkconv;  /*< The conversation displayed in a page     */
+  GtkWidget *current;           /*< The page that is currently displayed     */
+  GtkWidget *page;              /*< A page of the notebook                   */
+  GList *pages = NULL;          /*< The list of pages being built            */
+  GList *item;                  /*< A recently used page (iteration)         */
+  gint count;                   /*< The number of pages in the notebook      */
+  gint index;                   /*< The index of the current page            */
+  gint i;                       /*< The index of a page (iteration)          */
+
+  count = gtk_notebook_get_n_pages(notebook);
+  index = gtk_notebook_get_current_page(notebook);
+  current = gtk_notebook_get_nth_page(notebook, index);
+
+  /* Sanity check: There is nothing to warm without a current page. */
+  if ( current == NULL || budget <= 0 )
+    return NULL;
+
+  /* Ctrl+Tab and Ctrl+Shift+Tab wrap around to the ends of the notebook. */
+  pages = add_candidate(pages, gtk_notebook_get_nth_page(notebook,
+                                 (index + 1) % count), current);
+  pages = add_candidate(pages, gtk_notebook_get_nth_page(notebook,
+                                 (index + count - 1) % count), current);
+
+  /* Tabs with new messages are usually read next. */
+  for ( i = 0; i < count; i++ ) {
+    page = gtk_notebook_get_nth_page(notebook, i);
+    gtkconv = g_object_get_data(G_OBJECT(page), "PidginConversation");
+    if ( gtkconv != NULL && gtkconv->unseen_state >= PIDGIN_UNSEEN_TEXT )
+      pages = add_candidate(pages, page, current);
+  }
+
+  /* Fill the rest of the budget with the most recently used tabs. */
+  item = g_object_get_data(G_OBJECT(notebook), "pwm_recent");
+  for ( ; item != NULL; item = item->next )
+    pages = add_candidate(pages, item->data, current);
+
+  /* Drop the least likely pages that exceed the budget. */
+  while ( (gint)g_list_length(pages) > budget )
+    pages = g_list_delete_link(pages, g_list_last(pages));
+
+  return pages;
+}
+
+
+/**
+ * An idle callback to warm up one of the pages likely to be selected next
+ *
+ * Only one page is warmed up per call, so the main loop can handle input
+ * between pages.  Warm pages that are no longer likely are stashed again.
+ *
+ * @param[in] data       Pointer to the merged conversation notebook
+ * @return               Whether to call this function again
+**/
+static gboolean
+warm_idle_cb(gpointer data)
+{
+  PidginConversation *gtkconv;  /*< The conversation displayed in a page     */
+  GtkNotebook *notebook;        /*< The merged conversation notebook         */
+  GtkWidget *current;           /*< The page that is currently displayed     */
+  GtkWidget *page;              /*< A page of the notebook                   */
+  GList *pages;                 /*< The pages likely to be selected next     */
+  GList *item;                  /*< A likely page in the list (iteration)    */
+  gboolean more = FALSE;        /*< Whether stale pages remain to be warmed  */
+  gint i;                       /*< The index of a page (iteration)          */
+
+  notebook = data;
+  current = gtk_notebook_get_nth_page(notebook,
+                                      gtk_notebook_get_current_page(notebook));
+  pages = get_candidates(notebook, purple_prefs_get_int(PREF_WARM));
+
+  /* Stash the pages that are outside the budget. */
+  for ( i = 0; i < gtk_notebook_get_n_pages(notebook); i++ ) {
+    page = gtk_notebook_get_nth_page(notebook, i);
+    if ( page != current && g_list_find(pages, page) == NULL )
+      stash_page(page);
+  }
+
+  /* Lay out and realize the most likely page that is still stale. */
+  for ( item = pages; item != NULL; item = item->next )
+    if ( g_object_get_data(G_OBJECT(item->data), "pwm_stale") != NULL ) {
+      pwm_refresh_tab(item->data);
+      gtkconv = g_object_get_data(G_OBJECT(item->data), "PidginConversation");
+      if ( gtkconv != NULL && gtkconv->imhtml != NULL )
+        gtk_widget_realize(gtkconv->imhtml);
+      more = item->next != NULL;
+      break;
+    }
+  g_list_free(pages);
+
+  if ( !more )
+    g_object_set_data(G_OBJECT(notebook), "pwm_warm_idle", NULL);
+
+  return more;
+}
+
+
+/**
+ * Schedule warming up the pages likely to be selected next
+ *
+ * @param[in] notebook   The merged conversation notebook
+**/
+static void
+schedule_warm(GtkNotebook *notebook)
+{
+  guint source;                 /*< The idle source ID warming the pages     */
+
+  if ( g_object_get_data(G_OBJECT(notebook), "pwm_warm_idle") != NULL )
+    return;
+
+  source = g_idle_add_full(G_PRIORITY_LOW, warm_idle_cb, notebook, NULL);
+  g_object_set_data(G_OBJECT(notebook), "pwm_warm_idle",
+                    GUINT_TO_POINTER(source));
+}
+
+
+/**
+ * A callback for when a notebook is about to display a different page
+ *
+ * This runs before the notebook and Pidgin switch pages, so the new page is
+ * laid out before Pidgin focuses its widgets.  The page that was displayed is
+ * left to the idle warm-up to keep or stash.
+ *
+ * @param[in] notebook   The merged conversation notebook
+ * @param[in] page       Unused
+ * @param[in] page_num   The index of the page being displayed
+ * @param[in] data       Unused
+**/
+static void
+switch_page_cb(GtkNotebook *notebook, U gpointer page, guint page_num,
+               U gpointer data)
+{
+  GtkWidget *child;             /*< The page being displayed                 */
+  GList *recent;                /*< The pages in most recently used order    */
+
+  child = gtk_notebook_get_nth_page(notebook, page_num);
+  pwm_refresh_tab(child);
+
+  /* Move the page to the front of the recently used pages. */
+  recent = g_object_steal_data(G_OBJECT(notebook), "pwm_recent");
+  recent = g_list_prepend(g_list_remove(recent, child), child);
+  g_object_set_data_full(G_OBJECT(notebook), "pwm_recent", recent,
+                         (GDestroyNotify)g_list_free);
+
+  schedule_warm(notebook);
+}
+
+
+/**
+ * A callback for when a page is added to a notebook
+ *
+ * @param[in] notebook   The merged conversation notebook
+ * @param[in] child      The page that was added
+ * @param[in] page_num   The index of the new page
+ * @param[in] data       Unused
+**/
+static void
+page_added_cb(GtkNotebook *notebook, GtkWidget *child, guint page_num,
+              U gpointer data)
+{
+  if ( (gint)page_num != gtk_notebook_get_current_page(notebook) )
+    stash_page(child);
+  schedule_warm(notebook);
+}
+
+
+/**
+ * A callback for when a page is removed from a notebook
+ *
+ * Pages leaving the merged notebook are refreshed, since other windows don't
+ * know that they are stale.
+ *
+ * @param[in] notebook   The merged conversation notebook
+ * @param[in] child      The page that was removed
+ * @param[in] page_num   Unused
+ * @param[in] data       Unused
+**/
+static void
+page_removed_cb(GtkNotebook *notebook, GtkWidget *child, U guint page_num,
+                U gpointer data)
+{
+  GList *recent;                /*< The pages in most recently used order    */
+
+  pwm_refresh_tab(child);
+
+  recent = g_object_steal_data(G_OBJECT(notebook), "pwm_recent");
+  recent = g_list_remove(recent, child);
+  g_object_set_data_full(G_OBJECT(notebook), "pwm_recent", recent,
+                         (GDestroyNotify)g_list_free);
+}
+
+
+/**
+ * A callback for when a conversation's unread state may have changed
+ *
+ * @param[in] conv       The conversation that was updated
+ * @param[in] type       The kind of update
+ * @param[in] data       Pointer to the merged conversation notebook
+**/
+static void
+conversation_updated_cb(PurpleConversation *conv, PurpleConvUpdateType type,
+                        gpointer data)
+{
+  PidginConversation *gtkconv;  /*< The Pidgin conversation of conv          */
+
+  gtkconv = PIDGIN_CONVERSATION(conv);
+
+  if ( type == PURPLE_CONV_UPDATE_UNSEEN && gtkconv != NULL &&
+       gtkconv->win != NULL && gtkconv->win->notebook == data )
+    schedule_warm(GTK_NOTEBOOK(data));
+}
+
+
+/**
+ * Start hiding the pages of the merged notebook that are not displayed
+ *
+ * @param[in] gtkblist   The Buddy List whose conversation tabs are managed
+ *
+ * @note Remember pwm_free_lazy_tabs() before the notebook leaves the window.
+**/
+void
+pwm_init_lazy_tabs(PidginBuddyList *gtkblist)
+{
+  PidginWindow *gtkconvwin;     /*< Conversation window merged into gtkblist */
+  GtkNotebook *notebook;        /*< The merged conversation notebook         */
+  gint current;                 /*< The index of the displayed page          */
+  gint i;                       /*< The index of a page (iteration)          */
+
+  gtkconvwin = pwm_blist_get_convs(gtkblist);
+
+  /* Sanity check: Only act on a merged Buddy List window. */
+  if ( gtkconvwin == NULL )
+    return;
+
+  notebook = GTK_NOTEBOOK(gtkconvwin->notebook);
+  current = gtk_notebook_get_current_page(notebook);
+  for ( i = 0; i < gtk_notebook_get_n_pages(notebook); i++ )
+    if ( i != current )
+      stash_page(gtk_notebook_get_nth_page(notebook, i));
+
+  g_object_connect(G_OBJECT(notebook),
+                   "signal::switch-page", G_CALLBACK(switch_page_cb), NULL,
+                   "signal::page-added", G_CALLBACK(page_added_cb), NULL,
+                   "signal::page-removed", G_CALLBACK(page_removed_cb), NULL,
+                   NULL);
+  purple_signal_connect(purple_conversations_get_handle(),
+                        "conversation-updated", notebook,
+                        PURPLE_CALLBACK(conversation_updated_cb), notebook);
+  schedule_warm(notebook);
+}
+
+
+/**
+ * Stop hiding pages of the merged notebook, and refresh every stale page
+ *
+ * @param[in] gtkblist   The Buddy List whose conversation tabs are managed
+**/
+void
+pwm_free_lazy_tabs(PidginBuddyList *gtkblist)
+{
+  PidginWindow *gtkconvwin;     /*< Conversation window merged into gtkblist */
+  GtkNotebook *notebook;        /*< The merged conversation notebook         */
+  guint source;                 /*< The idle source ID warming the pages     */
+  gint i;                       /*< The index of a page (iteration)          */
+
+  gtkconvwin = pwm_blist_get_convs(gtkblist);
+
+  /* Sanity check: Only act on a merged Buddy List window. */
+  if ( gtkconvwin == NULL )
+    return;
+
+  notebook = GTK_NOTEBOOK(gtkconvwin->notebook);
+  g_object_disconnect(G_OBJECT(notebook), "any_signal",
+                      G_CALLBACK(switch_page_cb), NULL,
+                      "any_signal", G_CALLBACK(page_added_cb), NULL,
+                      "any_signal", G_CALLBACK(page_removed_cb), NULL,
+                      NULL);
+  purple_signal_disconnect(purple_conversations_get_handle(),
+                           "conversation-updated", notebook,
+                           PURPLE_CALLBACK(conversation_updated_cb));
+
+  /* Stop warming pages, and forget the recently used pages. */
+  source = GPOINTER_TO_UINT(g_object_steal_data(G_OBJECT(notebook),
+                                                "pwm_warm_idle"));
+  if ( source != 0 )
+    g_source_remove(source);
+  g_object_set_data(G_OBJECT(notebook), "pwm_recent", NULL);
+
+  for ( i = 0; i < gtk_notebook_get_n_pages(notebook); i++ )
+    pwm_refresh_tab(gtk_notebook_get_nth_page(notebook, i));
+}
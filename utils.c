@@ -24,6 +24,9 @@
 #include "plugin.h"
 #include <gtkblist.h>
 #include <gtkconv.h>
+#include <util.h>
+
+#include "probes.h"
 
 
 /**
@@ -57,6 +60,33 @@ pwm_convs_get_blist(PidginWindow *gtkconvwin)
   return g_object_get_data(G_OBJECT(gtkconvwin->notebook), "pwm_blist");
 }
 
+
+/**
+ * Count the real conversations in a window, skipping any placeholder tabs
+ *
+ * Placeholders such as the dummy tab and restored session tabs are kept in the
+ * window's list of conversations like real ones, so Pidgin doesn't destroy a
+ * window that only displays placeholders.  They have no Purple conversation.
+ *
+ * @param[in] gtkconvwin The conversation window to count
+ * @return               The number of real conversations in gtkconvwin
+**/
+guint
+pwm_count_real_convs(PidginWindow *gtkconvwin)
+{
+  GList *item;                  /*< A conversation in the list (iteration)   */
+  guint count = 0;              /*< The number of real conversations         */
+
+  if ( gtkconvwin == NULL )
+    return 0;
+
+  for ( item = gtkconvwin->gtkconvs; item != NULL; item = item->next )
+    if ( ((PidginConversation *)item->data)->active_conv != NULL )
+      count++;
+
+  return count;
+}
+
 
 /**
  * Given a parented widget, replace it and reparent it into a new container
@@ -84,6 +114,8 @@ pwm_widget_replace(GtkWidget *child, GtkWidget *swap, GtkWidget *new_parent)
   if ( child == NULL || swap == NULL )
     return;
 
+  PWM_PROBE3(replace__entry, child, swap, new_parent);
+
   parent = gtk_widget_get_parent(child);
   should_unparent = GTK_IS_CONTAINER(gtk_widget_get_parent(swap));
 
@@ -141,4 +173,135 @@ pwm_widget_replace(GtkWidget *child, GtkWidget *swap, GtkWidget *new_parent)
   /* Remove the replacement's temporary reference that avoided destruction. */
   if ( should_unparent )
     g_object_unref(G_OBJECT(swap));
+
+  PWM_PROBE3(replace__return, child, swap, new_parent);
+}
+
+
+/**
+ * Save the packing properties of a widget in its parent container
+ *
+ * @param[in] child      The widget whose properties are saved
+ * @param[out] count     The number of properties saved
+ * @return               A newly allocated array of property values
+**/
+static GValue *
+get_child_properties(GtkWidget *child, guint *count)
+{
+  GtkWidget *parent;            /*< The container of the widget              */
+  GParamSpec **specs;           /*< The child properties of the container    */
+  GValue *values;               /*< The saved property values                */
+  guint i;                      /*< The property number (iteration)          */
+
+  parent = gtk_widget_get_parent(child);
+  specs = gtk_container_class_list_child_properties(
+            G_OBJECT_GET_CLASS(parent), count);
+  values = g_new0(GValue, *count);
+
+  for ( i = 0; i < *count; i++ ) {
+    g_value_init(&values[i], specs[i]->value_type);
+    gtk_container_child_get_property(GTK_CONTAINER(parent), child,
+                                     specs[i]->name, &values[i]);
+  }
+  g_free(specs);
+
+  return values;
+}
+
+
+/**
+ * Restore packing properties saved from another widget in the same container
+ *
+ * @param[in] child      The widget receiving the properties
+ * @param[in] values     The saved property values, which are freed
+ * @param[in] count      The number of properties saved
+**/
+static void
+set_child_properties(GtkWidget *child, GValue *values, guint count)
+{
+  GtkWidget *parent;            /*< The container of the widget              */
+  GParamSpec **specs;           /*< The child properties of the container    */
+  guint i;                      /*< The property number (iteration)          */
+
+  parent = gtk_widget_get_parent(child);
+  specs = gtk_container_class_list_child_properties(
+            G_OBJECT_GET_CLASS(parent), NULL);
+
+  for ( i = 0; i < count; i++ ) {
+    gtk_container_child_set_property(GTK_CONTAINER(parent), child,
+                                     specs[i]->name, &values[i]);
+    g_value_unset(&values[i]);
+  }
+  g_free(specs);
+  g_free(values);
+}
+
+
+/**
+ * Exchange the places of two parented widgets, keeping the first realized
+ *
+ * Unlike pwm_widget_replace(), neither widget is destroyed, and the first is
+ * moved with gtk_widget_reparent().  When its new parent is already realized,
+ * its windows are simply moved instead of being destroyed and recreated, so
+ * the cost of the move doesn't grow with the size of the widget.
+ *
+ * @param[in] widget     The widget being moved to the other's place
+ * @param[in] spot       The widget marking where the first is being moved
+ *
+ * @note Both parents must be containers that add a child to the free slot
+ *       left by a removed child, such as GtkPaned or GtkBox.
+**/
+void
+pwm_widget_swap(GtkWidget *widget, GtkWidget *spot)
+{
+  GtkWidget *widget_parent;     /*< The original parent of widget            */
+  GtkWidget *spot_parent;       /*< The original parent of spot              */
+  GValue *widget_values;        /*< The packing properties of widget         */
+  GValue *spot_values;          /*< The packing properties of spot           */
+  guint widget_count;           /*< The number of properties of widget       */
+  guint spot_count;             /*< The number of properties of spot         */
+
+  widget_parent = gtk_widget_get_parent(widget);
+  spot_parent = gtk_widget_get_parent(spot);
+
+  /* Sanity check: Both widgets must be in place to swap them. */
+  if ( widget_parent == NULL || spot_parent == NULL )
+    return;
+
+  widget_values = get_child_properties(widget, &widget_count);
+  spot_values = get_child_properties(spot, &spot_count);
+
+  /* Free the spot's slot, and move the widget into it without unrealizing. */
+  g_object_ref(G_OBJECT(spot));
+  gtk_container_remove(GTK_CONTAINER(spot_parent), spot);
+  gtk_widget_reparent(widget, spot_parent);
+  set_child_properties(widget, spot_values, spot_count);
+
+  /* Put the spot in the slot the widget left behind. */
+  gtk_container_add(GTK_CONTAINER(widget_parent), spot);
+  set_child_properties(spot, widget_values, widget_count);
+  g_object_unref(G_OBJECT(spot));
+}
+
+
+/**
+ * Return the path of a file in the user's configuration directory
+ *
+ * Every file written by the plugin is named after the plugin, so it can be
+ * easily identified among the other files stored by libpurple.
+ *
+ * @param[in] suffix     The distinguishing end of the file name
+ * @return               A newly allocated path to the file
+**/
+gchar *
+pwm_user_file(const char *suffix)
+{
+  gchar *name;                  /*< The base name of the file                */
+  gchar *path;                  /*< The full path to the file                */
+
+  name = g_strconcat(PLUGIN_TOKEN, suffix, NULL);
+  path = g_build_filename(purple_user_dir(), name, NULL);
+  g_free(name);
+
+  return path;
 }
@@ -0,0 +1,227 @@
+/**
+ * @file watchdog.c
+ * Watches for main loop stalls and blames the plugin code that caused them
+ *
+ * A heartbeat source in the GLib main loop records the time of each beat, and
+ * a separate thread checks that the beats keep arriving.  When they stop for
+ * longer than the configured threshold, the thread takes a snapshot of the
+ * plugin functions that were running at the time.  The stall is reported from
+ * the main loop once it recovers, since libpurple is not thread-safe.
+ *
+ * Plugin functions mark themselves with pwm_watchdog_enter() and
+ * pwm_watchdog_leave() so they can be identified in stall reports.  A stall
+ * with no plugin functions running was caused by something else.
+ *
+ * @section LICENSE
+ * Copyright (C) 2012 David Michael <fedora.dm0@gmail.com>
+ *
+ * This file is part of Window Merge.
+ *
+ * Window Merge is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * Window Merge is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Window Merge.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "plugin.h"
+
+#include <gtkblist.h>
+#include <gtkconv.h>
+
+#include <debug.h>
+
+#include "window_merge.h"
+
+/** The number of nested plugin functions that can be named in a report */
+#define WATCHDOG_DEPTH 8
+
+
+/**
+ * The state shared between the main loop and the watchdog thread
+ *
+ * Everything except the thread and source handles and the running flag is
+ * protected by the mutex.  The running flag is only accessed atomically, since
+ * it is checked before taking the lock on every plugin function call.
+**/
+static struct {
+  GMutex mutex;                 /*< Lock for sharing with the watchdog       */
+  GCond wake;                   /*< Condition to interrupt the watchdog      */
+  GThread *thread;              /*< The watchdog thread, when it is running  */
+  guint source;                 /*< The main loop heartbeat source ID        */
+  gint running;                 /*< Whether the watchdog should keep going   */
+  gint64 threshold;             /*< Microseconds without a beat to complain  */
+  gint64 heartbeat;             /*< Monotonic time of the last heartbeat     */
+  gint64 stall_start;           /*< Start of the current stall, or zero      */
+  gchar *stall_stack;           /*< Plugin functions running in the stall    */
+  const char *stack[WATCHDOG_DEPTH]; /*< Names of running plugin functions   */
+  gint depth;                   /*< Number of running plugin functions       */
+} watchdog;
+
+
+/**
+ * The watchdog thread's main function
+ *
+ * @param[in] data       Unused
+ * @return               Unused
+**/
+static gpointer
+watchdog_thread(U gpointer data)
+{
+  const char *names[WATCHDOG_DEPTH + 1]; /*< Stack names, NULL-terminated    */
+  gint64 now;                   /*< The current monotonic time               */
+  gint i;                       /*< Index into the stack (iteration)         */
+
+  g_mutex_lock(&watchdog.mutex);
+  while ( g_atomic_int_get(&watchdog.running) ) {
+    g_cond_wait_until(&watchdog.wake, &watchdog.mutex,
+                      g_get_monotonic_time() + watchdog.threshold / 2);
+    now = g_get_monotonic_time();
+
+    /* Only the first check in a stall takes a snapshot of the stack. */
+    if ( !g_atomic_int_get(&watchdog.running) || watchdog.stall_start != 0 ||
+         now - watchdog.heartbeat < watchdog.threshold )
+      continue;
+
+    for ( i = 0; i < MIN(watchdog.depth, WATCHDOG_DEPTH); i++ )
+      names[i] = watchdog.stack[i];
+    names[i] = NULL;
+
+    watchdog.stall_start = watchdog.heartbeat;
+    watchdog.stall_stack = i > 0 ? g_strjoinv(" > ", (gchar **)names) :
+                                   g_strdup("(no plugin code)");
+  }
+  g_mutex_unlock(&watchdog.mutex);
+
+  return NULL;
+}
+
+
+/**
+ * A main loop callback to beat the heart and report stalls that have ended
+ *
+ * @param[in] data       Unused
+ * @return               Whether to continue beating
+**/
+static gboolean
+heartbeat_cb(U gpointer data)
+{
+  gchar *stack;                 /*< Plugin functions running in a stall      */
+  gint64 start;                 /*< The start of a stall that was detected   */
+  gint64 now;                   /*< The current monotonic time               */
+
+  g_mutex_lock(&watchdog.mutex);
+  now = g_get_monotonic_time();
+  watchdog.heartbeat = now;
+  start = watchdog.stall_start;
+  stack = watchdog.stall_stack;
+  watchdog.stall_start = 0;
+  watchdog.stall_stack = NULL;
+  g_mutex_unlock(&watchdog.mutex);
+
+  /* Report a stall that was detected since the last beat. */
+  if ( stack != NULL ) {
+    purple_debug_warning(PLUGIN_TOKEN,
+                         "The main loop stalled for %" G_GINT64_FORMAT
+                         " ms in: %s\n", (now - start) / 1000, stack);
+    pwm_stats_append("stall %" G_GINT64_FORMAT " ms in %s",
+                     (now - start) / 1000, stack);
+    g_free(stack);
+  }
+
+  return TRUE;
+}
+
+
+/**
+ * Start watching the main loop for stalls
+ *
+ * @param[in] threshold  Milliseconds without an iteration to count as a stall
+ *
+ * @note Nothing is started if threshold is not positive.
+**/
+void
+pwm_watchdog_start(gint threshold)
+{
+  /* Sanity check: The watchdog can't be started twice. */
+  if ( threshold <= 0 || watchdog.thread != NULL )
+    return;
+
+  watchdog.threshold = (gint64)threshold * 1000;
+  watchdog.heartbeat = g_get_monotonic_time();
+  watchdog.depth = 0;
+  g_atomic_int_set(&watchdog.running, TRUE);
+
+  /* Beat several times per threshold so a stall is detected reliably. */
+  watchdog.source = g_timeout_add(MAX(threshold / 4, 10), heartbeat_cb, NULL);
+  watchdog.thread = g_thread_new(PLUGIN_TOKEN "-watchdog",
+                                 watchdog_thread, NULL);
+}
+
+
+/**
+ * Stop watching the main loop, and wait for the watchdog thread to finish
+**/
+void
+pwm_watchdog_stop(void)
+{
+  /* Sanity check: Only stop a running watchdog. */
+  if ( watchdog.thread == NULL )
+    return;
+
+  g_mutex_lock(&watchdog.mutex);
+  g_atomic_int_set(&watchdog.running, FALSE);
+  g_cond_signal(&watchdog.wake);
+  g_mutex_unlock(&watchdog.mutex);
+
+  g_thread_join(watchdog.thread);
+  watchdog.thread = NULL;
+  g_source_remove(watchdog.source);
+  watchdog.source = 0;
+
+  g_free(watchdog.stall_stack);
+  watchdog.stall_stack = NULL;
+  watchdog.stall_start = 0;
+}
+
+
+/**
+ * Mark the start of a plugin function that could be blamed for a stall
+ *
+ * @param[in] name       The static name of the function, i.e. G_STRFUNC
+**/
+void
+pwm_watchdog_enter(const char *name)
+{
+  if ( !g_atomic_int_get(&watchdog.running) )
+    return;
+
+  g_mutex_lock(&watchdog.mutex);
+  if ( watchdog.depth < WATCHDOG_DEPTH )
+    watchdog.stack[watchdog.depth] = name;
+  watchdog.depth++;
+  g_mutex_unlock(&watchdog.mutex);
+}
+
+
+/**
+ * Mark the end of the plugin function most recently given to the watchdog
+**/
+void
+pwm_watchdog_leave(void)
+{
+  if ( !g_atomic_int_get(&watchdog.running) )
+    return;
+
+  g_mutex_lock(&watchdog.mutex);
+  if ( watchdog.depth > 0 )
+    watchdog.depth--;
+  g_mutex_unlock(&watchdog.mutex);
+}
@@ -26,20 +26,108 @@
 
 /* Functions for Merged Windows */
 void pwm_merge_conversation(PidginBuddyList *);
+void pwm_defer_merge_conversation(PidginBuddyList *);
 void pwm_split_conversation(PidginBuddyList *);
 void pwm_create_paned_layout(PidginBuddyList *, const char *);
 void pwm_set_conv_menus_visible(PidginBuddyList *, gboolean);
+void pwm_attach_all_conversations(PidginBuddyList *);
+void pwm_detach_all_conversations(PidginBuddyList *);
+void pwm_set_notebook_detached(PidginBuddyList *, gboolean);
+void pwm_sync_after_drag(PidginBuddyList *);
+void pwm_update_idle_layout(PidginBuddyList *);
 
 /* Dummy Conversation Functions */
 void pwm_init_dummy_conversation(PidginBuddyList *);
 void pwm_show_dummy_conversation(PidginBuddyList *);
 void pwm_hide_dummy_conversation(PidginBuddyList *);
 void pwm_free_dummy_conversation(PidginBuddyList *);
+PidginConversation *pwm_placeholder_new(const char *);
+void pwm_placeholder_show(PidginWindow *, PidginConversation *, const char *,
+                          const char *, gboolean);
+void pwm_placeholder_hide(PidginConversation *);
+void pwm_placeholder_free(PidginConversation *);
+
+/* Session Functions */
+void pwm_session_restore(PidginBuddyList *);
+void pwm_session_save(PidginBuddyList *);
+void pwm_session_clear(PidginBuddyList *);
+
+/* Buddy List Tree Functions */
+void pwm_set_blist_fixed_rows(PidginBuddyList *, gboolean);
+void pwm_update_blist_fixed_rows(PidginBuddyList *);
+void pwm_init_blist_rows(PidginBuddyList *);
+void pwm_free_blist_rows(PidginBuddyList *);
+void pwm_set_blist_collapsed(PidginBuddyList *, gboolean);
+
+/* Lazy Tab Functions */
+void pwm_init_lazy_tabs(PidginBuddyList *);
+void pwm_free_lazy_tabs(PidginBuddyList *);
+void pwm_refresh_tab(GtkWidget *);
+
+/* History Functions */
+void pwm_preload_history(PidginConversation *);
+void pwm_history_stop(void);
+
+/* Search Functions */
+void pwm_search_start(void);
+void pwm_search_stop(void);
+void pwm_search_show(PidginBuddyList *);
+
+/* Quick Switcher Functions */
+void pwm_switcher_start(void);
+void pwm_switcher_stop(void);
+void pwm_switcher_show(PidginBuddyList *);
+void pwm_switcher_next_unread(PidginBuddyList *);
+
+/* Message Display Functions */
+void pwm_display_start(gint, gboolean);
+void pwm_display_stop(void);
+void pwm_display_watch(PidginBuddyList *);
+void pwm_display_unwatch(PidginBuddyList *);
+
+/* Paned Slider Functions */
+void pwm_init_paned_drag(GtkWidget *);
+
+/* Layout State Functions */
+void pwm_state_load(void);
+void pwm_state_unload(void);
+gint pwm_state_get_int(const char *, const char *, gint);
+void pwm_state_set_int(const char *, const char *, gint);
+gchar **pwm_state_get_strv(const char *, const char *);
+void pwm_state_set_strv(const char *, const char *, const gchar * const *,
+                        gsize);
+
+/* Diagnostic Functions */
+void pwm_stats_append(const char *, ...) G_GNUC_PRINTF(1, 2);
+void pwm_latency_start(void);
+void pwm_latency_stop(void);
+void pwm_startup_begin(void);
+void pwm_startup_record(const char *, gint64);
+void pwm_startup_watch(PidginBuddyList *);
+void pwm_startup_finish(void);
+void pwm_startup_end(void);
+void pwm_watchdog_start(gint);
+void pwm_watchdog_stop(void);
+void pwm_watchdog_enter(const char *);
+void pwm_watchdog_leave(void);
+void pwm_record_event(PidginBuddyList *, const char *, gconstpointer);
+gchar *pwm_recorder_dump(void);
+gchar *pwm_census_dump(PidginBuddyList *);
+void pwm_recorder_start(void);
+void pwm_recorder_stop(void);
+void pwm_workload_record(const char *, PurpleConversation *, const char *);
+void pwm_workload_start(void);
+void pwm_workload_stop(void);
+gboolean pwm_workload_replay(const char *);
+void pwm_workload_cancel(void);
 
 /* Utility Functions */
 PidginWindow *pwm_blist_get_convs(PidginBuddyList *);
 PidginBuddyList *pwm_convs_get_blist(PidginWindow *);
+guint pwm_count_real_convs(PidginWindow *);
 void pwm_widget_replace(GtkWidget *, GtkWidget *, GtkWidget *);
+void pwm_widget_swap(GtkWidget *, GtkWidget *);
+gchar *pwm_user_file(const char *);
 
 #define pwm_store(pidgin_window, name, value) \
   g_object_set_data(G_OBJECT((pidgin_window)->window), "pwm_" name, value)
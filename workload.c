@@ -0,0 +1,512 @@
+/**
+ * @file workload.c
+ * Records the events of a user session so they can be replayed identically
+ *
+ * While the PREF_WORKLOAD preference is set, the events that drive the merged
+ * window are written to a trace file: conversations opening and closing, tab
+ * switches, received messages, layout changes, and pane slider drags.  Every
+ * recording gets a new file named after its start time, so no trace is ever
+ * overwritten.  Each line holds the milliseconds since the previous event,
+ * the event name, a conversation number, and a value.  Conversations are
+ * numbered in the order they appear and messages are only recorded by length,
+ * so a trace contains nothing private and can be attached to a bug report.
+ *
+ * A trace chosen by the user is replayed at its recorded pace against the
+ * first connected account.  Nothing is replayed while a trace is recorded,
+ * and nothing is recorded while a trace is replayed, so a replay never reads
+ * a trace that is still being written or records itself.  The trace's
+ * conversations are opened as IMs with made up names and logging turned off.
+ * Its messages are written to them locally without sending or logging
+ * anything, and they are flagged as delayed so notification plugins ignore
+ * them.  The same workload can then be run on different builds (e.g. under
+ * Xvfb) and compared without touching the user's logs.
+ *
+ * @section LICENSE
+ * Copyright (C) 2012 David Michael <fedora.dm0@gmail.com>
+ *
+ * This file is part of Window Merge.
+ *
+ * Window Merge is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * Window Merge is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Window Merge.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "plugin.h"
+
+#include <gtkblist.h>
+#include <gtkconv.h>
+
+#include <account.h>
+#include <connection.h>
+#include <conversation.h>
+#include <prefs.h>
+#include <signals.h>
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "window_merge.h"
+
+/** The first line of a trace file, identifying its format */
+#define WORKLOAD_HEADER "# window_merge workload 1"
+
+
+/**
+ * A single event read from a trace file
+**/
+typedef struct {
+  gint64 time;                  /*< Time since the trace started (msec)      */
+  gchar *event;                 /*< The name of the event                    */
+  gint conv;                    /*< The conversation number, or 0 for none   */
+  gchar *value;                 /*< The event's value                        */
+} PwmWorkloadEvent;
+
+
+/**
+ * The state of the workload recording and replay
+**/
+static struct {
+  FILE *file;                   /*< The trace being recorded                 */
+  gint64 last;                  /*< Monotonic time of the last event (usec)  */
+  gint convs;                   /*< Conversations numbered in the trace      */
+  GArray *events;               /*< The events of the trace being replayed   */
+  guint next;                   /*< The index of the next event to replay    */
+  PurpleAccount *account;       /*< The account replaying conversations      */
+  gint64 start;                 /*< Monotonic time the replay began (usec)   */
+  gint64 lag;                   /*< Total lateness of replayed events (usec) */
+  gint64 worst;                 /*< Highest lateness of an event (usec)      */
+  guint timeout;                /*< The source ID of the next replay event   */
+} workload;
+
+
+/**
+ * Return the number identifying a conversation in the trace being recorded
+ *
+ * @param[in] conv       The conversation to identify
+ * @return               The conversation number, or 0 if conv is NULL
+**/
+static gint
+get_conv_number(PurpleConversation *conv)
+{
+  gint number;                  /*< The number of the conversation           */
+
+  if ( conv == NULL )
+    return 0;
+
+  number = GPOINTER_TO_INT(purple_conversation_get_data(conv, "pwm_number"));
+  if ( number == 0 ) {
+    number = ++workload.convs;
+    purple_conversation_set_data(conv, "pwm_number", GINT_TO_POINTER(number));
+  }
+
+  return number;
+}
+
+
+/**
+ * Write an event to the trace file if a workload is being recorded
+ *
+ * Events caused by a replay are not recorded.
+ *
+ * @param[in] event      The name of the event
+ * @param[in] conv       The conversation involved in the event, if any
+ * @param[in] value      The value of the event, which can't contain spaces
+**/
+void
+pwm_workload_record(const char *event, PurpleConversation *conv,
+                    const char *value)
+{
+  gint64 now;                   /*< Monotonic time of the event (usec)       */
+
+  if ( workload.file == NULL || workload.events != NULL )
+    return;
+
+  now = g_get_monotonic_time();
+  fprintf(workload.file, "%" G_GINT64_FORMAT " %s %d %s\n",
+          (now - workload.last) / 1000, event, get_conv_number(conv),
+          value != NULL && *value != '\0' ? value : "-");
+  workload.last = now;
+}
+
+
+/**
+ * A callback for when a conversation is created or about to be closed
+ *
+ * @param[in] conv       The conversation
+ * @param[in] data       The name of the event to record
+**/
+static void
+conversation_cb(PurpleConversation *conv, gpointer data)
+{
+  pwm_workload_record(data, conv,
+                      purple_conversation_get_type(conv) ==
+                      PURPLE_CONV_TYPE_CHAT ? "chat" : "im");
+}
+
+
+/**
+ * A callback for when a conversation tab is selected
+ *
+ * @param[in] conv       The conversation that was selected
+**/
+static void
+conversation_switched_cb(PurpleConversation *conv)
+{
+  pwm_workload_record("switch", conv, NULL);
+}
+
+
+/**
+ * A callback for when an IM or chat message is received
+ *
+ * @param[in] account    Unused
+ * @param[in] sender     Unused
+ * @param[in] message    The text of the message
+ * @param[in] conv       The conversation receiving the message
+ * @param[in] flags      Unused
+**/
+static void
+received_msg_cb(U PurpleAccount *account, U char *sender, char *message,
+                PurpleConversation *conv, U PurpleMessageFlags flags)
+{
+  char length[16];              /*< The length of the message as text       */
+
+  g_snprintf(length, sizeof(length), "%" G_GSIZE_FORMAT,
+             message != NULL ? strlen(message) : 0);
+  pwm_workload_record("msg", conv, length);
+}
+
+
+/**
+ * A preference callback to record changes to the merged window's layout
+ *
+ * @param[in] name       Unused
+ * @param[in] type       Unused
+ * @param[in] pvalue     The new side of the Buddy List for conversations
+ * @param[in] data       Unused
+**/
+static void
+pref_side_cb(U const char *name, U PurplePrefType type,
+             gconstpointer pvalue, U gpointer data)
+{
+  pwm_workload_record("side", NULL, pvalue);
+}
+
+
+/**
+ * Start recording a workload trace in a new file
+**/
+void
+pwm_workload_start(void)
+{
+  void *conv_handle;            /*< The conversations handle                 */
+  void *gtkconv_handle;         /*< The Pidgin conversations handle          */
+  char stamp[32];               /*< The time the recording started           */
+  gchar *suffix;                /*< The end of the trace file name           */
+  gchar *path;                  /*< The path of the trace file               */
+  time_t now;                   /*< The current time                         */
+
+  /* Sanity check: Don't record two traces at once. */
+  if ( workload.file != NULL )
+    return;
+
+  now = time(NULL);
+  strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+  suffix = g_strdup_printf("-workload-%s.trace", stamp);
+  path = pwm_user_file(suffix);
+  workload.file = g_fopen(path, "w");
+  g_free(path);
+  g_free(suffix);
+
+  /* Give up quietly if the file can't be written, since it's only extra. */
+  if ( workload.file == NULL )
+    return;
+
+  fprintf(workload.file, "%s\n", WORKLOAD_HEADER);
+  workload.last = g_get_monotonic_time();
+  workload.convs = 0;
+
+  conv_handle = purple_conversations_get_handle();
+  gtkconv_handle = pidgin_conversations_get_handle();
+
+  purple_signal_connect(conv_handle, "conversation-created", &workload,
+                        PURPLE_CALLBACK(conversation_cb), "open");
+  purple_signal_connect(conv_handle, "deleting-conversation", &workload,
+                        PURPLE_CALLBACK(conversation_cb), "close");
+  purple_signal_connect(conv_handle, "received-im-msg", &workload,
+                        PURPLE_CALLBACK(received_msg_cb), NULL);
+  purple_signal_connect(conv_handle, "received-chat-msg", &workload,
+                        PURPLE_CALLBACK(received_msg_cb), NULL);
+  purple_signal_connect(gtkconv_handle, "conversation-switched", &workload,
+                        PURPLE_CALLBACK(conversation_switched_cb), NULL);
+  purple_prefs_connect_callback(&workload, PREF_SIDE, pref_side_cb, NULL);
+}
+
+
+/**
+ * Stop recording the workload trace
+ *
+ * @note This must be called before the plugin is unloaded from memory.
+**/
+void
+pwm_workload_stop(void)
+{
+  GList *item;                  /*< A conversation in the list (iteration)   */
+
+  if ( workload.file == NULL )
+    return;
+
+  purple_signals_disconnect_by_handle(&workload);
+  purple_prefs_disconnect_by_handle(&workload);
+
+  /* Forget the conversation numbers so the next trace starts over. */
+  for ( item = purple_get_conversations(); item != NULL; item = item->next )
+    purple_conversation_set_data(item->data, "pwm_number", NULL);
+
+  fclose(workload.file);
+  workload.file = NULL;
+}
+
+
+/**
+ * Free the events of the trace being replayed, and report how it went
+**/
+static void
+finish_replay(void)
+{
+  PwmWorkloadEvent *event;      /*< An event being freed                     */
+  guint i;                      /*< The index of an event (iteration)        */
+
+  if ( workload.events->len > 0 && workload.next > 0 )
+    pwm_stats_append("workload replay n=%u recorded=%" G_GINT64_FORMAT
+                     "ms actual=%" G_GINT64_FORMAT "ms lag avg=%"
+                     G_GINT64_FORMAT "us max=%" G_GINT64_FORMAT "us",
+                     workload.next,
+                     g_array_index(workload.events, PwmWorkloadEvent,
+                                   workload.next - 1).time,
+                     (g_get_monotonic_time() - workload.start) / 1000,
+                     workload.lag / workload.next, workload.worst);
+
+  for ( i = 0; i < workload.events->len; i++ ) {
+    event = &g_array_index(workload.events, PwmWorkloadEvent, i);
+    g_free(event->event);
+    g_free(event->value);
+  }
+  g_array_free(workload.events, TRUE);
+  workload.events = NULL;
+  workload.account = NULL;
+  workload.timeout = 0;
+}
+
+
+/**
+ * Return the conversation standing in for a trace's conversation number
+ *
+ * @param[in] number     The conversation number from the trace
+ * @param[in] create     Whether to open the conversation if it isn't open
+ * @return               The conversation, or NULL if it isn't open
+**/
+static PurpleConversation *
+get_replay_conv(gint number, gboolean create)
+{
+  PurpleConversation *conv;     /*< The stand-in conversation                */
+  gchar *name;                  /*< The made up name of the conversation     */
+
+  name = g_strdup_printf("pwm-replay-%d", number);
+  conv = purple_find_conversation_with_account(PURPLE_CONV_TYPE_IM, name,
+                                               workload.account);
+  if ( conv == NULL && create ) {
+    conv = purple_conversation_new(PURPLE_CONV_TYPE_IM, workload.account,
+                                   name);
+    purple_conversation_set_logging(conv, FALSE);
+  }
+  g_free(name);
+
+  return conv;
+}
+
+
+/**
+ * Reissue a single event from the trace being replayed
+ *
+ * Chats are replayed as IMs, since joining them needs a real server.  Messages
+ * are flagged as delayed, which the Message Notification plugin ignores.
+ *
+ * @param[in] event      The event to replay
+**/
+static void
+replay_event(PwmWorkloadEvent *event)
+{
+  PidginBuddyList *gtkblist;    /*< The Buddy List merged with conversations */
+  PurpleConversation *conv;     /*< The conversation involved in the event   */
+  PidginConversation *gtkconv;  /*< The Pidgin UI of conv                    */
+  GtkWidget *paned;             /*< The merged window's paned widget         */
+  gchar *text;                  /*< Filler text for a replayed message       */
+
+  gtkblist = pidgin_blist_get_default_gtk_blist();
+  conv = event->conv > 0 ?
+         get_replay_conv(event->conv, g_str_equal(event->event, "open")) :
+         NULL;
+  gtkconv = conv != NULL ? PIDGIN_CONVERSATION(conv) : NULL;
+
+  if ( g_str_equal(event->event, "close") && conv != NULL )
+    purple_conversation_destroy(conv);
+  else if ( g_str_equal(event->event, "switch") && gtkconv != NULL )
+    pidgin_conv_window_switch_gtkconv(pidgin_conv_get_window(gtkconv),
+                                      gtkconv);
+  else if ( g_str_equal(event->event, "msg") && conv != NULL ) {
+    text = g_strnfill(MAX(atoi(event->value), 1), 'x');
+    purple_conversation_write(conv, purple_conversation_get_name(conv), text,
+                              PURPLE_MESSAGE_RECV | PURPLE_MESSAGE_DELAYED |
+                              PURPLE_MESSAGE_NO_LOG, time(NULL));
+    g_free(text);
+  }
+  else if ( g_str_equal(event->event, "side") )
+    purple_prefs_set_string(PREF_SIDE, event->value);
+  else if ( g_str_equal(event->event, "pane") && gtkblist != NULL &&
+            (paned = pwm_fetch(gtkblist, "paned")) != NULL )
+    gtk_paned_set_position(GTK_PANED(paned), atoi(event->value));
+}
+
+
+/**
+ * A timeout callback to replay the next event of a trace when it is due
+ *
+ * @param[in] data       Unused
+ * @return               Whether to call this function again
+**/
+static gboolean
+replay_timeout_cb(U gpointer data)
+{
+  PwmWorkloadEvent *event;      /*< The event being replayed                 */
+  gint64 due;                   /*< Monotonic time the event was due (usec)  */
+  gint64 now;                   /*< The current monotonic time (usec)        */
+
+  /* Sanity check: Stop replaying if the account has been deleted. */
+  if ( g_list_find(purple_accounts_get_all(), workload.account) == NULL ) {
+    finish_replay();
+    return FALSE;
+  }
+
+  event = &g_array_index(workload.events, PwmWorkloadEvent, workload.next);
+  due = workload.start + event->time * 1000;
+  now = g_get_monotonic_time();
+  workload.lag += MAX(now - due, 0);
+  workload.worst = MAX(workload.worst, now - due);
+
+  replay_event(event);
+  workload.next++;
+
+  if ( workload.next >= workload.events->len ) {
+    finish_replay();
+    return FALSE;
+  }
+
+  /* Schedule the next event relative to the start, so delays never add up. */
+  event = &g_array_index(workload.events, PwmWorkloadEvent, workload.next);
+  due = workload.start + event->time * 1000;
+  now = g_get_monotonic_time();
+  workload.timeout = g_timeout_add((guint)(MAX(due - now, 0) / 1000),
+                                   replay_timeout_cb, NULL);
+
+  return FALSE;
+}
+
+
+/**
+ * Start replaying a recorded workload trace at its recorded pace
+ *
+ * @param[in] path       The path of the trace file to replay
+ * @return               Whether the trace and a connected account were found
+ *
+ * @note Nothing is replayed while a trace is being recorded.
+**/
+gboolean
+pwm_workload_replay(const char *path)
+{
+  PwmWorkloadEvent event;       /*< An event read from the trace             */
+  GList *connections;           /*< The connected accounts' connections      */
+  gchar **lines;                /*< The lines of the trace file              */
+  gchar **fields;               /*< The fields of a line                     */
+  gchar *contents;              /*< The text of the trace file               */
+  gint64 elapsed = 0;           /*< Time since the trace started (msec)      */
+  guint i;                      /*< The index of a line (iteration)          */
+
+  connections = purple_connections_get_all();
+
+  /* Sanity check: Only replay one trace at a time, with an account online. */
+  if ( workload.events != NULL || workload.file != NULL ||
+       connections == NULL || path == NULL ||
+       !g_file_get_contents(path, &contents, NULL, NULL) )
+    return FALSE;
+
+  /* Sanity check: Only replay traces in the format written above. */
+  if ( !g_str_has_prefix(contents, WORKLOAD_HEADER "\n") ) {
+    g_free(contents);
+    return FALSE;
+  }
+
+  workload.events = g_array_new(FALSE, FALSE, sizeof(PwmWorkloadEvent));
+  lines = g_strsplit(contents, "\n", -1);
+  g_free(contents);
+
+  for ( i = 1; lines[i] != NULL; i++ ) {
+    fields = g_strsplit(lines[i], " ", 4);
+    if ( g_strv_length(fields) == 4 ) {
+      elapsed += g_ascii_strtoll(fields[0], NULL, 10);
+      event.time = elapsed;
+      event.event = g_strdup(fields[1]);
+      event.conv = atoi(fields[2]);
+      event.value = g_strdup(fields[3]);
+      g_array_append_val(workload.events, event);
+    }
+    g_strfreev(fields);
+  }
+  g_strfreev(lines);
+
+  /* Sanity check: Don't bother with empty traces. */
+  if ( workload.events->len == 0 ) {
+    finish_replay();
+    return FALSE;
+  }
+
+  workload.account = purple_connection_get_account(connections->data);
+  workload.next = 0;
+  workload.lag = 0;
+  workload.worst = 0;
+  workload.start = g_get_monotonic_time();
+  workload.timeout = g_timeout_add((guint)g_array_index(workload.events,
+                                                        PwmWorkloadEvent,
+                                                        0).time,
+                                   replay_timeout_cb, NULL);
+
+  return TRUE;
+}
+
+
+/**
+ * Stop replaying a workload trace, and report the events replayed so far
+ *
+ * @note This must be called before the plugin is unloaded from memory.
+**/
+void
+pwm_workload_cancel(void)
+{
+  if ( workload.events == NULL )
+    return;
+
+  g_source_remove(workload.timeout);
+  finish_replay();
+}